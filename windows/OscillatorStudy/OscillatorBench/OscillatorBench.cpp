@@ -0,0 +1,1030 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+//
+// Headless benchmark: answers "how fast does this execute?" for AudioCallback and friends.
+// Kernels are called directly into preallocated buffers, no audio device is ever opened,
+// so this runs fine on build machines without a sound card.
+//
+//   OscillatorBench [--json] [--blocks N] [--only name] [--scaling] [--rt-check] [--drift [hours]] [--check]
+//
+// Linux:
+//   g++ -O2 -std=c++14 -pthread -I../OscillatorStudy $(sdl2-config --cflags) -o OscillatorBench
+//       OscillatorBench.cpp $(ls ../OscillatorStudy/*.cpp | grep -v /OscillatorStudy.cpp) $(sdl2-config --libs)
+//
+// As a gate against allocating, freeing or locking on the audio path, build the same way with
+// `-DREALTIME_GUARD -rdynamic ... -ldl` and run `OscillatorBench --rt-check`: every case runs
+// as usual, then any call that happened inside a RealtimeScope is listed by call site and the
+// exit code is 1 (0 when clean, 2 when the guard isn't built in).
+//
+// `--drift` checks phase accuracy instead of speed: a day (or `hours`) of rendering, compared
+// against the exact phase. Takes a minute or so; exits 1 if the engine's oscillator is off.
+//
+// `--check` renders cases that have gone wrong before and checks the output instead of timing
+// it; exits 1 if any fails.
+
+#include "SDL.h"
+#undef main
+
+#include "AudioEngine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <memory>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+
+// same block the real device is opened with in OscillatorStudy's main()
+static const int kBlockFrames = 1024;
+static const int kSampleRate = 44100;
+static const double kDeadlineNs = 1e9 * kBlockFrames / kSampleRate; // ~23.2 ms
+
+struct BenchCase
+{
+    const char* name;
+    void* (*create)();                                  // builds whatever the kernel renders from
+    void (*render)(void* state, float* out, int frames);
+    void (*destroy)(void* state);
+};
+
+static AudioEngine* newEngine()
+{
+    AudioEngine* engine = new AudioEngine;
+    engine->oscillator.frequency = 440.f;
+    engine->oscillator.amplitude = 1.f;
+    engine->oscillator.phase = 0;
+    engine->oscillator.waveform = WaveSine;
+    engine->profiler.configure(kSampleRate);
+    return engine;
+}
+
+// benches measure the work, so they wait out a late worker instead of dropping its share
+static void startBenchWorkers(WorkerPool& pool, int count)
+{
+    StartWorkers(pool, count, (double)kBlockFrames / kSampleRate);
+    pool.waitTicks = 0;
+}
+
+// one case per sine kernel variant, 440 Hz; variants the CPU can't run are skipped
+struct SineBench
+{
+    const SineKernel* kernel;
+    Phase phase;
+};
+
+template <int Variant>
+static void* createSineBench()
+{
+    if (sineKernels[Variant].level > DetectSimdLevel()) return nullptr;
+    SineBench* bench = new SineBench;
+    bench->kernel = &sineKernels[Variant];
+    bench->phase = 0;
+    return bench;
+}
+
+static void renderSineBench(void* state, float* out, int frames)
+{
+    SineBench* bench = reinterpret_cast<SineBench*>(state);
+    bench->phase = bench->kernel->render(out, frames, bench->phase, ToPhaseRamp(ConstantRamp(440.f / kSampleRate)), ConstantRamp(1.f));
+}
+
+// the same kernels while both frequency and amplitude ramp, as they do for a block after a change
+static void renderRampedSineBench(void* state, float* out, int frames)
+{
+    SineBench* bench = reinterpret_cast<SineBench*>(state);
+    Ramp increment = { 440.f / kSampleRate, 440.f / kSampleRate / frames };
+    Ramp amplitude = { 1.f, -0.5f / frames };
+    bench->phase = bench->kernel->render(out, frames, bench->phase, ToPhaseRamp(increment), amplitude);
+}
+
+static void destroySineBench(void* state) { delete reinterpret_cast<SineBench*>(state); }
+
+// band-limited 440 Hz saw, from the mip-mapped tables...
+struct WavetableBench
+{
+    const WavetableKernel* kernel;
+    const Wavetable* table;
+    Phase phase;
+};
+
+template <int Variant>
+static void* createWavetableBench()
+{
+    if (wavetableKernels[Variant].level > DetectSimdLevel()) return nullptr;
+    WavetableBench* bench = new WavetableBench;
+    bench->kernel = &wavetableKernels[Variant];
+    bench->table = &GetWavetable(WaveSaw);
+    bench->phase = 0;
+    return bench;
+}
+
+static void renderWavetableBench(void* state, float* out, int frames)
+{
+    WavetableBench* bench = reinterpret_cast<WavetableBench*>(state);
+    bench->phase = bench->kernel->render(*bench->table, out, frames, bench->phase, ToPhaseRamp(ConstantRamp(440.f / kSampleRate)), ConstantRamp(1.f));
+}
+
+static void destroyWavetableBench(void* state) { delete reinterpret_cast<WavetableBench*>(state); }
+
+// ...the PolyBLEP shapes, no tables at all...
+struct BlepBench
+{
+    const BlepKernel* kernel;
+    Phase phase;
+};
+
+template <int Variant>
+static void* createBlepBench()
+{
+    if (blepKernels[Variant].level > DetectSimdLevel()) return nullptr;
+    BlepBench* bench = new BlepBench;
+    bench->kernel = &blepKernels[Variant];
+    bench->phase = 0;
+    return bench;
+}
+
+template <BlepShape Shape>
+static void renderBlepBench(void* state, float* out, int frames)
+{
+    BlepBench* bench = reinterpret_cast<BlepBench*>(state);
+    bench->phase = bench->kernel->render(Shape, 0.3f, out, frames, bench->phase, ToPhaseRamp(ConstantRamp(440.f / kSampleRate)), ConstantRamp(1.f));
+}
+
+static void destroyBlepBench(void* state) { delete reinterpret_cast<BlepBench*>(state); }
+
+// ...and the same saw summed partial by partial with the fastest sine kernel
+struct AdditiveSawBench
+{
+    Phase phases[64];
+    float scratch[kBlockFrames];
+};
+
+static void renderAdditiveSawBench(void* state, float* out, int frames)
+{
+    AdditiveSawBench* bench = reinterpret_cast<AdditiveSawBench*>(state);
+    SineKernelFn sine = SelectSineKernel().render;
+    memset(out, 0, frames * sizeof(float));
+    for (int k = 1; k * 440.f < kSampleRate / 2; ++k)
+    {
+        bench->phases[k] = sine(bench->scratch, frames, bench->phases[k], ToPhaseRamp(ConstantRamp(k * 440.f / kSampleRate)), ConstantRamp(0.6366f / k));
+        for (int i = 0; i < frames; ++i) out[i] += bench->scratch[i];
+    }
+}
+
+// 256 voices spread over a few octaves, straight through each voice kernel
+template <int Variant>
+static void* createVoiceBench()
+{
+    if (voiceKernels[Variant].level > DetectSimdLevel()) return nullptr;
+    AudioEngine* engine = newEngine(); // for its aligned allocation
+    for (int v = 0; v < kMaxVoices; ++v) engine->voices.noteOn(v, (110.f + 7.f * v) / kSampleRate, 1.f / kMaxVoices);
+    return engine;
+}
+
+template <int Variant>
+static void renderVoiceBench(void* state, float* out, int frames)
+{
+    VoicePool& pool = reinterpret_cast<AudioEngine*>(state)->voices;
+    memset(out, 0, frames * sizeof(float));
+    voiceKernels[Variant].render(pool, 0, pool.renderCount(), out, frames);
+}
+
+static void destroyEngine(void* state) { delete reinterpret_cast<AudioEngine*>(state); }
+
+// the same 256 voices split across the worker pool and this thread (needs 2+ cores)
+static void* createParallelVoiceBench()
+{
+    if (SDL_GetCPUCount() < 2) return nullptr;
+    AudioEngine* engine = newEngine(); // with the best voice kernel
+    for (int v = 0; v < kMaxVoices; ++v) engine->voices.noteOn(v, (110.f + 7.f * v) / kSampleRate, 1.f / kMaxVoices);
+    startBenchWorkers(engine->workers, SDL_GetCPUCount() - 1);
+    return engine;
+}
+
+static void renderParallelVoiceBench(void* state, float* out, int frames)
+{
+    memset(out, 0, frames * sizeof(float));
+    RenderVoices(*reinterpret_cast<AudioEngine*>(state), out, frames);
+}
+
+static void destroyParallelVoiceBench(void* state)
+{
+    StopWorkers(reinterpret_cast<AudioEngine*>(state)->workers);
+    destroyEngine(state);
+}
+
+// one noise stream per kernel and color, seeded the same every run
+struct NoiseBench
+{
+    const NoiseKernel* kernel;
+    NoiseState state;
+};
+
+template <int Variant>
+static void* createNoiseBench()
+{
+    if (noiseKernels[Variant].level > DetectSimdLevel()) return nullptr;
+    NoiseBench* bench = new NoiseBench;
+    bench->kernel = &noiseKernels[Variant];
+    SeedNoise(bench->state, 1);
+    return bench;
+}
+
+template <NoiseColor Color>
+static void renderNoiseBench(void* state, float* out, int frames)
+{
+    NoiseBench* bench = reinterpret_cast<NoiseBench*>(state);
+    bench->kernel->render(Color, bench->state, out, frames, ConstantRamp(1.f));
+}
+
+static void destroyNoiseBench(void* state) { delete reinterpret_cast<NoiseBench*>(state); }
+
+// the template oscillators against the same variant in the one generic loop; stereo renders
+// half the frames, so every case writes a block's worth of samples
+static const OscillatorVariant benchVariants[] =
+{
+    { ShapeSine, InterpolateNone, 1, false },
+    { ShapeSine, InterpolateNone, 1, true },
+    { ShapeTable, InterpolateLinear, 2, true },
+    { ShapeTable, InterpolateCubic, 1, true },
+};
+
+struct VariantBench
+{
+    OscillatorVariant variant;
+    Phase phase;
+    float modulation[kBlockFrames];     // a slow sine, as from another oscillator
+};
+
+template <int Variant>
+static void* createVariantBench()
+{
+    VariantBench* bench = new VariantBench;
+    bench->variant = benchVariants[Variant];
+    bench->phase = 0;
+    for (int i = 0; i < kBlockFrames; ++i) bench->modulation[i] = sinf(6.2831853f * 3.f * i / kBlockFrames);
+    return bench;
+}
+
+template <bool Generic>
+static void renderVariantBench(void* state, float* out, int frames)
+{
+    VariantBench* bench = reinterpret_cast<VariantBench*>(state);
+    OscillatorBlock block = { &GetWavetable(WaveSaw), out, frames / bench->variant.channels, bench->phase,
+        ToPhaseRamp(ConstantRamp(440.f / kSampleRate)), ConstantRamp(1.f), bench->modulation, 0.3f, 0.25f };
+    bench->phase = Generic ? RenderOscillatorGeneric(bench->variant, block) : SelectOscillator(bench->variant)(block);
+}
+
+static void destroyVariantBench(void* state) { delete reinterpret_cast<VariantBench*>(state); }
+
+// a cloud of 10000 grains a second, 0.1 s each, so ~1000 playing at once, through one grain
+// kernel; run for a moment first so the pool is at that level when timing starts
+struct GrainBench
+{
+    const GrainKernel* kernel;
+    vector<float> source;
+    unique_ptr<GrainCloud> cloud;
+};
+
+template <int Variant>
+static void* createGrainBench()
+{
+    if (grainKernels[Variant].level > DetectSimdLevel()) return nullptr;
+    GrainBench* bench = new GrainBench;
+    bench->kernel = &grainKernels[Variant];
+    bench->source.resize(2 * kSampleRate);
+    for (size_t i = 0; i < bench->source.size(); ++i) bench->source[i] = sinf(0.03f * i) * (0.5f + 0.5f * sinf(0.0001f * i));
+    bench->cloud = make_unique<GrainCloud>();
+    GrainCloud& cloud = *bench->cloud;
+    cloud.source = bench->source.data();
+    cloud.sourceLength = (int)bench->source.size();
+    cloud.sampleRate = (float)kSampleRate;
+    cloud.settings.density = 10000.f;
+    cloud.settings.seconds = 0.1f;
+    cloud.settings.spray = 0.5f;
+    cloud.settings.detune = 12.f;
+    cloud.settings.gain = 0.01f;
+    vector<float> warmup(kBlockFrames);
+    for (int i = 0; i < 8; ++i) RenderGrains(cloud, bench->kernel->render, warmup.data(), kBlockFrames);
+    return bench;
+}
+
+static void renderGrainBench(void* state, float* out, int frames)
+{
+    GrainBench* bench = reinterpret_cast<GrainBench*>(state);
+    memset(out, 0, frames * sizeof(float));
+    RenderGrains(*bench->cloud, bench->kernel->render, out, frames);
+}
+
+static void destroyGrainBench(void* state) { delete reinterpret_cast<GrainBench*>(state); }
+
+// 256 strings or tubes from 55 to 440 Hz through one waveguide kernel; the strings' loop gain
+// is set to 1 so none of them rings out and retires while it's being timed
+struct WaveguideBench
+{
+    const WaveguideKernel* kernel;
+    unique_ptr<WaveguideVoices> voices;
+};
+
+template <int Variant>
+static void* createWaveguideBench()
+{
+    const WaveguideKernel& kernel = waveguideKernels[Variant];
+    if (kernel.level > DetectSimdLevel()) return nullptr;
+    WaveguideBench* bench = new WaveguideBench;
+    bench->kernel = &kernel;
+    bench->voices = make_unique<WaveguideVoices>(kernel.model, (float)kSampleRate);
+    for (int v = 0; v < kMaxWaveguideVoices; ++v)
+    {
+        int slot = bench->voices->noteOn(v, 55.0 * pow(2.0, 3.0 * v / kMaxWaveguideVoices) / kSampleRate, 0.01f);
+        bench->voices->loopGains[slot] = 1.f;
+    }
+    return bench;
+}
+
+static void renderWaveguideBench(void* state, float* out, int frames)
+{
+    WaveguideBench* bench = reinterpret_cast<WaveguideBench*>(state);
+    memset(out, 0, frames * sizeof(float));
+    RenderWaveguides(*bench->voices, bench->kernel->render, out, frames);
+}
+
+static void destroyWaveguideBench(void* state) { delete reinterpret_cast<WaveguideBench*>(state); }
+
+// 64 interleaved channels of noise through one filter kernel, each channel at its own cutoff
+// and resonance; `Sweep` moves every channel's cutoff each block, so coefficients are
+// recomputed and ramped every time
+static const int kBenchFilterChannels = 64;
+
+struct FilterBench
+{
+    const FilterKernel* kernel;
+    unique_ptr<FilterBank> bank;
+    vector<float> in;
+    vector<float> out;
+    int block = 0;
+};
+
+static FilterSettings benchFilterSettings(int channel, int block)
+{
+    FilterSettings settings;
+    settings.response = (FilterResponse)(channel % 4);
+    settings.cutoff = 100.f * powf(2.f, 7.f * (0.5f + 0.5f * sinf(0.05f * block + 0.1f * channel)));
+    settings.q = 0.5f + 0.125f * channel;
+    return settings;
+}
+
+template <int Variant>
+static void* createFilterBench()
+{
+    const FilterKernel& kernel = filterKernels[Variant];
+    if (kernel.level > DetectSimdLevel()) return nullptr;
+    FilterBench* bench = new FilterBench;
+    bench->kernel = &kernel;
+    bench->bank = make_unique<FilterBank>(kernel.structure, kBenchFilterChannels, (float)kSampleRate);
+    for (int c = 0; c < kBenchFilterChannels; ++c) SetFilter(*bench->bank, c, benchFilterSettings(c, 0));
+    bench->in.resize(kBenchFilterChannels * kBlockFrames);
+    bench->out.resize(kBenchFilterChannels * kBlockFrames);
+    for (size_t i = 0; i < bench->in.size(); ++i) bench->in[i] = (float)rand() / RAND_MAX - 0.5f;
+    return bench;
+}
+
+template <bool Sweep>
+static void renderFilterBench(void* state, float* out, int frames)
+{
+    FilterBench* bench = reinterpret_cast<FilterBench*>(state);
+    if (Sweep)
+    {
+        ++bench->block;
+        for (int c = 0; c < kBenchFilterChannels; ++c) SetFilter(*bench->bank, c, benchFilterSettings(c, bench->block));
+    }
+    RenderFilters(*bench->bank, bench->kernel->render, bench->in.data(), bench->out.data(), frames);
+    for (int i = 0; i < frames; ++i) out[i] = bench->out[i * kBenchFilterChannels];
+}
+
+static void destroyFilterBench(void* state) { delete reinterpret_cast<FilterBench*>(state); }
+
+// 128 FM voices of 6 operators through one FM kernel, on the first preset it can run (the
+// "any" kernels get the electric piano, to compare with its own specialization)
+template <int Variant>
+static void* createFmBench()
+{
+    if (fmKernels[Variant].level > DetectSimdLevel()) return nullptr;
+    static const FmPreset presets[] = { FmThreePairs, FmStack, FmTwoStacks, FmOneToThree, FmOrgan };
+    AudioEngine* engine = newEngine();
+    for (FmPreset preset : presets)
+    {
+        SetFmPatch(engine->fm, MakeFmPatch(preset), (float)kSampleRate);
+        if ((fmKernels[Variant].routing & engine->fm.algorithm.routing) == engine->fm.algorithm.routing) break;
+    }
+    engine->fm.algorithm.render = fmKernels[Variant].render;
+    for (int v = 0; v < kMaxFmVoices; ++v) engine->fm.noteOn(v, (55.0 + 3.1 * v) / kSampleRate, 1.f / kMaxFmVoices);
+    return engine;
+}
+
+static void renderFmBench(void* state, float* out, int frames)
+{
+    memset(out, 0, frames * sizeof(float));
+    RenderFm(*reinterpret_cast<AudioEngine*>(state), out, frames);
+}
+
+// 50k partials, 20 Hz to 20 kHz, all below Nyquist so none get culled; every block a
+// sixteenth of them glide somewhere new, so the envelopes and w updates are in the timing
+static const int kBenchPartials = 50000;
+
+struct AdditiveBench
+{
+    AudioEngine* engine;    // its pool, for the parallel case
+    AdditiveBank* bank;
+    AdditiveKernelFn kernel;
+    int block;
+    double increments[kBenchPartials];  // where each partial started
+};
+
+static AdditiveBench* newAdditiveBench(AdditiveKernelFn kernel)
+{
+    AdditiveBench* bench = new AdditiveBench;
+    bench->engine = newEngine();
+    bench->bank = new AdditiveBank;
+    bench->kernel = kernel;
+    bench->block = 0;
+    srand(1);
+    for (int p = 0; p < kBenchPartials; ++p)
+    {
+        StartPartial(*bench->bank, p, (float)rand() / RAND_MAX);
+        bench->increments[p] = 20.0 * pow(1000.0, (double)p / kBenchPartials) / kSampleRate;
+        SetPartial(*bench->bank, p, bench->increments[p], 1.f / kBenchPartials, 1.f);
+    }
+    return bench;
+}
+
+template <int Variant>
+static void* createAdditiveBench()
+{
+    if (additiveKernels[Variant].level > DetectSimdLevel()) return nullptr;
+    return newAdditiveBench(additiveKernels[Variant].render);
+}
+
+// the whole bank split across the worker pool and this thread (needs 2+ cores)
+static void* createParallelAdditiveBench()
+{
+    if (SDL_GetCPUCount() < 2) return nullptr;
+    AdditiveBench* bench = newAdditiveBench(SelectAdditiveKernel().render);
+    startBenchWorkers(bench->engine->workers, SDL_GetCPUCount() - 1);
+    return bench;
+}
+
+static void renderAdditiveBench(void* state, float* out, int frames)
+{
+    AdditiveBench* bench = reinterpret_cast<AdditiveBench*>(state);
+    static const double kIntervals[] = { 0.8909, 0.9439, 1.0, 1.0595, 1.1225 }; // -2 .. +2 semitones
+    int block = bench->block++;
+    for (int p = block % 16; p < kBenchPartials; p += 16)
+        SetPartial(*bench->bank, p, bench->increments[p] * kIntervals[(block / 16 + p) % 5], (1 + block % 3) * 0.5f / kBenchPartials, (float)frames);
+    memset(out, 0, frames * sizeof(float));
+    RenderAdditive(*bench->bank, bench->kernel, &bench->engine->workers, out, frames);
+}
+
+static void destroyAdditiveBench(void* state)
+{
+    AdditiveBench* bench = reinterpret_cast<AdditiveBench*>(state);
+    StopWorkers(bench->engine->workers);
+    delete bench->bank;
+    destroyEngine(bench->engine);
+    delete bench;
+}
+
+// the 50k partials and then the 256 voices in the same block, two jobs back to back on one
+// pool, as a graph with both engine nodes runs them (needs 2+ cores)
+static void* createVoicesAndPartialsBench()
+{
+    AdditiveBench* bench = reinterpret_cast<AdditiveBench*>(createParallelAdditiveBench());
+    if (!bench) return nullptr;
+    for (int v = 0; v < kMaxVoices; ++v) bench->engine->voices.noteOn(v, (110.f + 7.f * v) / kSampleRate, 1.f / kMaxVoices);
+    return bench;
+}
+
+static void renderVoicesAndPartialsBench(void* state, float* out, int frames)
+{
+    renderAdditiveBench(state, out, frames);
+    RenderVoices(*reinterpret_cast<AdditiveBench*>(state)->engine, out, frames);
+}
+
+// the default graph main() builds, with the lowpass switched in, through the callback
+static void* createGraphBench()
+{
+    AudioEngine* engine = newEngine();
+    ProcessGraph graph;
+    int mixer = graph.add(NodeMixer);
+    graph.connect(graph.add(NodeEngineOscillator), mixer);
+    graph.connect(graph.add(NodeEngineVoices), mixer);
+    int lowpass = graph.addLowpass(2000.f);
+    graph.connect(mixer, lowpass);
+    graph.connect(lowpass, graph.add(NodeOutput));
+    SubmitGraph(engine->graph, CompileGraph(graph, (float)kSampleRate));
+    return engine;
+}
+
+// --scaling: a few hundred nodes in 128 independent branches of uneven weight (an oscillator,
+// then one to four lowpasses), all mixed to the output, on 1 .. N threads
+static int scalingThreads = 0;     // 0: the serial, buffer-sharing compile
+static int scalingNodes = 0;
+
+static void* createScalingBench()
+{
+    ProcessGraph graph;
+    int mixer = graph.add(NodeMixer);
+    graph.connect(mixer, graph.add(NodeOutput));
+    for (int b = 0; b < 128; ++b)
+    {
+        int node = graph.addOscillator(55.f * (1 + b % 24), 1.f, b & 1 ? WaveSaw : WaveSine);
+        for (int f = 0; f <= b % 4; ++f)
+        {
+            int lowpass = graph.addLowpass(500.f + 100.f * f);
+            graph.connect(node, lowpass);
+            node = lowpass;
+        }
+        graph.connect(node, mixer, 1.f / 128);
+    }
+    scalingNodes = (int)graph.nodes.size();
+
+    AudioEngine* engine = newEngine();
+    SubmitGraph(engine->graph, CompileGraph(graph, (float)kSampleRate, scalingThreads > 0));
+    if (scalingThreads > 1) startBenchWorkers(engine->workers, scalingThreads - 1);
+    return engine;
+}
+
+// a lowpass ringing out in the denormal range, which is what any filter tail ends up doing
+// once its input goes quiet: with and without FTZ/DAZ
+static void* createDenormalBench()
+{
+    AudioEngine* engine = newEngine();
+    ProcessGraph graph;
+    int lowpass = graph.addLowpass(20.f);
+    graph.connect(graph.addOscillator(440.f, 0.f, WaveSine), lowpass);
+    graph.connect(lowpass, graph.add(NodeOutput));
+    SubmitGraph(engine->graph, CompileGraph(graph, (float)kSampleRate));
+    AcquireGraph(engine->graph);
+    return engine;
+}
+
+template <bool Flush>
+static void renderDenormalBench(void* state, float* out, int frames)
+{
+    CompiledGraph& graph = *reinterpret_cast<AudioEngine*>(state)->graph.current;
+    graph.steps[1].z = 1e-39f;  // the lowpass, already denormal
+    FlushDenormals(Flush);
+    RunGraph(graph, *reinterpret_cast<AudioEngine*>(state), out, frames);
+    FlushDenormals(false);
+}
+
+static BenchCase benchCases[] =
+{
+    {
+        "AudioCallback",
+        []() -> void* { return newEngine(); },
+        [](void* state, float* out, int frames) { AudioCallback(state, reinterpret_cast<Uint8*>(out), frames * (int)sizeof(float)); },
+        [](void* state) { delete reinterpret_cast<AudioEngine*>(state); },
+    },
+    {
+        "AudioCallback+graph",
+        createGraphBench,
+        [](void* state, float* out, int frames) { AudioCallback(state, reinterpret_cast<Uint8*>(out), frames * (int)sizeof(float)); },
+        destroyEngine,
+    },
+    {
+        // what's left for the device's thread when a render thread works ahead of it (the
+        // blocks come faster than real time here, so some of them are underruns)
+        "AudioCallback+renderahead",
+        []() -> void*
+        {
+            AudioEngine* engine = newEngine();
+            StartRenderAhead(*engine, kBlockFrames, 2 * kBlockFrames);
+            return engine;
+        },
+        [](void* state, float* out, int frames) { AudioCallback(state, reinterpret_cast<Uint8*>(out), frames * (int)sizeof(float)); },
+        [](void* state)
+        {
+            StopRenderAhead(*reinterpret_cast<AudioEngine*>(state));
+            delete reinterpret_cast<AudioEngine*>(state);
+        },
+    },
+    {
+        // 256 sample-accurate parameter changes per block (~11k per second) through the queue
+        "AudioCallback+256params",
+        []() -> void* { return newEngine(); },
+        [](void* state, float* out, int frames)
+        {
+            AudioEngine* engine = reinterpret_cast<AudioEngine*>(state);
+            Uint64 now = engine->sampleClock.load();
+            for (int i = 0; i < 256; ++i) SetParameter(*engine, ParamAmplitude, (i & 1) ? 1.f : 0.5f, now + i * (frames / 256));
+            AudioCallback(state, reinterpret_cast<Uint8*>(out), frames * (int)sizeof(float));
+        },
+        [](void* state) { delete reinterpret_cast<AudioEngine*>(state); },
+    },
+    {
+        // what the always-on instrumentation costs on its own
+        "CallbackProfiler",
+        []() -> void* { return newEngine(); },
+        [](void* state, float*, int frames)
+        {
+            CallbackProfiler& profiler = reinterpret_cast<AudioEngine*>(state)->profiler;
+            profiler.begin();
+            profiler.end(frames);
+        },
+        [](void* state) { delete reinterpret_cast<AudioEngine*>(state); },
+    },
+    { "sine/sinf", createSineBench<0>, renderSineBench, destroySineBench },
+    { "sine/poly", createSineBench<1>, renderSineBench, destroySineBench },
+    { "sine/poly-sse2", createSineBench<2>, renderSineBench, destroySineBench },
+    { "sine/poly-avx", createSineBench<3>, renderSineBench, destroySineBench },
+    { "sine/poly-avx2", createSineBench<4>, renderSineBench, destroySineBench },
+    { "sine/poly-sse2+ramps", createSineBench<2>, renderRampedSineBench, destroySineBench },
+    { "sine/poly-avx2+ramps", createSineBench<4>, renderRampedSineBench, destroySineBench },
+    { "saw/wavetable", createWavetableBench<0>, renderWavetableBench, destroyWavetableBench },
+    { "saw/wavetable-avx2", createWavetableBench<1>, renderWavetableBench, destroyWavetableBench },
+    { "saw/polyblep", createBlepBench<0>, renderBlepBench<BlepSaw>, destroyBlepBench },
+    { "saw/polyblep-sse2", createBlepBench<1>, renderBlepBench<BlepSaw>, destroyBlepBench },
+    { "saw/polyblep-avx2", createBlepBench<2>, renderBlepBench<BlepSaw>, destroyBlepBench },
+    { "pulse/polyblep-sse2", createBlepBench<1>, renderBlepBench<BlepPulse>, destroyBlepBench },
+    { "pulse/polyblep-avx2", createBlepBench<2>, renderBlepBench<BlepPulse>, destroyBlepBench },
+    { "triangle/polyblamp-sse2", createBlepBench<1>, renderBlepBench<BlepTriangle>, destroyBlepBench },
+    { "triangle/polyblamp-avx2", createBlepBench<2>, renderBlepBench<BlepTriangle>, destroyBlepBench },
+    { "voices256/scalar", createVoiceBench<0>, renderVoiceBench<0>, destroyEngine },
+    { "voices256/sse2", createVoiceBench<1>, renderVoiceBench<1>, destroyEngine },
+    { "voices256/avx2", createVoiceBench<2>, renderVoiceBench<2>, destroyEngine },
+    { "voices256/parallel", createParallelVoiceBench, renderParallelVoiceBench, destroyParallelVoiceBench },
+    { "noise/white", createNoiseBench<0>, renderNoiseBench<NoiseWhite>, destroyNoiseBench },
+    { "noise/white-sse2", createNoiseBench<1>, renderNoiseBench<NoiseWhite>, destroyNoiseBench },
+    { "noise/white-avx2", createNoiseBench<2>, renderNoiseBench<NoiseWhite>, destroyNoiseBench },
+    { "noise/pink", createNoiseBench<0>, renderNoiseBench<NoisePink>, destroyNoiseBench },
+    { "noise/pink-sse2", createNoiseBench<1>, renderNoiseBench<NoisePink>, destroyNoiseBench },
+    { "noise/pink-avx2", createNoiseBench<2>, renderNoiseBench<NoisePink>, destroyNoiseBench },
+    { "noise/brown", createNoiseBench<0>, renderNoiseBench<NoiseBrown>, destroyNoiseBench },
+    { "noise/brown-sse2", createNoiseBench<1>, renderNoiseBench<NoiseBrown>, destroyNoiseBench },
+    { "noise/brown-avx2", createNoiseBench<2>, renderNoiseBench<NoiseBrown>, destroyNoiseBench },
+    { "variants/sine", createVariantBench<0>, renderVariantBench<false>, destroyVariantBench },
+    { "variants/sine-generic", createVariantBench<0>, renderVariantBench<true>, destroyVariantBench },
+    { "variants/pm", createVariantBench<1>, renderVariantBench<false>, destroyVariantBench },
+    { "variants/pm-generic", createVariantBench<1>, renderVariantBench<true>, destroyVariantBench },
+    { "variants/stereo", createVariantBench<2>, renderVariantBench<false>, destroyVariantBench },
+    { "variants/stereo-generic", createVariantBench<2>, renderVariantBench<true>, destroyVariantBench },
+    { "variants/cubic", createVariantBench<3>, renderVariantBench<false>, destroyVariantBench },
+    { "variants/cubic-generic", createVariantBench<3>, renderVariantBench<true>, destroyVariantBench },
+    { "grains1000/scalar", createGrainBench<0>, renderGrainBench, destroyGrainBench },
+    { "grains1000/sse2", createGrainBench<1>, renderGrainBench, destroyGrainBench },
+    { "grains1000/avx2", createGrainBench<2>, renderGrainBench, destroyGrainBench },
+    { "strings256/scalar", createWaveguideBench<0>, renderWaveguideBench, destroyWaveguideBench },
+    { "strings256/sse2", createWaveguideBench<1>, renderWaveguideBench, destroyWaveguideBench },
+    { "strings256/avx2", createWaveguideBench<2>, renderWaveguideBench, destroyWaveguideBench },
+    { "tubes256/scalar", createWaveguideBench<3>, renderWaveguideBench, destroyWaveguideBench },
+    { "tubes256/sse2", createWaveguideBench<4>, renderWaveguideBench, destroyWaveguideBench },
+    { "tubes256/avx2", createWaveguideBench<5>, renderWaveguideBench, destroyWaveguideBench },
+    { "svf64/scalar", createFilterBench<0>, renderFilterBench<false>, destroyFilterBench },
+    { "svf64/sse2", createFilterBench<1>, renderFilterBench<false>, destroyFilterBench },
+    { "svf64/avx2", createFilterBench<2>, renderFilterBench<false>, destroyFilterBench },
+    { "svf64/sweep-avx2", createFilterBench<2>, renderFilterBench<true>, destroyFilterBench },
+    { "biquad64/scalar", createFilterBench<3>, renderFilterBench<false>, destroyFilterBench },
+    { "biquad64/sse2", createFilterBench<4>, renderFilterBench<false>, destroyFilterBench },
+    { "biquad64/avx2", createFilterBench<5>, renderFilterBench<false>, destroyFilterBench },
+    { "biquad64/sweep-avx2", createFilterBench<5>, renderFilterBench<true>, destroyFilterBench },
+    { "fm128x6/scalar", createFmBench<0>, renderFmBench, destroyEngine },
+    { "fm128x6/any-sse2", createFmBench<1>, renderFmBench, destroyEngine },
+    { "fm128x6/any-avx2", createFmBench<2>, renderFmBench, destroyEngine },
+    { "fm128x6/stack-avx2", createFmBench<4>, renderFmBench, destroyEngine },
+    { "fm128x6/epiano-sse2", createFmBench<7>, renderFmBench, destroyEngine },
+    { "fm128x6/epiano-avx2", createFmBench<8>, renderFmBench, destroyEngine },
+    { "fm128x6/organ-avx2", createFmBench<12>, renderFmBench, destroyEngine },
+    { "partials50k/sse2", createAdditiveBench<1>, renderAdditiveBench, destroyAdditiveBench },
+    { "partials50k/avx2", createAdditiveBench<2>, renderAdditiveBench, destroyAdditiveBench },
+    { "partials50k/parallel", createParallelAdditiveBench, renderAdditiveBench, destroyAdditiveBench },
+    { "voices+partials/parallel", createVoicesAndPartialsBench, renderVoicesAndPartialsBench, destroyAdditiveBench },
+    { "lowpass/denormal", createDenormalBench, renderDenormalBench<false>, destroyEngine },
+    { "lowpass/denormal+ftz", createDenormalBench, renderDenormalBench<true>, destroyEngine },
+    {
+        "saw/additive",
+        []() -> void* { return new AdditiveSawBench(); },
+        renderAdditiveSawBench,
+        [](void* state) { delete reinterpret_cast<AdditiveSawBench*>(state); },
+    },
+};
+
+// --drift: the engine's oscillator rendered block after block for `hours`, exactly as the
+// callback would, next to the float accumulator (phase += increment, wrap when >= 0.5) that
+// phase used to be. Both against the exact phase, frames * frequency / rate, in long double.
+// Integer steps with the fraction carried per block should land within the float reading of
+// the final phase (2^-25 cycles) however long it runs.
+static int runDrift(double hours)
+{
+    static const float frequencies[] = { 27.5f, 440.f, 1000.f, 4186.01f };
+    Uint64 blocks = (Uint64)(hours * 3600.0 * kSampleRate / kBlockFrames);
+    Uint64 frames = blocks * kBlockFrames;
+    printf("%.1f hours (%llu frames) @ %d Hz, phase error in cycles\n\n", hours, (unsigned long long)frames, kSampleRate);
+    printf("%-10s %14s %14s %14s\n", "frequency", "uint32", "float", "float (ms)");
+
+    bool ok = true;
+    vector<float> buffer(kBlockFrames);
+    for (float frequency : frequencies)
+    {
+        AudioEngine* engine = newEngine();
+        engine->oscillator.frequency = frequency;
+        for (Uint64 b = 0; b < blocks; ++b) RenderOscillator(*engine, buffer.data(), kBlockFrames);
+        Phase fixed = engine->oscillator.phase;
+        delete engine;
+
+        float phase = 0.f;
+        float increment = frequency / kSampleRate;
+        Uint64 wraps = 0;   // so an error of whole cycles shows too
+        for (Uint64 i = 0; i < frames; ++i)
+        {
+            phase += increment;
+            if (phase >= 0.5f)
+            {
+                phase -= 1.f;
+                ++wraps;
+            }
+        }
+
+        long double cycles = (long double)frames * frequency / kSampleRate;
+        double exact = (double)(cycles - floorl(cycles));
+        double fixedError = PhaseToCycles(fixed) - exact;
+        double floatError = (double)((long double)wraps + phase - cycles);
+        fixedError -= floor(fixedError + 0.5);
+        if (fabs(fixedError) > 1e-6) ok = false;
+        printf("%-10.2f %14.3e %14.3e %14.3f\n", frequency, fixedError, floatError, 1000.0 * floatError / frequency);
+    }
+    printf("\nuint32 phase %s\n", ok ? "exact" : "DRIFTED");
+    return ok ? 0 : 1;
+}
+
+// --check: a partial whose increment glides up past Nyquist at a steady amplitude (so its
+// amplitude rate is 0) still has to fade out and be culled, in every kernel
+static bool checkAdditiveNyquist(const AdditiveKernel& kernel)
+{
+    unique_ptr<AdditiveBank> bank(new AdditiveBank);
+    vector<float> buffer(kBlockFrames);
+    StartPartial(*bank, 0, 0.f);
+    SetPartial(*bank, 0, 0.1, 0.5f, 1.f);
+    RenderAdditive(*bank, kernel.render, nullptr, buffer.data(), kBlockFrames);
+    SetPartial(*bank, 0, 0.7, 0.5f, 2.f * kBlockFrames);
+
+    float peak = 0.f;
+    for (int block = 0; block < 4; ++block)
+    {
+        fill(buffer.begin(), buffer.end(), 0.f);
+        RenderAdditive(*bank, kernel.render, nullptr, buffer.data(), kBlockFrames);
+        // the increment is past Nyquist from ~1365 frames in, so the last two blocks are silent
+        if (block >= 2)
+            for (float s : buffer) peak = max(peak, fabsf(s));
+    }
+    bool ok = peak == 0.f && bank->silent[0];
+    printf("%-32s %-6s peak %.3g, batch %s\n", "additive past Nyquist", kernel.name, peak, bank->silent[0] ? "culled" : "live");
+    return ok;
+}
+
+// --check: the --scaling graph through the parallel executor has to come out the same as the
+// serial compile. Not quite bit for bit: the serial compile lets the mixer accumulate into one
+// of its inputs' buffers, which adds the same terms in another order, so within rounding
+static bool checkParallelGraph()
+{
+    scalingThreads = 0;
+    AudioEngine* serial = reinterpret_cast<AudioEngine*>(createScalingBench());
+    scalingThreads = 2; // one worker, even on a single core
+    AudioEngine* parallel = reinterpret_cast<AudioEngine*>(createScalingBench());
+    vector<float> expected(kBlockFrames), actual(kBlockFrames);
+    float worst = 0.f;
+    for (int block = 0; block < 50; ++block)
+    {
+        benchCases[0].render(serial, expected.data(), kBlockFrames);
+        benchCases[0].render(parallel, actual.data(), kBlockFrames);
+        for (int i = 0; i < kBlockFrames; ++i) worst = max(worst, fabsf(expected[i] - actual[i]));
+    }
+    bool ok = parallel->workers.workerCount > 0 && worst < 1e-6f;
+    printf("%-32s %-6s largest difference %.3g, %d worker%s\n", "parallel graph = serial", "", worst,
+        parallel->workers.workerCount, parallel->workers.workerCount == 1 ? "" : "s");
+    destroyParallelVoiceBench(serial);
+    destroyParallelVoiceBench(parallel);
+    return ok;
+}
+
+// --check: a worker preempted in the middle of its task mustn't hold the callback up for
+// longer than the pool's wait. The job is given up on and counted, nothing else goes out until
+// the worker is done, and after that the pool runs jobs as before.
+struct LateWorkerJob
+{
+    SDL_threadID caller;
+    atomic<bool>* started;
+    Uint32 holdMs;
+};
+
+static void runLateWorkerTask(void* context, int)
+{
+    LateWorkerJob& job = *reinterpret_cast<LateWorkerJob*>(context);
+    if (SDL_ThreadID() == job.caller)
+    {
+        // keep the callback's task going until the worker has the other one
+        Uint64 start = SDL_GetPerformanceCounter();
+        while (!job.started->load() && SDL_GetPerformanceCounter() - start < SDL_GetPerformanceFrequency()) {}
+        return;
+    }
+    job.started->store(true);
+    SDL_Delay(job.holdMs); // as if it had lost its core
+}
+
+static bool checkLateWorker()
+{
+    WorkerPool pool;
+    StartWorkers(pool, 1, (double)kBlockFrames / kSampleRate);
+    while (pool.workerCount && pool.parked.load() == 0) SDL_Delay(1); // a worker only looks for jobs newer than it is
+    atomic<bool> started { false };
+    LateWorkerJob job = { SDL_ThreadID(), &started, 50 }; // about two periods
+    Uint64 start = SDL_GetPerformanceCounter();
+    bool finished = RunParallel(pool, runLateWorkerTask, &job, sizeof(job), 2);
+    double waitedMs = 1000.0 * (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    bool gaveUp = started.load() && !finished && pool.finished.load() < 2;
+    bool held = !RunParallel(pool, runLateWorkerTask, &job, sizeof(job), 2);
+    while (!JoinWorkers(pool)) {}
+
+    pool.waitTicks = 0; // one core can't promise the worker gets there in time
+    started.store(false);
+    job.holdMs = 0;
+    bool again = RunParallel(pool, runLateWorkerTask, &job, sizeof(job), 2);
+    bool ok = pool.workerCount == 1 && gaveUp && held && again && pool.lateJobs == 1;
+    printf("%-32s %-6s gave up after %.1f ms, %s until joined, %s after\n", "late worker", "", waitedMs,
+        held ? "held" : "NOT HELD", again ? "runs" : "STUCK");
+    StopWorkers(pool);
+    return ok;
+}
+
+static int runChecks()
+{
+    bool ok = true;
+    for (int k = 0; k < additiveKernelCount; ++k)
+        if (additiveKernels[k].level <= DetectSimdLevel()) ok = checkAdditiveNyquist(additiveKernels[k]) && ok;
+    ok = checkParallelGraph() && ok;
+    ok = checkLateWorker() && ok;
+    printf("\n%s\n", ok ? "all checks pass" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+struct BenchResult
+{
+    const char* name;
+    double nsPerSample;     // mean over all measured blocks
+    double blockNs[5];      // min, p50, p90, p99, max
+    double checksum;        // keeps the optimizer honest, and flags output changes between builds
+};
+
+static const char* percentileNames[5] = { "min", "p50", "p90", "p99", "max" };
+
+static double percentile(const vector<double>& sorted, double p)
+{
+    size_t index = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+// false if the kernel can't run on this machine
+static bool runCase(const BenchCase& bench, int blocks, BenchResult& result)
+{
+    // everything is allocated up front so the timed loop only measures the kernel
+    void* state = bench.create();
+    if (!state) return false;
+    vector<float> buffer(kBlockFrames);
+    vector<double> times(blocks);
+
+    for (int i = 0; i < blocks / 10 + 1; ++i) bench.render(state, buffer.data(), kBlockFrames); // warm up caches & tables
+
+    double checksum = 0;
+    double total = 0;
+    for (int i = 0; i < blocks; ++i)
+    {
+        auto start = chrono::steady_clock::now();
+        bench.render(state, buffer.data(), kBlockFrames);
+        auto stop = chrono::steady_clock::now();
+        times[i] = (double)chrono::duration_cast<chrono::nanoseconds>(stop - start).count();
+        total += times[i];
+        checksum += buffer[i % kBlockFrames];
+    }
+    bench.destroy(state);
+
+    result.name = bench.name;
+    result.nsPerSample = total / ((double)blocks * kBlockFrames);
+    sort(times.begin(), times.end());
+    result.blockNs[0] = times.front();
+    result.blockNs[1] = percentile(times, 0.50);
+    result.blockNs[2] = percentile(times, 0.90);
+    result.blockNs[3] = percentile(times, 0.99);
+    result.blockNs[4] = times.back();
+    result.checksum = checksum;
+    return true;
+}
+
+static void printText(const vector<BenchResult>& results, int blocks)
+{
+    printf("%d blocks of %d frames @ %d Hz, deadline %.3f ms\n\n", blocks, kBlockFrames, kSampleRate, kDeadlineNs / 1e6);
+    printf("%-24s %10s %9s %9s %9s %9s %9s\n", "kernel", "ns/sample", "min%", "p50%", "p90%", "p99%", "max%");
+    for (const BenchResult& r : results)
+    {
+        printf("%-24s %10.3f", r.name, r.nsPerSample);
+        for (int i = 0; i < 5; ++i) printf(" %9.4f", 100.0 * r.blockNs[i] / kDeadlineNs);
+        printf("\n");
+    }
+}
+
+static void printJson(const vector<BenchResult>& results, int blocks)
+{
+    printf("{\n  \"blockFrames\": %d,\n  \"sampleRate\": %d,\n  \"deadlineNs\": %.1f,\n  \"blocks\": %d,\n  \"kernels\": [\n",
+        kBlockFrames, kSampleRate, kDeadlineNs, blocks);
+    for (size_t k = 0; k < results.size(); ++k)
+    {
+        const BenchResult& r = results[k];
+        printf("    {\n      \"name\": \"%s\",\n      \"nsPerSample\": %.4f,\n      \"checksum\": %.9g,\n", r.name, r.nsPerSample, r.checksum);
+        printf("      \"blockNs\": {");
+        for (int i = 0; i < 5; ++i) printf("%s\"%s\": %.1f", i ? ", " : " ", percentileNames[i], r.blockNs[i]);
+        printf(" },\n      \"deadlineFraction\": {");
+        for (int i = 0; i < 5; ++i) printf("%s\"%s\": %.6f", i ? ", " : " ", percentileNames[i], r.blockNs[i] / kDeadlineNs);
+        printf(" }\n    }%s\n", k + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+int main(int argc, const char** argv)
+{
+    bool json = false;
+    bool scaling = false;
+    bool rtCheck = false;
+    double driftHours = 0.0;
+    bool check = false;
+    int blocks = 2000;
+    const char* only = nullptr;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "--json")) json = true;
+        else if (!strcmp(argv[i], "--blocks") && i + 1 < argc) blocks = max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--only") && i + 1 < argc) only = argv[++i];
+        else if (!strcmp(argv[i], "--scaling")) scaling = true;
+        else if (!strcmp(argv[i], "--rt-check")) rtCheck = true;
+        else if (!strcmp(argv[i], "--drift")) driftHours = i + 1 < argc && atof(argv[i + 1]) > 0 ? atof(argv[++i]) : 24.0;
+        else if (!strcmp(argv[i], "--check")) check = true;
+        else
+        {
+            fprintf(stderr, "usage: %s [--json] [--blocks N] [--only name] [--scaling] [--rt-check] [--drift [hours]] [--check]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (driftHours > 0) return runDrift(driftHours);
+    if (check) return runChecks();
+
+    vector<BenchResult> results;
+    if (scaling)
+    {
+        // the work-stealing graph executor from 1 thread up to every core
+        static char names[kMaxWorkers + 2][32];
+        int maxThreads = min(SDL_GetCPUCount(), kMaxWorkers + 1);
+        for (int threads = 0; threads <= maxThreads; ++threads)
+        {
+            scalingThreads = threads;
+            BenchCase bench = { names[threads], createScalingBench, benchCases[0].render, destroyParallelVoiceBench };
+            BenchResult result;
+            runCase(bench, blocks, result);
+            snprintf(names[threads], sizeof(names[threads]), threads ? "graph%d/%d thread%s" : "graph%d/serial",
+                scalingNodes, threads, threads == 1 ? "" : "s");
+            results.push_back(result);
+        }
+        if (json) printJson(results, blocks);
+        else
+        {
+            printText(results, blocks);
+            printf("\n");
+            for (size_t i = 1; i < results.size(); ++i)
+                printf("%-24s %6.2fx vs 1 thread\n", results[i].name, results[1].nsPerSample / results[i].nsPerSample);
+        }
+        return 0;
+    }
+
+    for (const BenchCase& bench : benchCases)
+    {
+        if (only && !strstr(bench.name, only)) continue;
+        BenchResult result;
+        if (runCase(bench, blocks, result)) results.push_back(result);
+        else fprintf(stderr, "%s: not supported on this CPU, skipped\n", bench.name);
+    }
+
+    if (json) printJson(results, blocks);
+    else printText(results, blocks);
+
+    if (rtCheck)
+    {
+        printf("\n");
+        fflush(stdout);
+        PrintRealtimeViolations();
+        if (!kRealtimeGuard) return 2;
+        return RealtimeViolationCount() ? 1 : 0;
+    }
+    return 0;
+}
@@ -0,0 +1,407 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#include "stdafx.h"
+#include "Additive.h"
+#include "SineKernel.h"
+
+#include <math.h>
+#include <string.h>
+
+static const double kTwoPi = 6.283185307179586;
+static const float kJump = 1e30f;   // a rate that gets anywhere within one chunk
+
+AdditiveBank::AdditiveBank()
+{
+    memset(this, 0, sizeof(*this));
+    for (int p = 0; p < kMaxPartials; ++p)
+    {
+        re[p] = 1.f;
+        cosine[p] = 1.f;
+    }
+    memset(silent, 1, sizeof(silent));
+}
+
+static void GrowTo(AdditiveBank& bank, int index)
+{
+    int count = (index / kPartialBatch + 1) * kPartialBatch;
+    if (count > bank.partialCount) bank.partialCount = count;
+}
+
+void StartPartial(AdditiveBank& bank, int index, float phase)
+{
+    if (index < 0 || index >= kMaxPartials) return;
+    bank.re[index] = (float)cos(kTwoPi * phase);
+    bank.im[index] = (float)sin(kTwoPi * phase);
+    bank.amplitude[index] = 0.f;
+    bank.amplitudeTarget[index] = 0.f;
+    GrowTo(bank, index);
+}
+
+void SetPartial(AdditiveBank& bank, int index, double increment, float amplitude, float glideFrames)
+{
+    if (index < 0 || index >= kMaxPartials) return;
+    if (!(increment >= 0.0)) increment = 0.0;
+    bank.incrementTarget[index] = (float)increment;
+    bank.amplitudeTarget[index] = amplitude;
+    if (glideFrames <= 1.f)
+    {
+        // w straight from libm, so a held partial is as accurate as float allows
+        bank.increment[index] = (float)increment;
+        bank.cosine[index] = (float)cos(kTwoPi * (increment < 0.5 ? increment : 0.5));
+        bank.sine[index] = (float)sin(kTwoPi * (increment < 0.5 ? increment : 0.5));
+        bank.incrementRate[index] = kJump;
+        bank.amplitudeRate[index] = kJump;
+    }
+    else
+    {
+        bank.incrementRate[index] = fabsf((float)increment - bank.increment[index]) / glideFrames;
+        bank.amplitudeRate[index] = fabsf(amplitude - bank.amplitude[index]) / glideFrames;
+    }
+    bank.silent[index / kPartialBatch] = 0;
+    GrowTo(bank, index);
+}
+
+static inline float Toward(float x, float target, float maxStep)
+{
+    float d = target - x;
+    return x + (d > maxStep ? maxStep : (d < -maxStep ? -maxStep : d));
+}
+
+static void RenderPartialsScalar(AdditiveBank& bank, int beginBatch, int endBatch, float* out, int frames)
+{
+    for (int start = 0; start < frames; start += kAdditiveChunk)
+    {
+        int count = frames - start < kAdditiveChunk ? frames - start : kAdditiveChunk;
+        for (int b = beginBatch; b < endBatch; ++b)
+        {
+            if (bank.silent[b]) continue;
+            bool quiet = true;
+            for (int p = b * kPartialBatch; p < (b + 1) * kPartialBatch; ++p)
+            {
+                float increment = Toward(bank.increment[p], bank.incrementTarget[p], bank.incrementRate[p] * count);
+                if (increment != bank.increment[p])
+                {
+                    float x = increment < 0.5f ? increment : 0.5f;
+                    bank.increment[p] = increment;
+                    bank.cosine[p] = SinePoly(0.25f - x);
+                    bank.sine[p] = SinePoly(x);
+                }
+                // culled at Nyquist: faded out across this chunk, whatever its own rate
+                bool culled = increment >= 0.5f;
+                float target = culled ? 0.f : bank.amplitudeTarget[p];
+                float amp = bank.amplitude[p];
+                float end = Toward(amp, target, culled ? kJump : bank.amplitudeRate[p] * count);
+                float step = (end - amp) / count;
+                bank.amplitude[p] = end;
+                quiet = quiet && end == 0.f && target == 0.f && (bank.amplitudeTarget[p] == 0.f || bank.incrementTarget[p] >= 0.5f);
+
+                float re = bank.re[p], im = bank.im[p];
+                float c = bank.cosine[p], s = bank.sine[p];
+                for (int i = 0; i < count; ++i)
+                {
+                    out[start + i] += amp * im;
+                    float next = re * c - im * s;
+                    im = re * s + im * c;
+                    re = next;
+                    amp += step;
+                }
+                float gain = 1.5f - 0.5f * (re * re + im * im);
+                bank.re[p] = re * gain;
+                bank.im[p] = im * gain;
+            }
+            bank.silent[b] = quiet;
+        }
+    }
+}
+
+// The SIMD kernels: per chunk, each batch's envelopes are stepped a register at a time, then
+// the batch's registers all rotate together through the chunk's samples, summed per lane into
+// `sums`; one horizontal add per sample at the end of the chunk, like the voice kernels.
+
+static inline __m128 TowardSSE2(__m128 x, __m128 target, __m128 maxStep)
+{
+    __m128 d = _mm_sub_ps(target, x);
+    d = _mm_min_ps(_mm_max_ps(d, _mm_sub_ps(_mm_setzero_ps(), maxStep)), maxStep);
+    return _mm_add_ps(x, d);
+}
+
+// steps the envelopes of the 4 partials at p by `count` frames; leaves the amplitude ramp
+// for the chunk in amp / step and returns the lanes that are quiet for good
+static inline __m128 EnvelopeSSE2(AdditiveBank& bank, int p, int count, __m128& c, __m128& s, __m128& amp, __m128& step)
+{
+    const __m128 nyquist = _mm_set1_ps(0.5f);
+    const __m128 zero = _mm_setzero_ps();
+    __m128 chunk = _mm_set1_ps((float)count);
+    __m128 previous = _mm_load_ps(bank.increment + p);
+    __m128 incrementTarget = _mm_load_ps(bank.incrementTarget + p);
+    __m128 increment = TowardSSE2(previous, incrementTarget, _mm_mul_ps(_mm_load_ps(bank.incrementRate + p), chunk));
+    if (_mm_movemask_ps(_mm_cmpneq_ps(increment, previous)))
+    {
+        __m128 x = _mm_min_ps(increment, nyquist);
+        _mm_store_ps(bank.increment + p, increment);
+        _mm_store_ps(bank.cosine + p, SinePolySSE2(_mm_sub_ps(_mm_set1_ps(0.25f), x)));
+        _mm_store_ps(bank.sine + p, SinePolySSE2(x));
+    }
+    c = _mm_load_ps(bank.cosine + p);
+    s = _mm_load_ps(bank.sine + p);
+
+    __m128 wanted = _mm_load_ps(bank.amplitudeTarget + p);
+    __m128 below = _mm_cmplt_ps(increment, nyquist);
+    __m128 target = _mm_and_ps(wanted, below);
+    __m128 rate = _mm_mul_ps(_mm_load_ps(bank.amplitudeRate + p), chunk);
+    rate = _mm_or_ps(_mm_and_ps(below, rate), _mm_andnot_ps(below, _mm_set1_ps(kJump))); // culled: gone by the chunk's end
+    amp = _mm_load_ps(bank.amplitude + p);
+    __m128 end = TowardSSE2(amp, target, rate);
+    step = _mm_div_ps(_mm_sub_ps(end, amp), chunk);
+    _mm_store_ps(bank.amplitude + p, end);
+
+    __m128 stays = _mm_or_ps(_mm_cmpeq_ps(wanted, zero), _mm_cmpge_ps(incrementTarget, nyquist));
+    return _mm_and_ps(_mm_and_ps(_mm_cmpeq_ps(end, zero), _mm_cmpeq_ps(target, zero)), stays);
+}
+
+static inline void RenormalizeSSE2(float* re, float* im, __m128 r, __m128 i)
+{
+    __m128 gain = _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(_mm_set1_ps(0.5f), _mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(i, i))));
+    _mm_store_ps(re, _mm_mul_ps(r, gain));
+    _mm_store_ps(im, _mm_mul_ps(i, gain));
+}
+
+// 16 SSE registers: a batch goes through in two passes of 4 x 4 partials
+static const int kPassSSE2 = 16;
+
+static void RenderPartialsSSE2(AdditiveBank& bank, int beginBatch, int endBatch, float* out, int frames)
+{
+    alignas(16) float sums[kAdditiveChunk * 4];
+    for (int start = 0; start < frames; start += kAdditiveChunk)
+    {
+        int count = frames - start < kAdditiveChunk ? frames - start : kAdditiveChunk;
+        for (int i = 0; i < count; ++i) _mm_store_ps(sums + 4 * i, _mm_setzero_ps());
+
+        bool any = false;
+        for (int b = beginBatch; b < endBatch; ++b)
+        {
+            if (bank.silent[b]) continue;
+            any = true;
+            __m128 quiet = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (int p = b * kPartialBatch; p < (b + 1) * kPartialBatch; p += kPassSSE2)
+            {
+                __m128 c0, s0, a0, d0, c1, s1, a1, d1, c2, s2, a2, d2, c3, s3, a3, d3;
+                quiet = _mm_and_ps(quiet, EnvelopeSSE2(bank, p, count, c0, s0, a0, d0));
+                quiet = _mm_and_ps(quiet, EnvelopeSSE2(bank, p + 4, count, c1, s1, a1, d1));
+                quiet = _mm_and_ps(quiet, EnvelopeSSE2(bank, p + 8, count, c2, s2, a2, d2));
+                quiet = _mm_and_ps(quiet, EnvelopeSSE2(bank, p + 12, count, c3, s3, a3, d3));
+                __m128 r0 = _mm_load_ps(bank.re + p), i0 = _mm_load_ps(bank.im + p);
+                __m128 r1 = _mm_load_ps(bank.re + p + 4), i1 = _mm_load_ps(bank.im + p + 4);
+                __m128 r2 = _mm_load_ps(bank.re + p + 8), i2 = _mm_load_ps(bank.im + p + 8);
+                __m128 r3 = _mm_load_ps(bank.re + p + 12), i3 = _mm_load_ps(bank.im + p + 12);
+                for (int i = 0; i < count; ++i)
+                {
+                    __m128 sum = _mm_add_ps(_mm_mul_ps(a0, i0), _mm_mul_ps(a1, i1));
+                    sum = _mm_add_ps(sum, _mm_add_ps(_mm_mul_ps(a2, i2), _mm_mul_ps(a3, i3)));
+                    _mm_store_ps(sums + 4 * i, _mm_add_ps(_mm_load_ps(sums + 4 * i), sum));
+                    __m128 n0 = _mm_sub_ps(_mm_mul_ps(r0, c0), _mm_mul_ps(i0, s0));
+                    __m128 n1 = _mm_sub_ps(_mm_mul_ps(r1, c1), _mm_mul_ps(i1, s1));
+                    __m128 n2 = _mm_sub_ps(_mm_mul_ps(r2, c2), _mm_mul_ps(i2, s2));
+                    __m128 n3 = _mm_sub_ps(_mm_mul_ps(r3, c3), _mm_mul_ps(i3, s3));
+                    i0 = _mm_add_ps(_mm_mul_ps(r0, s0), _mm_mul_ps(i0, c0));
+                    i1 = _mm_add_ps(_mm_mul_ps(r1, s1), _mm_mul_ps(i1, c1));
+                    i2 = _mm_add_ps(_mm_mul_ps(r2, s2), _mm_mul_ps(i2, c2));
+                    i3 = _mm_add_ps(_mm_mul_ps(r3, s3), _mm_mul_ps(i3, c3));
+                    r0 = n0; r1 = n1; r2 = n2; r3 = n3;
+                    a0 = _mm_add_ps(a0, d0); a1 = _mm_add_ps(a1, d1); a2 = _mm_add_ps(a2, d2); a3 = _mm_add_ps(a3, d3);
+                }
+                RenormalizeSSE2(bank.re + p, bank.im + p, r0, i0);
+                RenormalizeSSE2(bank.re + p + 4, bank.im + p + 4, r1, i1);
+                RenormalizeSSE2(bank.re + p + 8, bank.im + p + 8, r2, i2);
+                RenormalizeSSE2(bank.re + p + 12, bank.im + p + 12, r3, i3);
+            }
+            bank.silent[b] = _mm_movemask_ps(quiet) == 0xF;
+        }
+
+        if (!any) continue;
+        for (int i = 0; i < count; ++i)
+        {
+            __m128 s = _mm_load_ps(sums + 4 * i);
+            s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+            s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+            out[start + i] += _mm_cvtss_f32(s);
+        }
+    }
+}
+
+SIMD_TARGET_AVX2 static inline __m256 TowardAVX2(__m256 x, __m256 target, __m256 maxStep)
+{
+    __m256 d = _mm256_sub_ps(target, x);
+    d = _mm256_min_ps(_mm256_max_ps(d, _mm256_sub_ps(_mm256_setzero_ps(), maxStep)), maxStep);
+    return _mm256_add_ps(x, d);
+}
+
+SIMD_TARGET_AVX2 static inline __m256 EnvelopeAVX2(AdditiveBank& bank, int p, int count, __m256& c, __m256& s, __m256& amp, __m256& step)
+{
+    const __m256 nyquist = _mm256_set1_ps(0.5f);
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 chunk = _mm256_set1_ps((float)count);
+    __m256 previous = _mm256_load_ps(bank.increment + p);
+    __m256 incrementTarget = _mm256_load_ps(bank.incrementTarget + p);
+    __m256 increment = TowardAVX2(previous, incrementTarget, _mm256_mul_ps(_mm256_load_ps(bank.incrementRate + p), chunk));
+    if (_mm256_movemask_ps(_mm256_cmp_ps(increment, previous, _CMP_NEQ_UQ)))
+    {
+        __m256 x = _mm256_min_ps(increment, nyquist);
+        _mm256_store_ps(bank.increment + p, increment);
+        _mm256_store_ps(bank.cosine + p, SinePolyAVX2(_mm256_sub_ps(_mm256_set1_ps(0.25f), x)));
+        _mm256_store_ps(bank.sine + p, SinePolyAVX2(x));
+    }
+    c = _mm256_load_ps(bank.cosine + p);
+    s = _mm256_load_ps(bank.sine + p);
+
+    __m256 wanted = _mm256_load_ps(bank.amplitudeTarget + p);
+    __m256 below = _mm256_cmp_ps(increment, nyquist, _CMP_LT_OQ);
+    __m256 target = _mm256_and_ps(wanted, below);
+    __m256 rate = _mm256_blendv_ps(_mm256_set1_ps(kJump), _mm256_mul_ps(_mm256_load_ps(bank.amplitudeRate + p), chunk), below);
+    amp = _mm256_load_ps(bank.amplitude + p);
+    __m256 end = TowardAVX2(amp, target, rate);
+    step = _mm256_div_ps(_mm256_sub_ps(end, amp), chunk);
+    _mm256_store_ps(bank.amplitude + p, end);
+
+    __m256 stays = _mm256_or_ps(_mm256_cmp_ps(wanted, zero, _CMP_EQ_OQ), _mm256_cmp_ps(incrementTarget, nyquist, _CMP_GE_OQ));
+    __m256 silent = _mm256_and_ps(_mm256_cmp_ps(end, zero, _CMP_EQ_OQ), _mm256_cmp_ps(target, zero, _CMP_EQ_OQ));
+    return _mm256_and_ps(silent, stays);
+}
+
+SIMD_TARGET_AVX2 static inline void RenormalizeAVX2(float* re, float* im, __m256 r, __m256 i)
+{
+    __m256 gain = _mm256_fnmadd_ps(_mm256_set1_ps(0.5f), _mm256_fmadd_ps(r, r, _mm256_mul_ps(i, i)), _mm256_set1_ps(1.5f));
+    _mm256_store_ps(re, _mm256_mul_ps(r, gain));
+    _mm256_store_ps(im, _mm256_mul_ps(i, gain));
+}
+
+// a whole batch in 4 registers per quantity; the rotations' 8 cycle latency is hidden by
+// the other three, and the c / s operands can come straight from the stack if it runs short
+SIMD_TARGET_AVX2 static void RenderPartialsAVX2(AdditiveBank& bank, int beginBatch, int endBatch, float* out, int frames)
+{
+    alignas(32) float sums[kAdditiveChunk * 8];
+    for (int start = 0; start < frames; start += kAdditiveChunk)
+    {
+        int count = frames - start < kAdditiveChunk ? frames - start : kAdditiveChunk;
+        for (int i = 0; i < count; ++i) _mm256_store_ps(sums + 8 * i, _mm256_setzero_ps());
+
+        bool any = false;
+        for (int b = beginBatch; b < endBatch; ++b)
+        {
+            if (bank.silent[b]) continue;
+            any = true;
+            int p = b * kPartialBatch;
+            __m256 c0, s0, a0, d0, c1, s1, a1, d1, c2, s2, a2, d2, c3, s3, a3, d3;
+            __m256 quiet = EnvelopeAVX2(bank, p, count, c0, s0, a0, d0);
+            quiet = _mm256_and_ps(quiet, EnvelopeAVX2(bank, p + 8, count, c1, s1, a1, d1));
+            quiet = _mm256_and_ps(quiet, EnvelopeAVX2(bank, p + 16, count, c2, s2, a2, d2));
+            quiet = _mm256_and_ps(quiet, EnvelopeAVX2(bank, p + 24, count, c3, s3, a3, d3));
+            __m256 r0 = _mm256_load_ps(bank.re + p), i0 = _mm256_load_ps(bank.im + p);
+            __m256 r1 = _mm256_load_ps(bank.re + p + 8), i1 = _mm256_load_ps(bank.im + p + 8);
+            __m256 r2 = _mm256_load_ps(bank.re + p + 16), i2 = _mm256_load_ps(bank.im + p + 16);
+            __m256 r3 = _mm256_load_ps(bank.re + p + 24), i3 = _mm256_load_ps(bank.im + p + 24);
+            for (int i = 0; i < count; ++i)
+            {
+                __m256 sum = _mm256_fmadd_ps(a0, i0, _mm256_load_ps(sums + 8 * i));
+                sum = _mm256_fmadd_ps(a1, i1, sum);
+                sum = _mm256_fmadd_ps(a2, i2, sum);
+                sum = _mm256_fmadd_ps(a3, i3, sum);
+                _mm256_store_ps(sums + 8 * i, sum);
+                __m256 n0 = _mm256_fmsub_ps(r0, c0, _mm256_mul_ps(i0, s0));
+                __m256 n1 = _mm256_fmsub_ps(r1, c1, _mm256_mul_ps(i1, s1));
+                __m256 n2 = _mm256_fmsub_ps(r2, c2, _mm256_mul_ps(i2, s2));
+                __m256 n3 = _mm256_fmsub_ps(r3, c3, _mm256_mul_ps(i3, s3));
+                i0 = _mm256_fmadd_ps(r0, s0, _mm256_mul_ps(i0, c0));
+                i1 = _mm256_fmadd_ps(r1, s1, _mm256_mul_ps(i1, c1));
+                i2 = _mm256_fmadd_ps(r2, s2, _mm256_mul_ps(i2, c2));
+                i3 = _mm256_fmadd_ps(r3, s3, _mm256_mul_ps(i3, c3));
+                r0 = n0; r1 = n1; r2 = n2; r3 = n3;
+                a0 = _mm256_add_ps(a0, d0); a1 = _mm256_add_ps(a1, d1); a2 = _mm256_add_ps(a2, d2); a3 = _mm256_add_ps(a3, d3);
+            }
+            RenormalizeAVX2(bank.re + p, bank.im + p, r0, i0);
+            RenormalizeAVX2(bank.re + p + 8, bank.im + p + 8, r1, i1);
+            RenormalizeAVX2(bank.re + p + 16, bank.im + p + 16, r2, i2);
+            RenormalizeAVX2(bank.re + p + 24, bank.im + p + 24, r3, i3);
+            bank.silent[b] = _mm256_movemask_ps(quiet) == 0xFF;
+        }
+
+        if (!any) continue;
+        for (int i = 0; i < count; ++i)
+        {
+            __m256 s8 = _mm256_load_ps(sums + 8 * i);
+            __m128 s = _mm_add_ps(_mm256_castps256_ps128(s8), _mm256_extractf128_ps(s8, 1));
+            s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+            s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+            out[start + i] += _mm_cvtss_f32(s);
+        }
+    }
+    _mm256_zeroupper();
+}
+
+const AdditiveKernel additiveKernels[] =
+{
+    { "scalar", SimdScalar, RenderPartialsScalar },
+    { "sse2", SimdSSE2, RenderPartialsSSE2 },
+    { "avx2", SimdAVX2, RenderPartialsAVX2 },
+};
+const int additiveKernelCount = sizeof(additiveKernels) / sizeof(additiveKernels[0]);
+
+const AdditiveKernel& SelectAdditiveKernel()
+{
+    SimdLevel level = DetectSimdLevel();
+    int best = 0;
+    for (int i = 1; i < additiveKernelCount; ++i)
+        if (additiveKernels[i].level <= level) best = i;
+    return additiveKernels[best];
+}
+
+struct AdditiveSlices
+{
+    AdditiveBank* bank;
+    AdditiveKernelFn kernel;
+    int frames;
+    int batchesPerSlice;
+    int batches;
+};
+
+static void RenderAdditiveSlice(void* context, int slice)
+{
+    AdditiveSlices& slices = *reinterpret_cast<AdditiveSlices*>(context);
+    int begin = slice * slices.batchesPerSlice;
+    int end = begin + slices.batchesPerSlice < slices.batches ? begin + slices.batchesPerSlice : slices.batches;
+    float* scratch = slices.bank->scratch[slice];
+    memset(scratch, 0, slices.frames * sizeof(float));
+    if (begin < end) slices.kernel(*slices.bank, begin, end, scratch, slices.frames);
+}
+
+void RenderAdditive(AdditiveBank& bank, AdditiveKernelFn kernel, WorkerPool* pool, float* out, int frames)
+{
+    int batches = bank.partialCount / kPartialBatch;
+    if (!batches) return;
+
+    // a slice is worth a worker from a few batches up
+    int sliceCount = pool ? pool->workerCount + 1 : 1;
+    if (sliceCount > batches / 4) sliceCount = batches / 4;
+    if (sliceCount <= 1)
+    {
+        kernel(bank, 0, batches, out, frames);
+        return;
+    }
+
+    AdditiveSlices slices;
+    slices.bank = &bank;
+    slices.kernel = kernel;
+    slices.batches = batches;
+    slices.batchesPerSlice = (batches + sliceCount - 1) / sliceCount;
+    for (int start = 0; start < frames; start += kAdditiveSliceFrames)
+    {
+        slices.frames = frames - start < kAdditiveSliceFrames ? frames - start : kAdditiveSliceFrames;
+        if (!RunParallel(*pool, RenderAdditiveSlice, &slices, sizeof(slices), sliceCount)) return; // a worker was late
+        for (int slice = 0; slice < sliceCount; ++slice)
+        {
+            const float* scratch = bank.scratch[slice];
+            for (int i = 0; i < slices.frames; ++i) out[start + i] += scratch[i];
+        }
+    }
+}
@@ -0,0 +1,75 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+#include "SDL.h"
+#include "Simd.h"
+#include "WorkerPool.h"
+
+// Additive synthesis at the scale of tens of thousands of partials. Each partial is a
+// rotating phasor z = (re, im): one complex multiply by w = e^(2 pi i increment) per sample
+// gives the next sine value, 4 multiply-adds instead of a polynomial. The rounding that
+// makes |z| creep away from 1 is undone once per chunk (one Newton step towards 1/|z|).
+//
+// Envelopes run at chunk rate: each partial glides towards its target amplitude and
+// increment at its own rate, the amplitude as a straight line across every chunk, the
+// frequency as a new w at the start of each (the phasor carries on, so no clicks). A partial
+// whose increment reaches Nyquist is faded out and culled; batches of partials that are
+// silent and will stay that way are skipped outright.
+//
+// Partials live in structure-of-arrays form like the voices, and are rendered in batches of
+// kPartialBatch (several registers per step, so the rotations' latency overlaps).
+
+static const int kMaxPartials = 65536;
+static const int kPartialBatch = 32;
+static const int kAdditiveChunk = 128;          // frames per envelope step (~3 ms)
+static const int kAdditiveSliceFrames = 1024;   // longest stretch one worker renders at once
+
+struct AdditiveBank
+{
+    alignas(32) float re[kMaxPartials];
+    alignas(32) float im[kMaxPartials];         // output is amplitude * im
+    alignas(32) float cosine[kMaxPartials];     // w, for the current increment
+    alignas(32) float sine[kMaxPartials];
+    alignas(32) float increment[kMaxPartials];  // cycles per sample
+    alignas(32) float incrementTarget[kMaxPartials];
+    alignas(32) float incrementRate[kMaxPartials];  // per sample
+    alignas(32) float amplitude[kMaxPartials];
+    alignas(32) float amplitudeTarget[kMaxPartials];
+    alignas(32) float amplitudeRate[kMaxPartials];  // per sample
+    Uint8 silent[kMaxPartials / kPartialBatch];     // whole batch is quiet until a SetPartial
+    int partialCount = 0;                           // [0, partialCount) get rendered, whole batches
+    alignas(32) float scratch[kMaxWorkers + 1][kAdditiveSliceFrames];  // one per worker slice
+
+    AdditiveBank();
+
+    static void* operator new(size_t size) { return AlignedAlloc(size, 32); }
+    static void operator delete(void* memory) { AlignedFree(memory); }
+};
+
+// Both belong to whoever renders the bank (the audio thread once it's playing).
+// Restarts partial `index` silent, at `phase` cycles
+void StartPartial(AdditiveBank& bank, int index, float phase);
+// glides partial `index` to `increment` (cycles per sample) and `amplitude` over `glideFrames`
+// (<= 1: the increment jumps, the amplitude still ramps across one chunk)
+void SetPartial(AdditiveBank& bank, int index, double increment, float amplitude, float glideFrames);
+
+// adds batches [begin, end) into out[0..frames)
+typedef void (*AdditiveKernelFn)(AdditiveBank& bank, int beginBatch, int endBatch, float* out, int frames);
+
+struct AdditiveKernel
+{
+    const char* name;
+    SimdLevel level;
+    AdditiveKernelFn render;
+};
+
+extern const AdditiveKernel additiveKernels[];
+extern const int additiveKernelCount;
+
+const AdditiveKernel& SelectAdditiveKernel();
+
+// adds the whole bank into out, batches split over the pool's workers (nullptr: all inline);
+// slices are summed in order, so the output doesn't depend on who rendered what
+void RenderAdditive(AdditiveBank& bank, AdditiveKernelFn kernel, WorkerPool* pool, float* out, int frames);
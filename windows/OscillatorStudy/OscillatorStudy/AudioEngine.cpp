@@ -0,0 +1,276 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#include "stdafx.h"
+#include "AudioEngine.h"
+
+#include <string.h>
+
+static bool PushChange(AudioEngine& engine, ParameterId id, int note, float value, Uint64 sampleTime)
+{
+    ParameterChange change;
+    change.sampleTime = sampleTime;
+    change.id = id;
+    change.note = note;
+    change.value = value;
+    return engine.parameters.push(change);
+}
+
+bool SetParameter(AudioEngine& engine, ParameterId id, float value, Uint64 sampleTime)
+{
+    return PushChange(engine, id, 0, value, sampleTime);
+}
+
+bool NoteOn(AudioEngine& engine, int note, float frequency, Uint64 sampleTime)
+{
+    return PushChange(engine, ParamNoteOn, note, frequency, sampleTime);
+}
+
+bool NoteOff(AudioEngine& engine, int note, Uint64 sampleTime)
+{
+    return PushChange(engine, ParamNoteOff, note, 0.f, sampleTime);
+}
+
+bool FmNoteOn(AudioEngine& engine, int note, float frequency, Uint64 sampleTime)
+{
+    return PushChange(engine, ParamFmNoteOn, note, frequency, sampleTime);
+}
+
+bool FmNoteOff(AudioEngine& engine, int note, Uint64 sampleTime)
+{
+    return PushChange(engine, ParamFmNoteOff, note, 0.f, sampleTime);
+}
+
+bool StringNoteOn(AudioEngine& engine, int note, float frequency, Uint64 sampleTime)
+{
+    return PushChange(engine, ParamStringOn, note, frequency, sampleTime);
+}
+
+bool StringNoteOff(AudioEngine& engine, int note, Uint64 sampleTime)
+{
+    return PushChange(engine, ParamStringOff, note, 0.f, sampleTime);
+}
+
+bool TubeNoteOn(AudioEngine& engine, int note, float frequency, Uint64 sampleTime)
+{
+    return PushChange(engine, ParamTubeOn, note, frequency, sampleTime);
+}
+
+bool TubeNoteOff(AudioEngine& engine, int note, Uint64 sampleTime)
+{
+    return PushChange(engine, ParamTubeOff, note, 0.f, sampleTime);
+}
+
+static void ApplyParameter(AudioEngine& engine, const ParameterChange& change)
+{
+    OscillatorData& osc = engine.oscillator;
+    switch (change.id)
+    {
+    case ParamFrequency: osc.frequency = change.value; break;
+    case ParamAmplitude: osc.amplitude = change.value; break;
+    case ParamWaveform: osc.waveform = (Waveform)(int)change.value; break;
+    case ParamPulseWidth: osc.pulseWidth = change.value; break;
+    case ParamVoiceGain: engine.voiceGain = change.value; break;
+    case ParamNoteOn: engine.voices.noteOn(change.note, (double)change.value / engine.sampleRate, engine.voiceGain); break;
+    case ParamNoteOff: engine.voices.noteOff(change.note); break;
+    case ParamAllNotesOff:
+        engine.voices.allNotesOff();
+        engine.fm.allNotesOff();
+        if (engine.strings) engine.strings->allNotesOff();
+        if (engine.tubes) engine.tubes->allNotesOff();
+        break;
+    case ParamFmNoteOn: engine.fm.noteOn(change.note, (double)change.value / engine.sampleRate, engine.voiceGain); break;
+    case ParamFmNoteOff: engine.fm.noteOff(change.note); break;
+    case ParamFmPreset: SetFmPatch(engine.fm, MakeFmPatch((FmPreset)(int)change.value), engine.sampleRate); break;
+    case ParamGrainDensity: if (engine.grains) engine.grains->settings.density = change.value; break;
+    case ParamStringOn: if (engine.strings) engine.strings->noteOn(change.note, (double)change.value / engine.sampleRate, engine.voiceGain); break;
+    case ParamStringOff: if (engine.strings) engine.strings->noteOff(change.note); break;
+    case ParamTubeOn: if (engine.tubes) engine.tubes->noteOn(change.note, (double)change.value / engine.sampleRate, engine.voiceGain); break;
+    case ParamTubeOff: if (engine.tubes) engine.tubes->noteOff(change.note); break;
+    }
+}
+
+Phase RenderWaveform(AudioEngine& engine, Waveform waveform, float pulseWidth, float* out, int frames, Phase phase, PhaseRamp increment, Ramp amplitude)
+{
+    switch (waveform)
+    {
+    case WaveSaw:
+    case WaveSquare:
+        return engine.renderWavetable(GetWavetable(waveform), out, frames, phase, increment, amplitude);
+    case WaveAnalogSaw: return engine.renderBlep(BlepSaw, pulseWidth, out, frames, phase, increment, amplitude);
+    case WaveAnalogPulse: return engine.renderBlep(BlepPulse, pulseWidth, out, frames, phase, increment, amplitude);
+    case WaveAnalogTriangle: return engine.renderBlep(BlepTriangle, pulseWidth, out, frames, phase, increment, amplitude);
+    default: return engine.renderSine(out, frames, phase, increment, amplitude);
+    }
+}
+
+// frequency and amplitude glide towards the current parameters in straight lines, so a
+// change never steps the waveform
+void RenderOscillator(AudioEngine& engine, float* out, int frames)
+{
+    OscillatorData& osc = engine.oscillator;
+    float increment = osc.frequency / engine.sampleRate;
+    if (!(increment >= 0.f && increment < 0.5f)) increment = 0.f; // nothing sensible above Nyquist
+    engine.incrementSmoother.setTarget(increment, engine.sampleRate);
+    engine.amplitudeSmoother.setTarget(osc.amplitude, engine.sampleRate);
+    Ramp incrementRamp = engine.incrementSmoother.next(frames, engine.sampleRate);
+    Ramp amplitudeRamp = engine.amplitudeSmoother.next(frames, engine.sampleRate);
+    // once settled, the increment comes straight from the frequency, in double and with the
+    // fraction carried, so a held tone never drifts; glides are short enough not to matter
+    if (incrementRamp.step == 0.f && incrementRamp.start == increment && increment > 0.f)
+    {
+        FineIncrement fine = ToFineIncrement((double)osc.frequency / engine.sampleRate);
+        osc.phase = RenderWaveform(engine, osc.waveform, osc.pulseWidth, out, frames, osc.phase, ConstantPhaseRamp(fine.whole), amplitudeRamp);
+        osc.phase = CarryPhase(osc.phase, osc.phaseRemainder, fine, frames);
+        return;
+    }
+    osc.phase = RenderWaveform(engine, osc.waveform, osc.pulseWidth, out, frames, osc.phase, ToPhaseRamp(incrementRamp), amplitudeRamp);
+}
+
+struct VoiceSlices
+{
+    AudioEngine* engine;
+    int frames;
+    int groupsPerSlice;
+    int end;
+};
+
+static void RenderVoiceSlice(void* context, int slice)
+{
+    VoiceSlices& slices = *reinterpret_cast<VoiceSlices*>(context);
+    AudioEngine& engine = *slices.engine;
+    int begin = slice * slices.groupsPerSlice * kVoiceGroup;
+    int end = begin + slices.groupsPerSlice * kVoiceGroup;
+    if (end > slices.end) end = slices.end;
+    float* scratch = engine.voiceScratch[slice];
+    memset(scratch, 0, slices.frames * sizeof(float));
+    if (begin < end) engine.renderVoices(engine.voices, begin, end, scratch, slices.frames);
+}
+
+void RenderVoices(AudioEngine& engine, float* out, int frames)
+{
+    if (!engine.voices.activeCount) return;
+    int end = engine.voices.renderCount();
+    int groups = end / kVoiceGroup;
+
+    // below a couple of groups per thread, waking anyone costs more than it saves
+    int sliceCount = engine.workers.workerCount + 1;
+    if (sliceCount > groups / 2) sliceCount = groups / 2;
+    if (sliceCount <= 1)
+    {
+        engine.renderVoices(engine.voices, 0, end, out, frames);
+        return;
+    }
+
+    VoiceSlices slices;
+    slices.engine = &engine;
+    slices.groupsPerSlice = (groups + sliceCount - 1) / sliceCount;
+    slices.end = end;
+    for (int start = 0; start < frames; start += kVoiceSliceFrames)
+    {
+        slices.frames = frames - start < kVoiceSliceFrames ? frames - start : kVoiceSliceFrames;
+        if (!RunParallel(engine.workers, RenderVoiceSlice, &slices, sizeof(slices), sliceCount)) return; // see RenderBlock
+        for (int slice = 0; slice < sliceCount; ++slice)
+        {
+            const float* scratch = engine.voiceScratch[slice];
+            for (int i = 0; i < slices.frames; ++i) out[start + i] += scratch[i];
+        }
+    }
+}
+
+void RenderFm(AudioEngine& engine, float* out, int frames)
+{
+    if (engine.fm.activeCount) engine.fm.algorithm.render(engine.fm, 0, engine.fm.renderCount(), out, frames);
+}
+
+// renders `frames` samples with the parameters as they are right now
+static void Render(AudioEngine& engine, CompiledGraph* graph, float* out, int frames)
+{
+    if (graph)
+    {
+        RunGraph(*graph, engine, out, frames);
+        return;
+    }
+    RenderOscillator(engine, out, frames);
+    RenderVoices(engine, out, frames);
+    RenderFm(engine, out, frames);
+    if (engine.additive) RenderAdditive(*engine.additive, engine.renderAdditive, &engine.workers, out, frames);
+    if (engine.grains) RenderGrains(*engine.grains, engine.renderGrains, out, frames);
+    if (engine.strings) RenderWaveguides(*engine.strings, engine.renderStrings, out, frames);
+    if (engine.tubes) RenderWaveguides(*engine.tubes, engine.renderTubes, out, frames);
+}
+
+bool RenderBlock(AudioEngine& engine, float* out, int frames)
+{
+    RealtimeScope realtime; // no allocating, freeing or locking from here on (checked with REALTIME_GUARD)
+
+    // A worker the last block gave up on may still be inside the voices, the partials or the
+    // graph. Until it's out none of that can be touched, parameter changes and graph swaps
+    // included, so the block is silent; the changes land as soon as it is.
+    Uint32 lateJobs = engine.workers.lateJobs;
+    bool joined = JoinWorkers(engine.workers);
+    if (!joined) memset(out, 0, frames * sizeof(float));
+
+    CompiledGraph* graph = joined ? AcquireGraph(engine.graph) : nullptr; // a freshly edited graph starts on a block boundary
+
+    // split the block wherever a queued parameter change is due, so every change lands on
+    // its exact sample no matter how many arrive per block
+    Uint64 blockStart = engine.sampleClock.load(std::memory_order_relaxed);
+    int done = joined ? 0 : frames;
+    while (done < frames)
+    {
+        const ParameterChange* change = engine.parameters.front();
+        while (change && change->sampleTime <= blockStart + done)
+        {
+            ApplyParameter(engine, *change);
+            engine.parameters.pop();
+            change = engine.parameters.front();
+        }
+
+        int end = frames;
+        if (change && change->sampleTime < blockStart + frames) end = (int)(change->sampleTime - blockStart);
+        Render(engine, graph, out + done, end - done);
+        if (engine.workers.unfinished)
+        {
+            memset(out + done, 0, (frames - done) * sizeof(float)); // this segment is missing the late worker's share
+            break;
+        }
+        done = end;
+    }
+    engine.sampleClock.store(blockStart + frames, std::memory_order_relaxed);
+    return joined && engine.workers.lateJobs == lateJobs;
+}
+
+void AudioCallback(void* userData, Uint8* buffer, int bufferSizeBytes)
+{
+    AudioEngine* engine = reinterpret_cast<AudioEngine*>(userData); // see main() for setup
+    if (engine->realtime && engine->callbackRealtime.load(std::memory_order_relaxed) < 0)
+        engine->callbackRealtime.store(PrepareRealtimeThread()); // SDL's thread, we only get to see it from here
+    RealtimeScope realtime;
+
+    // this is where all the audio computation takes place:
+    float* sampleArray = reinterpret_cast<float*>(buffer);
+    int frames = bufferSizeBytes / (int)sizeof(float);
+
+    // how fast does this execute? -- OscillatorBench offline, `p` in the console while playing.
+    // With render-ahead that's the copy out of the ring, since that's what the device waits
+    // for; the rendering happens in bursts on the render thread, which no xrun check can judge.
+    engine->profiler.begin();
+    RenderAhead& ahead = engine->renderAhead;
+    if (ahead.running.load(std::memory_order_relaxed))
+    {
+        Uint64 blockStart = ahead.played;
+        bool underrun = !ReadRenderedAudio(ahead, sampleArray, frames); // already rendered, see StartRenderAhead
+        Uint32 lateBlocks = ahead.lateBlocks.load(std::memory_order_relaxed);
+        bool workerLate = lateBlocks != ahead.lateReported;
+        ahead.lateReported = lateBlocks;
+        engine->profiler.end(frames);
+        engine->xruns.check(engine->profiler, blockStart, ahead.activeVoices.load(std::memory_order_relaxed), workerLate, underrun);
+        return;
+    }
+
+    Uint64 blockStart = engine->sampleClock.load(std::memory_order_relaxed);
+    bool complete = RenderBlock(*engine, sampleArray, frames);
+    engine->profiler.end(frames);
+    engine->xruns.check(engine->profiler, blockStart, engine->voices.activeCount, !complete);
+}
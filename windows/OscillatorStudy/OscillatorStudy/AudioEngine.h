@@ -0,0 +1,144 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+#include "SDL.h"
+#include "Additive.h"
+#include "CallbackProfiler.h"
+#include "Fm.h"
+#include "Granular.h"
+#include "PolyBlep.h"
+#include "ProcessGraph.h"
+#include "RealtimeGuard.h"
+#include "RealtimeSetup.h"
+#include "RenderAhead.h"
+#include "SineKernel.h"
+#include "Smoothing.h"
+#include "SpscQueue.h"
+#include "VoicePool.h"
+#include "Waveguide.h"
+#include "Wavetable.h"
+#include "WorkerPool.h"
+#include "XrunMonitor.h"
+
+#include <atomic>
+
+// Everything the audio thread needs lives behind the `userData` pointer handed to SDL.
+// Kept in its own file so the benchmark can drive AudioCallback without opening a device.
+
+struct OscillatorData
+{
+    float frequency;
+    float amplitude;
+    Phase phase;
+    Uint32 phaseRemainder = 0;  // below phase's last bit, see FineIncrement
+    Waveform waveform;  // sine and the analog shapes are computed, the rest come from the shared wavetables
+    float pulseWidth = 0.5f;    // WaveAnalogPulse only
+};
+
+enum ParameterId
+{
+    ParamFrequency,
+    ParamAmplitude,
+    ParamWaveform,      // value is a Waveform
+    ParamPulseWidth,    // fraction of the cycle the pulse is high
+    ParamVoiceGain,     // gain of voices started from now on
+    ParamNoteOn,        // value is the frequency
+    ParamNoteOff,
+    ParamAllNotesOff,   // FM and waveguide voices too
+    ParamFmNoteOn,      // value is the frequency
+    ParamFmNoteOff,
+    ParamFmPreset,      // value is an FmPreset; stops the FM voices
+    ParamGrainDensity,  // grains per second, 0 to stop spawning them
+    ParamStringOn,      // value is the frequency
+    ParamStringOff,
+    ParamTubeOn,        // value is the frequency
+    ParamTubeOff,
+};
+
+// A parameter update travelling from the console (or any other single producer) to the
+// audio thread. It takes effect exactly at `sampleTime` on the engine's sample clock, or at
+// the start of the next block if that moment has already been rendered (0 = asap).
+struct ParameterChange
+{
+    Uint64 sampleTime;
+    ParameterId id;
+    int note;           // which voice, for the note messages
+    float value;
+};
+
+// voices are split between the workers and the callback thread in slices, each rendered
+// into its own scratch buffer and summed in slice order (so the output doesn't depend on
+// who rendered what); this is the longest stretch one slice covers
+static const int kVoiceSliceFrames = 1024;
+
+struct AudioEngine
+{
+    OscillatorData oscillator;      // owned by the audio thread, change it through `parameters`
+    VoicePool voices;               // same
+    FmVoices fm;                    // same
+    SmoothedValue amplitudeSmoother { RampExponential, 0.005f };    // follows oscillator.amplitude
+    SmoothedValue incrementSmoother { RampLinear, 0.02f };          // follows oscillator.frequency, as a short glide
+    float voiceGain = 0.1f;
+    float sampleRate = 44100.f;     // set from the obtained device spec before playback starts
+    SineKernelFn renderSine = SelectSineKernel().render;
+    WavetableKernelFn renderWavetable = SelectWavetableKernel().render;
+    BlepKernelFn renderBlep = SelectBlepKernel().render;
+    NoiseKernelFn renderNoise = SelectNoiseKernel().render;
+    VoiceKernelFn renderVoices = SelectVoiceKernel().render;
+    AdditiveBank* additive = nullptr;   // set up before playback starts, rendered by the audio thread
+    AdditiveKernelFn renderAdditive = SelectAdditiveKernel().render;
+    GrainCloud* grains = nullptr;   // same; mono, like the device
+    GrainKernelFn renderGrains = SelectGrainKernel().render;
+    WaveguideVoices* strings = nullptr; // same
+    WaveguideVoices* tubes = nullptr;   // same
+    WaveguideKernelFn renderStrings = SelectWaveguideKernel(WaveguideString).render;
+    WaveguideKernelFn renderTubes = SelectWaveguideKernel(WaveguideTube).render;
+    WorkerPool workers;             // helps render voices once started; none by default
+    alignas(32) float voiceScratch[kMaxWorkers + 1][kVoiceSliceFrames]; // one per voice slice
+    RenderAhead renderAhead;        // when running, the callback only copies what it rendered
+    GraphSlot graph;                // when empty, the oscillator and voices go straight out
+    CallbackProfiler profiler;
+    XrunMonitor xruns;
+    SpscQueue<ParameterChange, 4096> parameters;
+    std::atomic<Uint64> sampleClock { 0 };  // frames rendered so far
+    bool realtime = false;                  // set before the device starts: prepare the callback's thread
+    std::atomic<int> callbackRealtime { -1 };   // what that managed, once the first callback ran
+
+    // the voice arrays want 32-byte alignment, which plain C++14 `new` doesn't promise
+    static void* operator new(size_t size) { return AlignedAlloc(size, 32); }
+    static void operator delete(void* memory) { AlignedFree(memory); }
+};
+
+// producer side of AudioEngine::parameters; changes must be pushed in sampleTime order,
+// returns false if the queue is full
+bool SetParameter(AudioEngine& engine, ParameterId id, float value, Uint64 sampleTime = 0);
+bool NoteOn(AudioEngine& engine, int note, float frequency, Uint64 sampleTime = 0);
+bool NoteOff(AudioEngine& engine, int note, Uint64 sampleTime = 0);
+bool FmNoteOn(AudioEngine& engine, int note, float frequency, Uint64 sampleTime = 0);
+bool FmNoteOff(AudioEngine& engine, int note, Uint64 sampleTime = 0);
+bool StringNoteOn(AudioEngine& engine, int note, float frequency, Uint64 sampleTime = 0);
+bool StringNoteOff(AudioEngine& engine, int note, Uint64 sampleTime = 0);
+bool TubeNoteOn(AudioEngine& engine, int note, float frequency, Uint64 sampleTime = 0);
+bool TubeNoteOff(AudioEngine& engine, int note, Uint64 sampleTime = 0);
+
+// any waveform through whichever kernel draws it; returns the phase to continue from
+Phase RenderWaveform(AudioEngine& engine, Waveform waveform, float pulseWidth, float* out, int frames, Phase phase, PhaseRamp increment, Ramp amplitude);
+
+// the engine's oscillator as it stands, ramping towards its latest parameters
+void RenderOscillator(AudioEngine& engine, float* out, int frames);
+
+// adds the active voices into out, spread over the worker pool when it's running
+void RenderVoices(AudioEngine& engine, float* out, int frames);
+
+// adds the active FM voices into out, through the kernel the current patch compiled to
+void RenderFm(AudioEngine& engine, float* out, int frames);
+
+// the next `frames` samples: applies due parameter changes, renders and updates the clock.
+// False when a late worker left part of them silent (see WorkerPool). Called by
+// AudioCallback, or by the render-ahead thread when that runs
+bool RenderBlock(AudioEngine& engine, float* out, int frames);
+
+// SDL_AudioCallback: fills `buffer` with `bufferSizeBytes` worth of mono float samples
+void AudioCallback(void* userData, Uint8* buffer, int bufferSizeBytes);
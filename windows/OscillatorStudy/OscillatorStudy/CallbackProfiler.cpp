@@ -0,0 +1,99 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#include "stdafx.h"
+#include "CallbackProfiler.h"
+
+#include <iostream>
+
+using namespace std;
+
+// the audio thread is the only writer, so a plain load + store is enough (no lock prefix)
+template <typename T>
+static inline void bump(atomic<T>& value, T amount)
+{
+    value.store(value.load(memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+void CallbackProfiler::configure(int sampleRate)
+{
+    ticksPerSample = (double)SDL_GetPerformanceFrequency() / sampleRate;
+}
+
+void CallbackProfiler::begin()
+{
+    entry = SDL_GetPerformanceCounter();
+    lastInterval = lastEntry ? entry - lastEntry : 0;
+    lastEntry = entry;
+
+    if (resetRequested.load(memory_order_relaxed))
+    {
+        for (auto& bin : loadBins) bin.store(0, memory_order_relaxed);
+        for (auto& bin : jitterBins) bin.store(0, memory_order_relaxed);
+        callbacks.store(0, memory_order_relaxed);
+        loadSum.store(0, memory_order_relaxed);
+        loadMax.store(0, memory_order_relaxed);
+        lastInterval = 0;
+        resetRequested.store(false, memory_order_relaxed);
+    }
+}
+
+void CallbackProfiler::end(int frames)
+{
+    Uint64 exit = SDL_GetPerformanceCounter();
+    if (ticksPerSample == 0) return; // configure() not called (yet)
+
+    double budget = ticksPerSample * frames;
+    lastDuration = exit - entry;
+    lastBudget = budget;
+    float load = (float)(100.0 * lastDuration / budget);
+    bump(loadBins[load < kLoadBins - 1 ? (int)load : kLoadBins - 1], 1u);
+    bump(loadSum, load);
+    if (load > loadMax.load(memory_order_relaxed)) loadMax.store(load, memory_order_relaxed);
+
+    if (lastInterval)
+    {
+        double jitter = 100.0 * (lastInterval - budget) / budget;
+        int bin = (int)(jitter + (jitter < 0 ? -0.5 : 0.5)) + kJitterBins / 2;
+        bump(jitterBins[bin < 0 ? 0 : (bin >= kJitterBins ? kJitterBins - 1 : bin)], 1u);
+    }
+    bump(callbacks, 1u);
+}
+
+// walks a histogram until `fraction` of its entries are covered, returns that bin
+static int histogramPercentile(const atomic<Uint32>* bins, int count, double fraction)
+{
+    Uint64 total = 0;
+    for (int i = 0; i < count; ++i) total += bins[i].load(memory_order_relaxed);
+    if (total == 0) return 0;
+
+    Uint64 target = (Uint64)(fraction * total);
+    Uint64 seen = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        seen += bins[i].load(memory_order_relaxed);
+        if (seen > target) return i;
+    }
+    return count - 1;
+}
+
+void CallbackProfiler::snapshot(ProfileSnapshot& out) const
+{
+    out.callbacks = callbacks.load(memory_order_relaxed);
+    out.meanLoad = out.callbacks ? loadSum.load(memory_order_relaxed) / out.callbacks : 0;
+    out.maxLoad = loadMax.load(memory_order_relaxed);
+    out.loadP50 = (float)histogramPercentile(loadBins, kLoadBins, 0.50);
+    out.loadP99 = (float)histogramPercentile(loadBins, kLoadBins, 0.99);
+    out.jitterP1 = (float)(histogramPercentile(jitterBins, kJitterBins, 0.01) - kJitterBins / 2);
+    out.jitterP50 = (float)(histogramPercentile(jitterBins, kJitterBins, 0.50) - kJitterBins / 2);
+    out.jitterP99 = (float)(histogramPercentile(jitterBins, kJitterBins, 0.99) - kJitterBins / 2);
+}
+
+void PrintProfile(const ProfileSnapshot& profile)
+{
+    cout << " -  " << profile.callbacks << " callbacks\n";
+    cout << "    load (% of budget): mean " << profile.meanLoad << ", p50 " << profile.loadP50
+         << ", p99 " << profile.loadP99 << ", max " << profile.maxLoad << '\n';
+    cout << "    jitter (% of period): p1 " << profile.jitterP1 << ", p50 " << profile.jitterP50
+         << ", p99 " << profile.jitterP99 << '\n';
+}
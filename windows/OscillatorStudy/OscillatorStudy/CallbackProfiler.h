@@ -0,0 +1,53 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+#include "SDL.h"
+
+#include <atomic>
+
+// Always-on timing for AudioCallback. begin()/end() bracket the callback and only touch
+// preallocated atomics that the audio thread alone writes to, so there's no locking and no
+// allocation; each call is one SDL_GetPerformanceCounter plus a handful of relaxed stores.
+// The console thread reads the histograms whenever it likes.
+
+struct ProfileSnapshot
+{
+    Uint32 callbacks;
+    float meanLoad;     // percent of the callback budget
+    float maxLoad;
+    float loadP50, loadP99;
+    float jitterP1, jitterP50, jitterP99;   // callback-to-callback interval minus the nominal period, % of period
+};
+
+struct CallbackProfiler
+{
+    // 1% wide bins; the last load bin collects everything at or over budget
+    static const int kLoadBins = 101;
+    static const int kJitterBins = 201;   // -100% .. +100% of the nominal period
+
+    void configure(int sampleRate);
+    void begin();
+    void end(int frames);
+
+    void snapshot(ProfileSnapshot& out) const;
+    void requestReset() { resetRequested.store(true, std::memory_order_relaxed); }
+
+    // audio thread only; the last*s describe the most recent callback once end() returns
+    double ticksPerSample = 0;
+    Uint64 entry = 0;
+    Uint64 lastEntry = 0;
+    Uint64 lastInterval = 0;    // since the previous callback's entry, 0 for the first
+    Uint64 lastDuration = 0;
+    double lastBudget = 0;      // ticks the callback's frames last for at the device rate
+
+    std::atomic<bool> resetRequested { false };
+    std::atomic<Uint32> callbacks { 0 };
+    std::atomic<float> loadSum { 0 };
+    std::atomic<float> loadMax { 0 };
+    std::atomic<Uint32> loadBins[kLoadBins] = {};
+    std::atomic<Uint32> jitterBins[kJitterBins] = {};
+};
+
+void PrintProfile(const ProfileSnapshot& profile);
@@ -0,0 +1,81 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+// Math for tables computed by the compiler. The library's sin and cos aren't constexpr, so
+// these are short series, good to the last bit or so of a double; table builders call them
+// from constexpr functions and the finished tables end up as constants in the executable's
+// read-only data. Nothing is computed at startup, and every process running the program
+// shares the same pages. Far too slow to call per sample.
+
+static constexpr double kConstPi = 3.14159265358979323846;
+
+static constexpr double ConstAbs(double x)
+{
+    return x < 0 ? -x : x;
+}
+
+// Taylor series, for |x| <= pi / 4 where they converge in a dozen terms
+static constexpr double ConstSinSeries(double x)
+{
+    double term = x;
+    double sum = x;
+    for (int n = 3; n < 30; n += 2)
+    {
+        term *= -x * x / ((n - 1) * n);
+        sum += term;
+    }
+    return sum;
+}
+
+static constexpr double ConstCosSeries(double x)
+{
+    double term = 1.0;
+    double sum = 1.0;
+    for (int n = 2; n < 30; n += 2)
+    {
+        term *= -x * x / ((n - 1) * n);
+        sum += term;
+    }
+    return sum;
+}
+
+// sin(x + shift * pi / 2), reduced to the nearest multiple of pi / 2; meant for arguments of
+// a few cycles at most
+static constexpr double ConstSinQuadrant(double x, int shift)
+{
+    double quarters = x / (kConstPi / 2);
+    long long n = (long long)(quarters < 0 ? quarters - 0.5 : quarters + 0.5);
+    double r = x - (double)n * (kConstPi / 2);
+    switch ((n + shift) & 3)
+    {
+    case 0: return ConstSinSeries(r);
+    case 1: return ConstCosSeries(r);
+    case 2: return -ConstSinSeries(r);
+    default: return -ConstCosSeries(r);
+    }
+}
+
+static constexpr double ConstSin(double x) { return ConstSinQuadrant(x, 0); }
+static constexpr double ConstCos(double x) { return ConstSinQuadrant(x, 1); }
+
+// e^x: halved until small, the series, then squared back up
+static constexpr double ConstExp(double x)
+{
+    int halvings = 0;
+    while (ConstAbs(x) > 0.5)
+    {
+        x *= 0.5;
+        ++halvings;
+    }
+    double term = 1.0;
+    double sum = 1.0;
+    for (int n = 1; n < 20; ++n)
+    {
+        term *= x / n;
+        sum += term;
+    }
+    for (int i = 0; i < halvings; ++i) sum *= sum;
+    return sum;
+}
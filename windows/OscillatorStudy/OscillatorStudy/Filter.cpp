@@ -0,0 +1,341 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#include "stdafx.h"
+#include "Filter.h"
+
+#include <math.h>
+#include <string.h>
+
+static void ComputeCoefficients(FilterStructure structure, const FilterSettings& settings, float sampleRate, float* c)
+{
+    double cutoff = settings.cutoff;
+    double highest = 0.49 * sampleRate;
+    cutoff = cutoff < 1.0 ? 1.0 : (cutoff > highest ? highest : cutoff);
+    double q = settings.q < 0.1f ? 0.1 : settings.q;
+    double pi = 3.14159265358979323846;
+
+    if (structure == FilterSvf)
+    {
+        double g = tan(pi * cutoff / sampleRate);
+        double k = 1.0 / q;
+        double a1 = 1.0 / (1.0 + g * (g + k));
+        double m0 = 0.0, m1 = 0.0, m2 = 0.0;
+        switch (settings.response)
+        {
+        case FilterLowpass: m2 = 1.0; break;
+        case FilterHighpass: m0 = 1.0; m1 = -k; m2 = -1.0; break;
+        case FilterBandpass: m1 = k; break;
+        case FilterNotch: m0 = 1.0; m1 = -k; break;
+        }
+        c[0] = (float)a1;
+        c[1] = (float)(g * a1);
+        c[2] = (float)(g * g * a1);
+        c[3] = (float)m0;
+        c[4] = (float)m1;
+        c[5] = (float)m2;
+        return;
+    }
+
+    double w = 2.0 * pi * cutoff / sampleRate;
+    double cosine = cos(w);
+    double alpha = sin(w) / (2.0 * q);
+    double b0 = 0.0, b1 = 0.0, b2 = 0.0;
+    switch (settings.response)
+    {
+    case FilterLowpass: b0 = b2 = 0.5 * (1.0 - cosine); b1 = 1.0 - cosine; break;
+    case FilterHighpass: b0 = b2 = 0.5 * (1.0 + cosine); b1 = -(1.0 + cosine); break;
+    case FilterBandpass: b0 = alpha; b2 = -alpha; break;
+    case FilterNotch: b0 = b2 = 1.0; b1 = -2.0 * cosine; break;
+    }
+    double a0 = 1.0 + alpha;
+    c[0] = (float)(b0 / a0);
+    c[1] = (float)(b1 / a0);
+    c[2] = (float)(b2 / a0);
+    c[3] = (float)(-2.0 * cosine / a0);
+    c[4] = (float)((1.0 - alpha) / a0);
+    c[5] = 0.f;
+}
+
+FilterBank::FilterBank(FilterStructure structure, int channels, float sampleRate, const FilterSettings& initial)
+    : structure(structure), channels(channels < 1 ? 1 : (channels > kMaxFilterChannels ? kMaxFilterChannels : channels)), sampleRate(sampleRate)
+{
+    memset(steps, 0, sizeof(steps));
+    memset(state, 0, sizeof(state));
+    memset(changed, 0, sizeof(changed));
+    float c[kFilterCoefficients];
+    ComputeCoefficients(structure, initial, sampleRate, c);
+    for (int channel = 0; channel < kMaxFilterChannels; ++channel)
+    {
+        settings[channel] = initial;
+        for (int k = 0; k < kFilterCoefficients; ++k) coefficients[k][channel] = targets[k][channel] = c[k];
+    }
+}
+
+void SetFilter(FilterBank& bank, int channel, const FilterSettings& settings)
+{
+    const FilterSettings& current = bank.settings[channel];
+    if (current.response == settings.response && current.cutoff == settings.cutoff && current.q == settings.q) return;
+    bank.settings[channel] = settings;
+    bank.changed[channel] = 1;
+    bank.anyChanged = true;
+}
+
+void ResetFilter(FilterBank& bank, int channel)
+{
+    bank.state[0][channel] = 0.f;
+    bank.state[1][channel] = 0.f;
+}
+
+void ContinueFilter(FilterBank& bank, const FilterBank& previous)
+{
+    if (bank.structure != previous.structure) return;
+    int channels = bank.channels < previous.channels ? bank.channels : previous.channels;
+    for (int channel = 0; channel < channels; ++channel)
+    {
+        bank.state[0][channel] = previous.state[0][channel];
+        bank.state[1][channel] = previous.state[1][channel];
+        for (int k = 0; k < kFilterCoefficients; ++k) bank.coefficients[k][channel] = previous.coefficients[k][channel];
+        bank.changed[channel] = 1;
+    }
+    bank.anyChanged = channels > 0;
+}
+
+// channels [begin, end) one at a time, down the interleaved buffer
+template <FilterStructure Structure, bool Ramp>
+static void FilterChannelsScalar(FilterBank& bank, int begin, int end, const float* in, float* out, int frames)
+{
+    int stride = bank.channels;
+    for (int channel = begin; channel < end; ++channel)
+    {
+        float c[kFilterCoefficients], dc[kFilterCoefficients];
+        for (int k = 0; k < kFilterCoefficients; ++k)
+        {
+            c[k] = bank.coefficients[k][channel];
+            dc[k] = Ramp ? bank.steps[k][channel] : 0.f;
+        }
+        float s1 = bank.state[0][channel];
+        float s2 = bank.state[1][channel];
+        for (int i = 0; i < frames; ++i)
+        {
+            float x = in[i * stride + channel];
+            float a[kFilterCoefficients];
+            for (int k = 0; k < kFilterCoefficients; ++k) a[k] = Ramp ? c[k] + (float)i * dc[k] : c[k];
+            float y;
+            if (Structure == FilterSvf)
+            {
+                float v3 = x - s2;
+                float v1 = a[0] * s1 + a[1] * v3;
+                float v2 = s2 + a[1] * s1 + a[2] * v3;
+                s1 = 2.f * v1 - s1;
+                s2 = 2.f * v2 - s2;
+                y = a[3] * x + a[4] * v1 + a[5] * v2;
+            }
+            else
+            {
+                y = a[0] * x + s1;
+                s1 = a[1] * x - a[3] * y + s2;
+                s2 = a[2] * x - a[4] * y;
+            }
+            out[i * stride + channel] = y;
+        }
+        bank.state[0][channel] = s1;
+        bank.state[1][channel] = s2;
+    }
+}
+
+template <FilterStructure Structure>
+static void FilterScalar(FilterBank& bank, const float* in, float* out, int frames, bool ramp)
+{
+    if (ramp) FilterChannelsScalar<Structure, true>(bank, 0, bank.channels, in, out, frames);
+    else FilterChannelsScalar<Structure, false>(bank, 0, bank.channels, in, out, frames);
+}
+
+// groups of 4 channels from `begin`, as many as fit before `end`; returns where they stopped.
+// The coefficients are kept in named registers: as an array, the compiler spills them
+template <FilterStructure Structure, bool Ramp>
+static int FilterChannelsSSE2(FilterBank& bank, int begin, int end, const float* in, float* out, int frames)
+{
+    int stride = bank.channels;
+    int channel = begin;
+    for (; channel + 4 <= end; channel += 4)
+    {
+        __m128 c0 = _mm_loadu_ps(bank.coefficients[0] + channel), d0 = _mm_loadu_ps(bank.steps[0] + channel);
+        __m128 c1 = _mm_loadu_ps(bank.coefficients[1] + channel), d1 = _mm_loadu_ps(bank.steps[1] + channel);
+        __m128 c2 = _mm_loadu_ps(bank.coefficients[2] + channel), d2 = _mm_loadu_ps(bank.steps[2] + channel);
+        __m128 c3 = _mm_loadu_ps(bank.coefficients[3] + channel), d3 = _mm_loadu_ps(bank.steps[3] + channel);
+        __m128 c4 = _mm_loadu_ps(bank.coefficients[4] + channel), d4 = _mm_loadu_ps(bank.steps[4] + channel);
+        __m128 c5 = _mm_loadu_ps(bank.coefficients[5] + channel), d5 = _mm_loadu_ps(bank.steps[5] + channel);
+        __m128 s1 = _mm_loadu_ps(bank.state[0] + channel);
+        __m128 s2 = _mm_loadu_ps(bank.state[1] + channel);
+        const __m128 two = _mm_set1_ps(2.f);
+        for (int i = 0; i < frames; ++i)
+        {
+            __m128 x = _mm_loadu_ps(in + i * stride + channel);
+            __m128 a0 = c0, a1 = c1, a2 = c2, a3 = c3, a4 = c4, a5 = c5;
+            if (Ramp)
+            {
+                __m128 at = _mm_set1_ps((float)i);
+                a0 = _mm_add_ps(c0, _mm_mul_ps(at, d0));
+                a1 = _mm_add_ps(c1, _mm_mul_ps(at, d1));
+                a2 = _mm_add_ps(c2, _mm_mul_ps(at, d2));
+                a3 = _mm_add_ps(c3, _mm_mul_ps(at, d3));
+                a4 = _mm_add_ps(c4, _mm_mul_ps(at, d4));
+                a5 = _mm_add_ps(c5, _mm_mul_ps(at, d5));
+            }
+            __m128 y;
+            if (Structure == FilterSvf)
+            {
+                __m128 v3 = _mm_sub_ps(x, s2);
+                __m128 v1 = _mm_add_ps(_mm_mul_ps(a0, s1), _mm_mul_ps(a1, v3));
+                __m128 v2 = _mm_add_ps(_mm_add_ps(s2, _mm_mul_ps(a1, s1)), _mm_mul_ps(a2, v3));
+                s1 = _mm_sub_ps(_mm_mul_ps(two, v1), s1);
+                s2 = _mm_sub_ps(_mm_mul_ps(two, v2), s2);
+                y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a3, x), _mm_mul_ps(a4, v1)), _mm_mul_ps(a5, v2));
+            }
+            else
+            {
+                y = _mm_add_ps(_mm_mul_ps(a0, x), s1);
+                s1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(a1, x), _mm_mul_ps(a3, y)), s2);
+                s2 = _mm_sub_ps(_mm_mul_ps(a2, x), _mm_mul_ps(a4, y));
+            }
+            _mm_storeu_ps(out + i * stride + channel, y);
+        }
+        _mm_storeu_ps(bank.state[0] + channel, s1);
+        _mm_storeu_ps(bank.state[1] + channel, s2);
+    }
+    return channel;
+}
+
+template <FilterStructure Structure, bool Ramp>
+static void FilterRunSSE2(FilterBank& bank, const float* in, float* out, int frames)
+{
+    int done = FilterChannelsSSE2<Structure, Ramp>(bank, 0, bank.channels, in, out, frames);
+    FilterChannelsScalar<Structure, Ramp>(bank, done, bank.channels, in, out, frames);
+}
+
+template <FilterStructure Structure>
+static void FilterSSE2(FilterBank& bank, const float* in, float* out, int frames, bool ramp)
+{
+    if (ramp) FilterRunSSE2<Structure, true>(bank, in, out, frames);
+    else FilterRunSSE2<Structure, false>(bank, in, out, frames);
+}
+
+template <FilterStructure Structure, bool Ramp>
+SIMD_TARGET_AVX2 static void FilterRunAVX2(FilterBank& bank, const float* in, float* out, int frames)
+{
+    int stride = bank.channels;
+    int channel = 0;
+    for (; channel + 8 <= bank.channels; channel += 8)
+    {
+        __m256 c0 = _mm256_loadu_ps(bank.coefficients[0] + channel), d0 = _mm256_loadu_ps(bank.steps[0] + channel);
+        __m256 c1 = _mm256_loadu_ps(bank.coefficients[1] + channel), d1 = _mm256_loadu_ps(bank.steps[1] + channel);
+        __m256 c2 = _mm256_loadu_ps(bank.coefficients[2] + channel), d2 = _mm256_loadu_ps(bank.steps[2] + channel);
+        __m256 c3 = _mm256_loadu_ps(bank.coefficients[3] + channel), d3 = _mm256_loadu_ps(bank.steps[3] + channel);
+        __m256 c4 = _mm256_loadu_ps(bank.coefficients[4] + channel), d4 = _mm256_loadu_ps(bank.steps[4] + channel);
+        __m256 c5 = _mm256_loadu_ps(bank.coefficients[5] + channel), d5 = _mm256_loadu_ps(bank.steps[5] + channel);
+        __m256 s1 = _mm256_loadu_ps(bank.state[0] + channel);
+        __m256 s2 = _mm256_loadu_ps(bank.state[1] + channel);
+        for (int i = 0; i < frames; ++i)
+        {
+            __m256 x = _mm256_loadu_ps(in + i * stride + channel);
+            __m256 a0 = c0, a1 = c1, a2 = c2, a3 = c3, a4 = c4, a5 = c5;
+            if (Ramp)
+            {
+                __m256 at = _mm256_set1_ps((float)i);
+                a0 = _mm256_fmadd_ps(at, d0, c0);
+                a1 = _mm256_fmadd_ps(at, d1, c1);
+                a2 = _mm256_fmadd_ps(at, d2, c2);
+                a3 = _mm256_fmadd_ps(at, d3, c3);
+                a4 = _mm256_fmadd_ps(at, d4, c4);
+                a5 = _mm256_fmadd_ps(at, d5, c5);
+            }
+            __m256 y;
+            if (Structure == FilterSvf)
+            {
+                __m256 v3 = _mm256_sub_ps(x, s2);
+                __m256 v1 = _mm256_fmadd_ps(a0, s1, _mm256_mul_ps(a1, v3));
+                __m256 v2 = _mm256_fmadd_ps(a1, s1, _mm256_fmadd_ps(a2, v3, s2));
+                s1 = _mm256_sub_ps(_mm256_add_ps(v1, v1), s1);
+                s2 = _mm256_sub_ps(_mm256_add_ps(v2, v2), s2);
+                y = _mm256_fmadd_ps(a5, v2, _mm256_fmadd_ps(a4, v1, _mm256_mul_ps(a3, x)));
+            }
+            else
+            {
+                y = _mm256_fmadd_ps(a0, x, s1);
+                s1 = _mm256_fnmadd_ps(a3, y, _mm256_fmadd_ps(a1, x, s2));
+                s2 = _mm256_fnmadd_ps(a4, y, _mm256_mul_ps(a2, x));
+            }
+            _mm256_storeu_ps(out + i * stride + channel, y);
+        }
+        _mm256_storeu_ps(bank.state[0] + channel, s1);
+        _mm256_storeu_ps(bank.state[1] + channel, s2);
+    }
+    _mm256_zeroupper();
+    channel = FilterChannelsSSE2<Structure, Ramp>(bank, channel, bank.channels, in, out, frames);
+    FilterChannelsScalar<Structure, Ramp>(bank, channel, bank.channels, in, out, frames);
+}
+
+template <FilterStructure Structure>
+SIMD_TARGET_AVX2 static void FilterAVX2(FilterBank& bank, const float* in, float* out, int frames, bool ramp)
+{
+    if (ramp) FilterRunAVX2<Structure, true>(bank, in, out, frames);
+    else FilterRunAVX2<Structure, false>(bank, in, out, frames);
+}
+
+const FilterKernel filterKernels[] =
+{
+    { "svf-scalar", SimdScalar, FilterSvf, FilterScalar<FilterSvf> },
+    { "svf-sse2", SimdSSE2, FilterSvf, FilterSSE2<FilterSvf> },
+    { "svf-avx2", SimdAVX2, FilterSvf, FilterAVX2<FilterSvf> },
+    { "biquad-scalar", SimdScalar, FilterBiquad, FilterScalar<FilterBiquad> },
+    { "biquad-sse2", SimdSSE2, FilterBiquad, FilterSSE2<FilterBiquad> },
+    { "biquad-avx2", SimdAVX2, FilterBiquad, FilterAVX2<FilterBiquad> },
+};
+const int filterKernelCount = sizeof(filterKernels) / sizeof(filterKernels[0]);
+
+const FilterKernel& SelectFilterKernel(FilterStructure structure)
+{
+    SimdLevel level = DetectSimdLevel();
+    int best = -1;
+    for (int i = 0; i < filterKernelCount; ++i)
+        if (filterKernels[i].structure == structure && filterKernels[i].level <= level) best = i;
+    return filterKernels[best];
+}
+
+void RenderFilters(FilterBank& bank, FilterKernelFn kernel, const float* in, float* out, int frames)
+{
+    if (frames <= 0) return;
+    if (!bank.anyChanged)
+    {
+        kernel(bank, in, out, frames, false);
+        return;
+    }
+
+    // the changed channels' lines from where they are to their new settings, reached on the
+    // block's last sample; the rest stay flat
+    float inverse = 1.f / (float)(frames > 1 ? frames - 1 : 1);
+    for (int channel = 0; channel < bank.channels; ++channel)
+    {
+        if (!bank.changed[channel]) continue;
+        float c[kFilterCoefficients];
+        ComputeCoefficients(bank.structure, bank.settings[channel], bank.sampleRate, c);
+        for (int k = 0; k < kFilterCoefficients; ++k)
+        {
+            bank.targets[k][channel] = c[k];
+            bank.steps[k][channel] = (c[k] - bank.coefficients[k][channel]) * inverse;
+        }
+    }
+    kernel(bank, in, out, frames, true);
+    for (int channel = 0; channel < bank.channels; ++channel)
+    {
+        if (!bank.changed[channel]) continue;
+        for (int k = 0; k < kFilterCoefficients; ++k)
+        {
+            bank.coefficients[k][channel] = bank.targets[k][channel];
+            bank.steps[k][channel] = 0.f;
+        }
+        bank.changed[channel] = 0;
+    }
+    bank.anyChanged = false;
+}
@@ -0,0 +1,97 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+#include "SDL.h"
+#include "Simd.h"
+
+// Resonant filters for many signals at once, in two structures. The state-variable filter is
+// the topology-preserving (trapezoidal) one: its response doesn't warp or blow up when the
+// cutoff moves every sample, so it's the one to modulate. The biquad is transposed direct
+// form II with the cookbook responses, a little cheaper and the usual choice for a setting
+// that stays put.
+//
+// A FilterBank runs up to kMaxFilterChannels independent channels (voices, or the channels
+// of one signal) of one structure over an interleaved buffer, frame after frame of every
+// channel. Each channel's coefficients and state are arrays across the channels, so 4 or 8
+// neighbours are one register and every load and store is contiguous; the recursion only
+// runs frame to frame, never across lanes.
+//
+// Coefficients cost a tan or a sin and cos plus a division, so they're worked out once per
+// block for the channels whose settings changed, never per sample. That block then runs a
+// straight line from the coefficients the last one ended on to the new ones, like Smoothing
+// does for gains; blocks where nothing changed run a kernel without the ramp.
+
+static const int kMaxFilterChannels = 64;
+static const int kFilterCoefficients = 6;
+
+enum FilterStructure
+{
+    FilterSvf,      // coefficients a1 a2 a3 m0 m1 m2
+    FilterBiquad,   // b0 b1 b2 a1 a2, normalised by a0
+};
+
+enum FilterResponse
+{
+    FilterLowpass,
+    FilterHighpass,
+    FilterBandpass, // 0 dB at the centre
+    FilterNotch,
+};
+
+struct FilterSettings
+{
+    FilterResponse response = FilterLowpass;
+    float cutoff = 1000.f;      // Hz, kept below Nyquist
+    float q = 0.7071f;          // 0.7071 is flat (Butterworth) for the low and highpass
+};
+
+struct FilterBank
+{
+    alignas(32) float coefficients[kFilterCoefficients][kMaxFilterChannels];   // where the last block ended
+    alignas(32) float steps[kFilterCoefficients][kMaxFilterChannels];          // per sample, this block
+    alignas(32) float targets[kFilterCoefficients][kMaxFilterChannels];
+    alignas(32) float state[2][kMaxFilterChannels];     // the SVF's integrators, or the biquad's s1 s2
+    FilterSettings settings[kMaxFilterChannels];        // latest, maybe not yet reached
+    Uint8 changed[kMaxFilterChannels];
+    bool anyChanged = false;
+    FilterStructure structure;
+    int channels;
+    float sampleRate;
+
+    // every channel starts at `initial`, silent
+    FilterBank(FilterStructure structure, int channels, float sampleRate, const FilterSettings& initial = FilterSettings());
+
+    static void* operator new(size_t size) { return AlignedAlloc(size, 32); }
+    static void operator delete(void* memory) { AlignedFree(memory); }
+};
+
+// Whoever renders the bank. The channel glides to `settings` over the next RenderFilters;
+// setting what it already has costs nothing
+void SetFilter(FilterBank& bank, int channel, const FilterSettings& settings);
+// silences a channel's state, for a voice that starts over
+void ResetFilter(FilterBank& bank, int channel);
+// `bank` picks up where `previous` left off: the same state, gliding from its coefficients
+// to its own settings. The structures must match for the state to carry
+void ContinueFilter(FilterBank& bank, const FilterBank& previous);
+
+// in and out hold `frames` frames of bank.channels interleaved channels and may be the same
+// buffer; `ramp`: step the coefficients across the block
+typedef void (*FilterKernelFn)(FilterBank& bank, const float* in, float* out, int frames, bool ramp);
+
+struct FilterKernel
+{
+    const char* name;
+    SimdLevel level;
+    FilterStructure structure;
+    FilterKernelFn render;
+};
+
+extern const FilterKernel filterKernels[];
+extern const int filterKernelCount;
+
+const FilterKernel& SelectFilterKernel(FilterStructure structure);
+
+// filters in into out (see FilterKernelFn), ramping the channels whose settings changed
+void RenderFilters(FilterBank& bank, FilterKernelFn kernel, const float* in, float* out, int frames);
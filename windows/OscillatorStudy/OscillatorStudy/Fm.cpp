@@ -0,0 +1,481 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#include "stdafx.h"
+#include "Fm.h"
+#include "SineKernel.h"
+
+#include <math.h>
+#include <string.h>
+
+// the presets' routings, and the kernels instantiated for them
+static const Uint64 kFmStackRouting = FmRoute(0, 0) | FmRoute(1, 0) | FmRoute(2, 1) | FmRoute(3, 2) | FmRoute(4, 3) | FmRoute(5, 4) | FmCarrier(5);
+static const Uint64 kFmTwoStacksRouting = FmRoute(0, 0) | FmRoute(1, 0) | FmRoute(2, 1) | FmRoute(3, 2) | FmRoute(5, 4) | FmCarrier(3) | FmCarrier(5);
+static const Uint64 kFmThreePairsRouting = FmRoute(0, 0) | FmRoute(1, 0) | FmRoute(3, 2) | FmRoute(5, 4) | FmCarrier(1) | FmCarrier(3) | FmCarrier(5);
+static const Uint64 kFmOneToThreeRouting = FmRoute(0, 0) | FmRoute(1, 0) | FmRoute(2, 0) | FmRoute(3, 0) | FmRoute(5, 4) | FmCarrier(1) | FmCarrier(2) | FmCarrier(3) | FmCarrier(5);
+static const Uint64 kFmOrganRouting = FmRoute(0, 0) | FmCarrier(0) | FmCarrier(1) | FmCarrier(2) | FmCarrier(3) | FmCarrier(4) | FmCarrier(5);
+
+FmVoices::FmVoices()
+{
+    memset(phases, 0, sizeof(phases));
+    memset(increments, 0, sizeof(increments));
+    memset(outputs, 0, sizeof(outputs));
+    memset(levels, 0, sizeof(levels));
+    memset(gains, 0, sizeof(gains));
+    memset(notes, 0, sizeof(notes));
+    memset(ages, 0, sizeof(ages));
+    memset(&algorithm, 0, sizeof(algorithm));
+    SetFmPatch(*this, MakeFmPatch(FmThreePairs), 44100.f);
+}
+
+int FmVoices::noteOn(int note, double increment, float gain)
+{
+    int slot = activeCount;
+    if (activeCount < kMaxFmVoices)
+    {
+        ++activeCount;
+    }
+    else
+    {
+        slot = 0;
+        for (int i = 1; i < kMaxFmVoices; ++i)
+            if ((Sint32)(ages[i] - ages[slot]) < 0) slot = i;
+    }
+
+    for (int op = 0; op < kFmOperators; ++op)
+    {
+        phases[op][slot] = 0;
+        increments[op][slot] = PhaseIncrement(increment * algorithm.ratio[op] + algorithm.detune[op]);
+        outputs[op][slot] = 0.f;
+        levels[op][slot] = algorithm.level[op];
+    }
+    gains[slot] = gain;
+    notes[slot] = note;
+    ages[slot] = nextAge++;
+    return slot;
+}
+
+void FmVoices::noteOff(int note)
+{
+    for (int i = 0; i < activeCount; ++i)
+    {
+        if (notes[i] == note)
+        {
+            remove(i);
+            return;
+        }
+    }
+}
+
+void FmVoices::allNotesOff()
+{
+    while (activeCount) remove(activeCount - 1);
+}
+
+// moves the last active voice into the hole so the active range stays packed
+void FmVoices::remove(int slot)
+{
+    int last = --activeCount;
+    for (int op = 0; op < kFmOperators; ++op)
+    {
+        phases[op][slot] = phases[op][last];
+        increments[op][slot] = increments[op][last];
+        outputs[op][slot] = outputs[op][last];
+        levels[op][slot] = levels[op][last];
+        levels[op][last] = 0.f;
+        outputs[op][last] = 0.f;
+        increments[op][last] = 0;
+    }
+    gains[slot] = gains[last];
+    notes[slot] = notes[last];
+    ages[slot] = ages[last];
+    gains[last] = 0.f;
+}
+
+void SetFmPatch(FmVoices& voices, const FmPatch& patch, float sampleRate)
+{
+    voices.allNotesOff();
+    FmAlgorithm& algorithm = voices.algorithm;
+
+    // evaluation order: repeatedly the first operator whose modulators have all run; when a
+    // cycle leaves none, the first one left, and whatever closes the cycle hears last sample
+    bool placed[kFmOperators] = {};
+    for (int slot = 0; slot < kFmOperators; ++slot)
+    {
+        int pick = -1;
+        for (int op = 0; op < kFmOperators && pick < 0; ++op)
+        {
+            if (placed[op]) continue;
+            bool ready = true;
+            for (int from = 0; from < kFmOperators; ++from)
+                if (from != op && !placed[from] && patch.modulation[op][from] != 0.f) ready = false;
+            if (ready) pick = op;
+        }
+        for (int op = 0; op < kFmOperators && pick < 0; ++op)
+            if (!placed[op]) pick = op;
+        placed[pick] = true;
+        algorithm.order[slot] = pick;
+    }
+
+    algorithm.routing = 0;
+    for (int to = 0; to < kFmOperators; ++to)
+    {
+        int op = algorithm.order[to];
+        for (int from = 0; from < kFmOperators; ++from)
+        {
+            algorithm.modulation[to][from] = patch.modulation[op][algorithm.order[from]];
+            if (algorithm.modulation[to][from] != 0.f) algorithm.routing |= FmRoute(to, from);
+        }
+        algorithm.output[to] = patch.output[op];
+        if (patch.output[op] != 0.f) algorithm.routing |= FmCarrier(to);
+        algorithm.ratio[to] = patch.ratio[op];
+        algorithm.detune[to] = patch.detune[op] / sampleRate;
+        algorithm.level[to] = patch.level[op];
+        algorithm.decay[to] = patch.decay[op] > 0.f ? powf(0.001f, 1.f / (patch.decay[op] * sampleRate)) : 1.f;
+    }
+
+    const FmKernel& kernel = SelectFmKernel(algorithm.routing);
+    algorithm.name = kernel.name;
+    algorithm.render = kernel.render;
+}
+
+// The kernels work through the block in chunks, as the voice kernels do: per group of voices,
+// every operator's level ramps linearly to where its decay has it at the chunk's end, and the
+// chunk's samples are summed per lane, each sample getting its one horizontal add at the end.
+// Within a sample the operators run in slot order, each reading the outputs of its modulators
+// from registers: this sample's for earlier slots, last sample's for itself and later ones.
+
+static const int kFmChunk = 64;
+
+// the chunk's level multipliers, shared by every group
+static void ChunkDecay(const FmAlgorithm& algorithm, int count, float* decay)
+{
+    for (int slot = 0; slot < kFmOperators; ++slot)
+        decay[slot] = algorithm.decay[slot] == 1.f ? 1.f : powf(algorithm.decay[slot], (float)count);
+}
+
+// the reference: the whole matrix, looked up every sample
+static void RenderFmScalar(FmVoices& voices, int begin, int end, float* out, int frames)
+{
+    const FmAlgorithm& algorithm = voices.algorithm;
+    for (int start = 0; start < frames; start += kFmChunk)
+    {
+        int count = frames - start < kFmChunk ? frames - start : kFmChunk;
+        float decay[kFmOperators];
+        ChunkDecay(algorithm, count, decay);
+        for (int v = begin; v < end; ++v)
+        {
+            float level[kFmOperators], step[kFmOperators], output[kFmOperators];
+            for (int slot = 0; slot < kFmOperators; ++slot)
+            {
+                level[slot] = voices.levels[slot][v];
+                float target = level[slot] * decay[slot];
+                step[slot] = (target - level[slot]) * (1.f / count);
+                voices.levels[slot][v] = target;
+                output[slot] = voices.outputs[slot][v];
+            }
+            float gain = voices.gains[v];
+            for (int i = 0; i < count; ++i)
+            {
+                float sum = 0.f;
+                for (int slot = 0; slot < kFmOperators; ++slot)
+                {
+                    float x = PhaseToCycles(voices.phases[slot][v]);
+                    for (int from = 0; from < kFmOperators; ++from) x += algorithm.modulation[slot][from] * output[from];
+                    x -= floorf(x + 0.5f);
+                    output[slot] = level[slot] * SinePoly(x);
+                    sum += algorithm.output[slot] * output[slot];
+                    voices.phases[slot][v] += voices.increments[slot][v];
+                    level[slot] += step[slot];
+                }
+                out[start + i] += gain * sum;
+            }
+            for (int slot = 0; slot < kFmOperators; ++slot) voices.outputs[slot][v] = output[slot];
+        }
+    }
+}
+
+// whether a slot's output is used at all: heard, or modulating another slot
+static constexpr bool FmSlotLive(Uint64 routing, int slot)
+{
+    return (routing & FmCarrier(slot)) ||
+        (routing & (FmRoute(0, slot) | FmRoute(1, slot) | FmRoute(2, slot) | FmRoute(3, slot) | FmRoute(4, slot) | FmRoute(5, slot)) & ~FmRoute(slot, slot));
+}
+
+static constexpr bool FmSlotModulated(Uint64 routing, int slot)
+{
+    return (routing >> (slot * kFmOperators)) & ((1ull << kFmOperators) - 1);
+}
+
+// one group of voices, everything in registers as long as the algorithm allows
+struct FmLanesSSE2
+{
+    __m128i phase[kFmOperators];
+    __m128i increment[kFmOperators];
+    __m128 output[kFmOperators];
+    __m128 level[kFmOperators];
+    __m128 step[kFmOperators];
+};
+
+template <Uint64 Routing, int To, int From>
+static inline __m128 ModulateSSE2(__m128 x, const FmLanesSSE2& lanes, const FmAlgorithm& algorithm)
+{
+    if (Routing & FmRoute(To, From)) x = _mm_add_ps(x, _mm_mul_ps(_mm_set1_ps(algorithm.modulation[To][From]), lanes.output[From]));
+    return x;
+}
+
+// one operator for one sample, adding what's heard of it into `sum`
+template <Uint64 Routing, int Slot>
+static inline void StepSlotSSE2(FmLanesSSE2& lanes, const FmAlgorithm& algorithm, __m128& sum)
+{
+    if (!FmSlotLive(Routing, Slot)) return;
+    __m128 x = PhaseToCyclesSSE2(lanes.phase[Slot]);
+    if (FmSlotModulated(Routing, Slot))
+    {
+        x = ModulateSSE2<Routing, Slot, 0>(x, lanes, algorithm);
+        x = ModulateSSE2<Routing, Slot, 1>(x, lanes, algorithm);
+        x = ModulateSSE2<Routing, Slot, 2>(x, lanes, algorithm);
+        x = ModulateSSE2<Routing, Slot, 3>(x, lanes, algorithm);
+        x = ModulateSSE2<Routing, Slot, 4>(x, lanes, algorithm);
+        x = ModulateSSE2<Routing, Slot, 5>(x, lanes, algorithm);
+        x = _mm_sub_ps(x, _mm_cvtepi32_ps(_mm_cvtps_epi32(x))); // back into [-0.5, 0.5]
+    }
+    lanes.output[Slot] = _mm_mul_ps(lanes.level[Slot], SinePolySSE2(x));
+    if (Routing & FmCarrier(Slot)) sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(algorithm.output[Slot]), lanes.output[Slot]));
+    lanes.phase[Slot] = _mm_add_epi32(lanes.phase[Slot], lanes.increment[Slot]);
+    lanes.level[Slot] = _mm_add_ps(lanes.level[Slot], lanes.step[Slot]);
+}
+
+template <Uint64 Routing>
+static void RenderFmSSE2(FmVoices& voices, int begin, int end, float* out, int frames)
+{
+    const FmAlgorithm& algorithm = voices.algorithm;
+    alignas(16) float sums[kFmChunk * 4];
+    for (int start = 0; start < frames; start += kFmChunk)
+    {
+        int count = frames - start < kFmChunk ? frames - start : kFmChunk;
+        float decay[kFmOperators];
+        ChunkDecay(algorithm, count, decay);
+        __m128 perSample = _mm_set1_ps(1.f / count);
+        for (int i = 0; i < count; ++i) _mm_store_ps(sums + 4 * i, _mm_setzero_ps());
+
+        for (int v = begin; v < end; v += 4)
+        {
+            FmLanesSSE2 lanes;
+            for (int slot = 0; slot < kFmOperators; ++slot)
+            {
+                lanes.phase[slot] = _mm_load_si128(reinterpret_cast<const __m128i*>(voices.phases[slot] + v));
+                lanes.increment[slot] = _mm_load_si128(reinterpret_cast<const __m128i*>(voices.increments[slot] + v));
+                lanes.output[slot] = _mm_load_ps(voices.outputs[slot] + v);
+                lanes.level[slot] = _mm_load_ps(voices.levels[slot] + v);
+                __m128 target = _mm_mul_ps(lanes.level[slot], _mm_set1_ps(decay[slot]));
+                lanes.step[slot] = _mm_mul_ps(_mm_sub_ps(target, lanes.level[slot]), perSample);
+                _mm_store_ps(voices.levels[slot] + v, target);
+            }
+            __m128 gain = _mm_load_ps(voices.gains + v);
+            for (int i = 0; i < count; ++i)
+            {
+                __m128 sum = _mm_setzero_ps();
+                StepSlotSSE2<Routing, 0>(lanes, algorithm, sum);
+                StepSlotSSE2<Routing, 1>(lanes, algorithm, sum);
+                StepSlotSSE2<Routing, 2>(lanes, algorithm, sum);
+                StepSlotSSE2<Routing, 3>(lanes, algorithm, sum);
+                StepSlotSSE2<Routing, 4>(lanes, algorithm, sum);
+                StepSlotSSE2<Routing, 5>(lanes, algorithm, sum);
+                _mm_store_ps(sums + 4 * i, _mm_add_ps(_mm_load_ps(sums + 4 * i), _mm_mul_ps(gain, sum)));
+            }
+            for (int slot = 0; slot < kFmOperators; ++slot)
+            {
+                _mm_store_si128(reinterpret_cast<__m128i*>(voices.phases[slot] + v), lanes.phase[slot]);
+                _mm_store_ps(voices.outputs[slot] + v, lanes.output[slot]);
+            }
+        }
+
+        for (int i = 0; i < count; ++i)
+        {
+            __m128 s = _mm_load_ps(sums + 4 * i);
+            s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+            s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+            out[start + i] += _mm_cvtss_f32(s);
+        }
+    }
+}
+
+struct FmLanesAVX2
+{
+    __m256i phase[kFmOperators];
+    __m256i increment[kFmOperators];
+    __m256 output[kFmOperators];
+    __m256 level[kFmOperators];
+    __m256 step[kFmOperators];
+};
+
+template <Uint64 Routing, int To, int From>
+SIMD_TARGET_AVX2 static inline __m256 ModulateAVX2(__m256 x, const FmLanesAVX2& lanes, const FmAlgorithm& algorithm)
+{
+    if (Routing & FmRoute(To, From)) x = _mm256_fmadd_ps(_mm256_set1_ps(algorithm.modulation[To][From]), lanes.output[From], x);
+    return x;
+}
+
+template <Uint64 Routing, int Slot>
+SIMD_TARGET_AVX2 static inline void StepSlotAVX2(FmLanesAVX2& lanes, const FmAlgorithm& algorithm, __m256& sum)
+{
+    if (!FmSlotLive(Routing, Slot)) return;
+    __m256 x = PhaseToCyclesAVX2(lanes.phase[Slot]);
+    if (FmSlotModulated(Routing, Slot))
+    {
+        x = ModulateAVX2<Routing, Slot, 0>(x, lanes, algorithm);
+        x = ModulateAVX2<Routing, Slot, 1>(x, lanes, algorithm);
+        x = ModulateAVX2<Routing, Slot, 2>(x, lanes, algorithm);
+        x = ModulateAVX2<Routing, Slot, 3>(x, lanes, algorithm);
+        x = ModulateAVX2<Routing, Slot, 4>(x, lanes, algorithm);
+        x = ModulateAVX2<Routing, Slot, 5>(x, lanes, algorithm);
+        x = _mm256_sub_ps(x, _mm256_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+    }
+    lanes.output[Slot] = _mm256_mul_ps(lanes.level[Slot], SinePolyAVX2(x));
+    if (Routing & FmCarrier(Slot)) sum = _mm256_fmadd_ps(_mm256_set1_ps(algorithm.output[Slot]), lanes.output[Slot], sum);
+    lanes.phase[Slot] = _mm256_add_epi32(lanes.phase[Slot], lanes.increment[Slot]);
+    lanes.level[Slot] = _mm256_add_ps(lanes.level[Slot], lanes.step[Slot]);
+}
+
+template <Uint64 Routing>
+SIMD_TARGET_AVX2 static void RenderFmAVX2(FmVoices& voices, int begin, int end, float* out, int frames)
+{
+    const FmAlgorithm& algorithm = voices.algorithm;
+    alignas(32) float sums[kFmChunk * 8];
+    for (int start = 0; start < frames; start += kFmChunk)
+    {
+        int count = frames - start < kFmChunk ? frames - start : kFmChunk;
+        float decay[kFmOperators];
+        ChunkDecay(algorithm, count, decay);
+        __m256 perSample = _mm256_set1_ps(1.f / count);
+        for (int i = 0; i < count; ++i) _mm256_store_ps(sums + 8 * i, _mm256_setzero_ps());
+
+        for (int v = begin; v < end; v += 8)
+        {
+            FmLanesAVX2 lanes;
+            for (int slot = 0; slot < kFmOperators; ++slot)
+            {
+                lanes.phase[slot] = _mm256_load_si256(reinterpret_cast<const __m256i*>(voices.phases[slot] + v));
+                lanes.increment[slot] = _mm256_load_si256(reinterpret_cast<const __m256i*>(voices.increments[slot] + v));
+                lanes.output[slot] = _mm256_load_ps(voices.outputs[slot] + v);
+                lanes.level[slot] = _mm256_load_ps(voices.levels[slot] + v);
+                __m256 target = _mm256_mul_ps(lanes.level[slot], _mm256_set1_ps(decay[slot]));
+                lanes.step[slot] = _mm256_mul_ps(_mm256_sub_ps(target, lanes.level[slot]), perSample);
+                _mm256_store_ps(voices.levels[slot] + v, target);
+            }
+            __m256 gain = _mm256_load_ps(voices.gains + v);
+            for (int i = 0; i < count; ++i)
+            {
+                __m256 sum = _mm256_setzero_ps();
+                StepSlotAVX2<Routing, 0>(lanes, algorithm, sum);
+                StepSlotAVX2<Routing, 1>(lanes, algorithm, sum);
+                StepSlotAVX2<Routing, 2>(lanes, algorithm, sum);
+                StepSlotAVX2<Routing, 3>(lanes, algorithm, sum);
+                StepSlotAVX2<Routing, 4>(lanes, algorithm, sum);
+                StepSlotAVX2<Routing, 5>(lanes, algorithm, sum);
+                _mm256_store_ps(sums + 8 * i, _mm256_fmadd_ps(gain, sum, _mm256_load_ps(sums + 8 * i)));
+            }
+            for (int slot = 0; slot < kFmOperators; ++slot)
+            {
+                _mm256_store_si256(reinterpret_cast<__m256i*>(voices.phases[slot] + v), lanes.phase[slot]);
+                _mm256_store_ps(voices.outputs[slot] + v, lanes.output[slot]);
+            }
+        }
+
+        for (int i = 0; i < count; ++i)
+        {
+            __m256 s8 = _mm256_load_ps(sums + 8 * i);
+            __m128 s = _mm_add_ps(_mm256_castps256_ps128(s8), _mm256_extractf128_ps(s8, 1));
+            s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+            s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+            out[start + i] += _mm_cvtss_f32(s);
+        }
+    }
+    _mm256_zeroupper();
+}
+
+const FmKernel fmKernels[] =
+{
+    { "scalar", kFmAllRoutes, SimdScalar, RenderFmScalar },
+    { "any-sse2", kFmAllRoutes, SimdSSE2, RenderFmSSE2<kFmAllRoutes> },
+    { "any-avx2", kFmAllRoutes, SimdAVX2, RenderFmAVX2<kFmAllRoutes> },
+    { "stack-sse2", kFmStackRouting, SimdSSE2, RenderFmSSE2<kFmStackRouting> },
+    { "stack-avx2", kFmStackRouting, SimdAVX2, RenderFmAVX2<kFmStackRouting> },
+    { "twostacks-sse2", kFmTwoStacksRouting, SimdSSE2, RenderFmSSE2<kFmTwoStacksRouting> },
+    { "twostacks-avx2", kFmTwoStacksRouting, SimdAVX2, RenderFmAVX2<kFmTwoStacksRouting> },
+    { "threepairs-sse2", kFmThreePairsRouting, SimdSSE2, RenderFmSSE2<kFmThreePairsRouting> },
+    { "threepairs-avx2", kFmThreePairsRouting, SimdAVX2, RenderFmAVX2<kFmThreePairsRouting> },
+    { "onetothree-sse2", kFmOneToThreeRouting, SimdSSE2, RenderFmSSE2<kFmOneToThreeRouting> },
+    { "onetothree-avx2", kFmOneToThreeRouting, SimdAVX2, RenderFmAVX2<kFmOneToThreeRouting> },
+    { "organ-sse2", kFmOrganRouting, SimdSSE2, RenderFmSSE2<kFmOrganRouting> },
+    { "organ-avx2", kFmOrganRouting, SimdAVX2, RenderFmAVX2<kFmOrganRouting> },
+};
+const int fmKernelCount = sizeof(fmKernels) / sizeof(fmKernels[0]);
+
+static int CountBits(Uint64 bits)
+{
+    int count = 0;
+    for (; bits; bits &= bits - 1) ++count;
+    return count;
+}
+
+const FmKernel& SelectFmKernel(Uint64 routing)
+{
+    SimdLevel level = DetectSimdLevel();
+    int best = 0;
+    for (int i = 1; i < fmKernelCount; ++i)
+    {
+        const FmKernel& kernel = fmKernels[i];
+        if (kernel.level > level || (kernel.routing & routing) != routing) continue;
+        int bits = CountBits(kernel.routing), bestBits = CountBits(fmKernels[best].routing);
+        if (bits < bestBits || (bits == bestBits && kernel.level > fmKernels[best].level)) best = i;
+    }
+    return fmKernels[best];
+}
+
+FmPatch MakeFmPatch(FmPreset preset)
+{
+    static const Uint64 routings[] = { kFmStackRouting, kFmTwoStacksRouting, kFmThreePairsRouting, kFmOneToThreeRouting, kFmOrganRouting };
+    Uint64 routing = routings[preset];
+    FmPatch patch;
+    memset(&patch, 0, sizeof(patch));
+    int carriers = CountBits(routing >> (kFmOperators * kFmOperators));
+    for (int op = 0; op < kFmOperators; ++op)
+    {
+        bool carrier = (routing & FmCarrier(op)) != 0;
+        patch.ratio[op] = 1.f;
+        patch.level[op] = 1.f;
+        patch.decay[op] = carrier ? 4.f : 1.5f;    // the index falls faster than the sound: bright attack, mellow tail
+        patch.output[op] = carrier ? 1.f / carriers : 0.f;
+        for (int from = 0; from < kFmOperators; ++from)
+            if (routing & FmRoute(op, from)) patch.modulation[op][from] = from == op ? 0.1f : 0.25f;
+    }
+
+    switch (preset)
+    {
+    case FmThreePairs:
+        patch.ratio[2] = 14.f;      // the tine
+        patch.decay[2] = 0.3f;
+        patch.detune[5] = 0.7f;
+        break;
+    case FmOneToThree:
+        patch.ratio[2] = 2.f;
+        patch.ratio[3] = 3.f;
+        break;
+    case FmOrgan:
+        {
+            static const float drawbars[] = { 0.5f, 1.f, 1.5f, 2.f, 3.f, 4.f };
+            for (int op = 0; op < kFmOperators; ++op)
+            {
+                patch.ratio[op] = drawbars[op];
+                patch.decay[op] = 0.f;
+            }
+            patch.modulation[0][0] = 0.05f;
+        }
+        break;
+    default:
+        break;
+    }
+    return patch;
+}
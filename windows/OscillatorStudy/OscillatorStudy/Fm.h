@@ -0,0 +1,119 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+#include "SDL.h"
+#include "Phase.h"
+#include "Simd.h"
+
+// DX-style phase modulation: every voice has kFmOperators sine operators, and any operator
+// can modulate the phase of any other (itself included, as feedback) by an amount from the
+// patch's matrix. The patch is compiled once into an FmAlgorithm: operators are put into an
+// evaluation order where each modulator runs before what it modulates (a connection against
+// that order, like feedback, hears the previous sample), and the connections that exist
+// become a routing mask. Kernels are templates over that mask, instantiated for a set of
+// common algorithms, so for a known algorithm the inner loop is exactly its multiply-adds
+// with no matrix lookups and no branches; anything else runs the all-connections instance.
+//
+// Voices are structure-of-arrays per operator, like VoicePool, so each operator of 4 or 8
+// neighbouring voices is one register; the active voices are packed at the front.
+
+static const int kFmOperators = 6;
+static const int kMaxFmVoices = 128;
+static const int kFmGroup = 8;
+
+// routing mask: bit to * kFmOperators + from is "from modulates to" (in evaluation order),
+// bit 36 + op is "op is heard"
+static constexpr Uint64 FmRoute(int to, int from) { return 1ull << (to * kFmOperators + from); }
+static constexpr Uint64 FmCarrier(int op) { return 1ull << (kFmOperators * kFmOperators + op); }
+static const Uint64 kFmAllRoutes = (1ull << (kFmOperators * kFmOperators + kFmOperators)) - 1;
+
+struct FmPatch
+{
+    float ratio[kFmOperators];      // operator frequency / note frequency
+    float detune[kFmOperators];     // Hz on top
+    float level[kFmOperators];      // at note on
+    float decay[kFmOperators];      // seconds to fall 60 dB, 0 holds the level
+    float modulation[kFmOperators][kFmOperators];   // [to][from], cycles of phase per unit output
+    float output[kFmOperators];     // how much of each operator is heard
+};
+
+struct FmVoices;
+// adds voices [begin, end) (multiples of kFmGroup) into out[0..frames)
+typedef void (*FmKernelFn)(FmVoices& voices, int begin, int end, float* out, int frames);
+
+struct FmAlgorithm
+{
+    int order[kFmOperators];        // order[slot] is the patch operator evaluated slot-th
+    Uint64 routing;                 // in slots
+    float modulation[kFmOperators][kFmOperators];   // the patch's, in slots
+    float output[kFmOperators];
+    float ratio[kFmOperators];
+    float detune[kFmOperators];     // cycles per sample
+    float level[kFmOperators];
+    float decay[kFmOperators];      // level multiplier per sample
+    const char* name;               // of the kernel it runs on
+    FmKernelFn render;
+};
+
+// fixed capacity, nothing is allocated once it exists; owned by the audio thread once playing
+struct FmVoices
+{
+    alignas(32) Phase phases[kFmOperators][kMaxFmVoices];       // [slot][voice]
+    alignas(32) Uint32 increments[kFmOperators][kMaxFmVoices];
+    alignas(32) float outputs[kFmOperators][kMaxFmVoices];      // last sample's, for feedback
+    alignas(32) float levels[kFmOperators][kMaxFmVoices];
+    alignas(32) float gains[kMaxFmVoices];
+    int notes[kMaxFmVoices];
+    Uint32 ages[kMaxFmVoices];
+    int activeCount = 0;
+    Uint32 nextAge = 0;
+    FmAlgorithm algorithm;
+
+    FmVoices();
+
+    // starts a voice on the current patch (increment of the note in cycles per sample);
+    // when all are busy the oldest is stolen. Returns its slot
+    int noteOn(int note, double increment, float gain);
+    void noteOff(int note);
+    void allNotesOff();
+
+    int renderCount() const { return (activeCount + kFmGroup - 1) / kFmGroup * kFmGroup; }
+
+    static void* operator new(size_t size) { return AlignedAlloc(size, 32); }
+    static void operator delete(void* memory) { AlignedFree(memory); }
+
+private:
+    void remove(int slot);
+};
+
+// compiles `patch` and picks its kernel; stops every voice, whose state is in the old order
+void SetFmPatch(FmVoices& voices, const FmPatch& patch, float sampleRate);
+
+struct FmKernel
+{
+    const char* name;
+    Uint64 routing;     // everything the kernel computes; it runs any patch whose routing is a subset
+    SimdLevel level;
+    FmKernelFn render;
+};
+
+extern const FmKernel fmKernels[];
+extern const int fmKernelCount;
+
+// the fastest kernel the CPU runs that covers `routing` with the fewest connections
+const FmKernel& SelectFmKernel(Uint64 routing);
+
+// a few algorithms to start patches from, in DX7 terms (numbered in evaluation order here)
+enum FmPreset
+{
+    FmStack,        // 0 -> 1 -> 2 -> 3 -> 4 -> 5, feedback on 0
+    FmTwoStacks,    // DX7 1: 0 -> 1 -> 2 -> 3 and 4 -> 5, feedback on 0
+    FmThreePairs,   // DX7 5: 0 -> 1, 2 -> 3, 4 -> 5, feedback on 0 (the electric piano)
+    FmOneToThree,   // DX7 22: 0 modulates 1, 2 and 3, plus 4 -> 5
+    FmOrgan,        // DX7 32: six carriers, feedback on 0
+};
+
+// the preset's connections at a moderate index, ratios 1 with a little spread, gentle decays
+FmPatch MakeFmPatch(FmPreset preset);
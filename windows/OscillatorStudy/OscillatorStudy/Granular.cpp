@@ -0,0 +1,487 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#include "stdafx.h"
+#include "Granular.h"
+#include "ConstMath.h"
+
+#include <math.h>
+#include <string.h>
+
+struct GrainWindows
+{
+    float shapes[GrainWindowCount][kGrainWindowSize + 1];
+};
+
+static constexpr double kTukeyTaper = 0.25;     // of the grain, at each end
+static constexpr double kGaussWidth = 0.15;     // standard deviation, in grains
+
+// x from 0 to 1 across the grain
+static constexpr double WindowValue(GrainWindow window, double x)
+{
+    if (window == WindowTukey)
+    {
+        double edge = x < 0.5 ? x : 1.0 - x;
+        return edge < kTukeyTaper ? 0.5 - 0.5 * ConstCos(kConstPi * edge / kTukeyTaper) : 1.0;
+    }
+    if (window == WindowGauss)
+    {
+        double floor = ConstExp(-0.5 * (0.5 / kGaussWidth) * (0.5 / kGaussWidth));
+        double d = (x - 0.5) / kGaussWidth;
+        return (ConstExp(-0.5 * d * d) - floor) / (1.0 - floor);
+    }
+    return 0.5 - 0.5 * ConstCos(2.0 * kConstPi * x);
+}
+
+static constexpr GrainWindows MakeGrainWindows()
+{
+    GrainWindows windows = {};
+    for (int w = 0; w < GrainWindowCount; ++w)
+        for (int j = 0; j <= kGrainWindowSize; ++j)
+            windows.shapes[w][j] = (float)WindowValue((GrainWindow)w, (double)j / kGrainWindowSize);
+    return windows;
+}
+
+// computed by the compiler, like the wavetables
+static constexpr GrainWindows grainWindows = MakeGrainWindows();
+
+const float* GetGrainWindow(GrainWindow window)
+{
+    return grainWindows.shapes[window < GrainWindowCount ? window : WindowHann];
+}
+
+GrainCloud::GrainCloud()
+{
+    memset(grains, 0, sizeof(grains));
+    for (int g = 0; g + 1 < kMaxGrains; ++g) grains[g].next = &grains[g + 1];
+    freeGrains = &grains[0];
+    memset(accumulators, 0, sizeof(accumulators));
+}
+
+// a double in [0, 2^32), split into whole and 2^-32ths
+static inline void ToFixed(double value, Sint32& whole, Uint32& fraction)
+{
+    double w = floor(value);
+    double f = (value - w) * 4294967296.0;
+    whole = (Sint32)w;
+    fraction = (Uint32)(f < 4294967295.0 ? f : 4294967295.0);
+}
+
+bool SpawnGrain(GrainCloud& cloud, const GrainParameters& grain, int delay)
+{
+    if (!cloud.source || !(grain.rate > 0.0) || !(grain.position >= 0.0) || delay < 0) return false;
+
+    // its last frame reads samples index and index + 1, which have to be in the source
+    double room = (cloud.sourceLength - 2 - grain.position) / grain.rate;
+    int length = grain.length < room ? grain.length : (int)room;
+    if (length < 2) return false;
+
+    Grain* g = cloud.freeGrains;
+    if (!g)
+    {
+        ++cloud.dropped;
+        return false;
+    }
+    cloud.freeGrains = g->next;
+    g->next = cloud.activeGrains;
+    cloud.activeGrains = g;
+    ++cloud.activeCount;
+
+    ToFixed(grain.position, g->index, g->fraction);
+    ToFixed(grain.rate, g->rateWhole, g->rateFraction);
+    g->window = 0;
+    g->windowIncrement = (Uint32)(4294967296.0 / length);
+    g->windowOffset = (grain.window < GrainWindowCount ? grain.window : WindowHann) * (kGrainWindowSize + 1);
+    g->delay = delay;
+    g->remaining = length;
+    if (cloud.channels == 2)
+    {
+        float pan = grain.pan < 0.f ? 0.f : (grain.pan > 1.f ? 1.f : grain.pan);
+        g->gains[0] = grain.gain * cosf(1.5707963f * pan);
+        g->gains[1] = grain.gain * sinf(1.5707963f * pan);
+    }
+    else
+    {
+        g->gains[0] = grain.gain;
+        g->gains[1] = 0.f;
+    }
+    return true;
+}
+
+static const int kFractionShift = 8;                                // the top 24 bits make a float
+static const float kFractionScale = 1.f / 16777216.f;
+static const int kWindowShift = 32 - kGrainWindowBits;
+static const Uint32 kWindowFractionMask = (1u << kWindowShift) - 1; // 22 bits, also exact
+static const float kWindowFractionScale = 1.f / (float)(1u << kWindowShift);
+
+template <bool Stereo>
+static void RenderGrainsScalar(GrainCloud& cloud, int frames)
+{
+    const float* source = cloud.source;
+    for (Grain* g = cloud.activeGrains; g; g = g->next)
+    {
+        const float* window = grainWindows.shapes[0] + g->windowOffset;
+        int end = g->delay + g->remaining < frames ? g->delay + g->remaining : frames;
+        Sint32 index = g->index;
+        Uint32 fraction = g->fraction;
+        Phase phase = g->window;
+        for (int i = g->delay; i < end; ++i)
+        {
+            float t = (float)(fraction >> kFractionShift) * kFractionScale;
+            float x = source[index] + t * (source[index + 1] - source[index]);
+            int w = (int)(phase >> kWindowShift);
+            float u = (float)(phase & kWindowFractionMask) * kWindowFractionScale;
+            float value = x * (window[w] + u * (window[w + 1] - window[w]));
+            cloud.accumulators[0][i][0] += value * g->gains[0];
+            if (Stereo) cloud.accumulators[1][i][0] += value * g->gains[1];
+
+            Uint32 next = fraction + g->rateFraction;
+            index += g->rateWhole + (next < fraction ? 1 : 0);
+            fraction = next;
+            phase += g->windowIncrement;
+        }
+        g->index = index;
+        g->fraction = fraction;
+        g->window = phase;
+    }
+}
+
+// One batch's state, a lane per grain; lanes past the batch's grains never play (their
+// first frame is after their last) and read the source's first samples harmlessly
+template <int Lanes>
+struct GrainLanes
+{
+    alignas(32) Sint32 index[Lanes];
+    alignas(32) Uint32 fraction[Lanes];
+    alignas(32) Sint32 rateWhole[Lanes];
+    alignas(32) Uint32 rateFraction[Lanes];
+    alignas(32) Uint32 window[Lanes];
+    alignas(32) Uint32 windowIncrement[Lanes];
+    alignas(32) Sint32 windowOffset[Lanes];
+    alignas(32) Sint32 beforeFirst[Lanes];  // delay - 1
+    alignas(32) Sint32 ends[Lanes];         // delay + remaining
+    alignas(32) float left[Lanes];
+    alignas(32) float right[Lanes];
+    Grain* grains[Lanes];
+    int count;
+    int first;      // the frames any lane plays, so a batch doesn't step through the rest
+    int end;
+};
+
+// takes up to Lanes grains from `g` on for the next `frames`; returns where the next batch starts
+template <int Lanes>
+static Grain* LoadLanes(GrainLanes<Lanes>& lanes, Grain* g, int frames)
+{
+    lanes.count = 0;
+    lanes.first = frames;
+    lanes.end = 0;
+    for (int lane = 0; lane < Lanes; ++lane)
+    {
+        if (g)
+        {
+            lanes.grains[lane] = g;
+            lanes.index[lane] = g->index;
+            lanes.fraction[lane] = g->fraction;
+            lanes.rateWhole[lane] = g->rateWhole;
+            lanes.rateFraction[lane] = g->rateFraction;
+            lanes.window[lane] = g->window;
+            lanes.windowIncrement[lane] = g->windowIncrement;
+            lanes.windowOffset[lane] = g->windowOffset;
+            lanes.beforeFirst[lane] = g->delay - 1;
+            lanes.ends[lane] = g->delay + g->remaining;
+            lanes.left[lane] = g->gains[0];
+            lanes.right[lane] = g->gains[1];
+            lanes.count = lane + 1;
+            if (g->delay < lanes.first) lanes.first = g->delay;
+            if (g->delay + g->remaining > lanes.end) lanes.end = g->delay + g->remaining;
+            g = g->next;
+        }
+        else
+        {
+            lanes.index[lane] = lanes.fraction[lane] = lanes.rateWhole[lane] = lanes.rateFraction[lane] = 0;
+            lanes.window[lane] = lanes.windowIncrement[lane] = lanes.windowOffset[lane] = 0;
+            lanes.beforeFirst[lane] = 0;
+            lanes.ends[lane] = 0;
+            lanes.left[lane] = lanes.right[lane] = 0.f;
+        }
+    }
+    return g;
+}
+
+template <int Lanes>
+static void StoreLanes(const GrainLanes<Lanes>& lanes)
+{
+    for (int lane = 0; lane < lanes.count; ++lane)
+    {
+        Grain* g = lanes.grains[lane];
+        g->index = lanes.index[lane];
+        g->fraction = lanes.fraction[lane];
+        g->window = lanes.window[lane];
+    }
+}
+
+// unsigned a < b, which SSE2 can't compare directly
+static inline __m128i CarrySSE2(__m128i sum, __m128i before)
+{
+    const __m128i sign = _mm_set1_epi32((int)0x80000000u);
+    return _mm_cmpgt_epi32(_mm_xor_si128(before, sign), _mm_xor_si128(sum, sign));
+}
+
+// no gathers before AVX2: each lane's pair of neighbours is one 64-bit load, then the four
+// pairs are transposed into the lower and the upper neighbours
+static inline __m128 LoadPairSSE2(const float* at)
+{
+    return _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(at)));
+}
+
+static inline __m128 LerpSSE2(const float* base, __m128i index, __m128 t)
+{
+    alignas(16) Sint32 i[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(i), index);
+    __m128 pairs01 = _mm_unpacklo_ps(LoadPairSSE2(base + i[0]), LoadPairSSE2(base + i[1]));   // a0 a1 b0 b1
+    __m128 pairs23 = _mm_unpacklo_ps(LoadPairSSE2(base + i[2]), LoadPairSSE2(base + i[3]));
+    __m128 a = _mm_movelh_ps(pairs01, pairs23);
+    __m128 b = _mm_movehl_ps(pairs23, pairs01);
+    return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+}
+
+// 4 grains at a time, alternating between the two halves of the accumulator lanes
+template <bool Stereo>
+static void RenderGrainsSSE2(GrainCloud& cloud, int frames)
+{
+    const float* windows = grainWindows.shapes[0];
+    GrainLanes<4> lanes;
+    int half = 0;
+    for (Grain* g = cloud.activeGrains; g; half ^= 4)
+    {
+        g = LoadLanes(lanes, g, frames);
+        __m128i index = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.index));
+        __m128i fraction = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.fraction));
+        __m128i rateWhole = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.rateWhole));
+        __m128i rateFraction = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.rateFraction));
+        __m128i window = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.window));
+        __m128i windowIncrement = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.windowIncrement));
+        __m128i windowOffset = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.windowOffset));
+        __m128i beforeFirst = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.beforeFirst));
+        __m128i end = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.ends));
+        __m128 left = _mm_load_ps(lanes.left);
+        __m128 right = _mm_load_ps(lanes.right);
+
+        int last = lanes.end < frames ? lanes.end : frames;
+        for (int i = lanes.first; i < last; ++i)
+        {
+            __m128i frame = _mm_set1_epi32(i);
+            __m128i active = _mm_and_si128(_mm_cmpgt_epi32(frame, beforeFirst), _mm_cmpgt_epi32(end, frame));
+
+            __m128 t = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(fraction, kFractionShift)), _mm_set1_ps(kFractionScale));
+            __m128 x = LerpSSE2(cloud.source, index, t);
+            __m128 u = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(window, _mm_set1_epi32((int)kWindowFractionMask))), _mm_set1_ps(kWindowFractionScale));
+            __m128 w = LerpSSE2(windows, _mm_add_epi32(_mm_srli_epi32(window, kWindowShift), windowOffset), u);
+            __m128 value = _mm_and_ps(_mm_mul_ps(x, w), _mm_castsi128_ps(active));
+
+            float* l = cloud.accumulators[0][i] + half;
+            _mm_store_ps(l, _mm_add_ps(_mm_load_ps(l), _mm_mul_ps(value, left)));
+            if (Stereo)
+            {
+                float* r = cloud.accumulators[1][i] + half;
+                _mm_store_ps(r, _mm_add_ps(_mm_load_ps(r), _mm_mul_ps(value, right)));
+            }
+
+            __m128i next = _mm_add_epi32(fraction, _mm_and_si128(rateFraction, active));
+            index = _mm_sub_epi32(_mm_add_epi32(index, _mm_and_si128(rateWhole, active)), CarrySSE2(next, fraction));
+            fraction = next;
+            window = _mm_add_epi32(window, _mm_and_si128(windowIncrement, active));
+        }
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes.index), index);
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes.fraction), fraction);
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes.window), window);
+        StoreLanes(lanes);
+    }
+}
+
+SIMD_TARGET_AVX2 static inline __m256 LerpAVX2(const float* base, __m256i index, __m256 t)
+{
+    __m256 a = _mm256_i32gather_ps(base, index, 4);
+    __m256 b = _mm256_i32gather_ps(base + 1, index, 4);
+    return _mm256_fmadd_ps(t, _mm256_sub_ps(b, a), a);
+}
+
+template <bool Stereo>
+SIMD_TARGET_AVX2 static void RenderGrainsAVX2(GrainCloud& cloud, int frames)
+{
+    const float* windows = grainWindows.shapes[0];
+    const __m256i sign = _mm256_set1_epi32((int)0x80000000u);
+    GrainLanes<8> lanes;
+    for (Grain* g = cloud.activeGrains; g;)
+    {
+        g = LoadLanes(lanes, g, frames);
+        __m256i index = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.index));
+        __m256i fraction = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.fraction));
+        __m256i rateWhole = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.rateWhole));
+        __m256i rateFraction = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.rateFraction));
+        __m256i window = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.window));
+        __m256i windowIncrement = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.windowIncrement));
+        __m256i windowOffset = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.windowOffset));
+        __m256i beforeFirst = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.beforeFirst));
+        __m256i end = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.ends));
+        __m256 left = _mm256_load_ps(lanes.left);
+        __m256 right = _mm256_load_ps(lanes.right);
+
+        int last = lanes.end < frames ? lanes.end : frames;
+        for (int i = lanes.first; i < last; ++i)
+        {
+            __m256i frame = _mm256_set1_epi32(i);
+            __m256i active = _mm256_and_si256(_mm256_cmpgt_epi32(frame, beforeFirst), _mm256_cmpgt_epi32(end, frame));
+
+            __m256 t = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(fraction, kFractionShift)), _mm256_set1_ps(kFractionScale));
+            __m256 x = LerpAVX2(cloud.source, index, t);
+            __m256 u = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(window, _mm256_set1_epi32((int)kWindowFractionMask))), _mm256_set1_ps(kWindowFractionScale));
+            __m256 w = LerpAVX2(windows, _mm256_add_epi32(_mm256_srli_epi32(window, kWindowShift), windowOffset), u);
+            __m256 value = _mm256_and_ps(_mm256_mul_ps(x, w), _mm256_castsi256_ps(active));
+
+            float* l = cloud.accumulators[0][i];
+            _mm256_store_ps(l, _mm256_fmadd_ps(value, left, _mm256_load_ps(l)));
+            if (Stereo)
+            {
+                float* r = cloud.accumulators[1][i];
+                _mm256_store_ps(r, _mm256_fmadd_ps(value, right, _mm256_load_ps(r)));
+            }
+
+            __m256i next = _mm256_add_epi32(fraction, _mm256_and_si256(rateFraction, active));
+            __m256i carry = _mm256_cmpgt_epi32(_mm256_xor_si256(fraction, sign), _mm256_xor_si256(next, sign));
+            index = _mm256_sub_epi32(_mm256_add_epi32(index, _mm256_and_si256(rateWhole, active)), carry);
+            fraction = next;
+            window = _mm256_add_epi32(window, _mm256_and_si256(windowIncrement, active));
+        }
+
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes.index), index);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes.fraction), fraction);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes.window), window);
+        StoreLanes(lanes);
+    }
+    _mm256_zeroupper();
+}
+
+// the channel count is the cloud's, fixed before it plays; each kernel has both loops
+static void RenderGrainKernelScalar(GrainCloud& cloud, int frames)
+{
+    if (cloud.channels == 2) RenderGrainsScalar<true>(cloud, frames);
+    else RenderGrainsScalar<false>(cloud, frames);
+}
+
+static void RenderGrainKernelSSE2(GrainCloud& cloud, int frames)
+{
+    if (cloud.channels == 2) RenderGrainsSSE2<true>(cloud, frames);
+    else RenderGrainsSSE2<false>(cloud, frames);
+}
+
+SIMD_TARGET_AVX2 static void RenderGrainKernelAVX2(GrainCloud& cloud, int frames)
+{
+    if (cloud.channels == 2) RenderGrainsAVX2<true>(cloud, frames);
+    else RenderGrainsAVX2<false>(cloud, frames);
+}
+
+const GrainKernel grainKernels[] =
+{
+    { "scalar", SimdScalar, RenderGrainKernelScalar },
+    { "sse2", SimdSSE2, RenderGrainKernelSSE2 },
+    { "avx2", SimdAVX2, RenderGrainKernelAVX2 },
+};
+const int grainKernelCount = sizeof(grainKernels) / sizeof(grainKernels[0]);
+
+const GrainKernel& SelectGrainKernel()
+{
+    SimdLevel level = DetectSimdLevel();
+    int best = 0;
+    for (int i = 1; i < grainKernelCount; ++i)
+        if (grainKernels[i].level <= level) best = i;
+    return grainKernels[best];
+}
+
+// xorshift32, as a float in [-1, 1)
+static inline float Random(GrainCloud& cloud)
+{
+    Uint32 x = cloud.random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    cloud.random = x;
+    return (float)(Sint32)x * (1.f / 2147483648.f);
+}
+
+// every grain the settings ask for in the next `frames`, each on its own frame; the
+// fraction of a frame between them carries over, so the density is exact on average
+static void ScheduleGrains(GrainCloud& cloud, int frames)
+{
+    const GrainCloudSettings& settings = cloud.settings;
+    if (settings.density <= 0.f || !cloud.source)
+    {
+        cloud.nextSpawn = 0.0;
+        return;
+    }
+    double interval = cloud.sampleRate / settings.density;
+    int length = (int)(settings.seconds * cloud.sampleRate);
+    while (cloud.nextSpawn < frames)
+    {
+        GrainParameters grain;
+        double position = settings.position + settings.spray * Random(cloud);
+        grain.position = (position < 0.0 ? 0.0 : (position > 1.0 ? 1.0 : position)) * (cloud.sourceLength - 2);
+        grain.rate = settings.rate * exp2f(settings.detune * Random(cloud) * (1.f / 12.f));
+        grain.length = length;
+        grain.gain = settings.gain;
+        grain.pan = 0.5f + settings.spread * Random(cloud);
+        grain.window = settings.window;
+        SpawnGrain(cloud, grain, (int)cloud.nextSpawn);
+        cloud.nextSpawn += interval;
+    }
+    cloud.nextSpawn -= frames;
+}
+
+// moves every grain on by `frames`, returning the ones that finished to the free list
+static void RetireGrains(GrainCloud& cloud, int frames)
+{
+    Grain** link = &cloud.activeGrains;
+    while (Grain* g = *link)
+    {
+        int played = frames - g->delay;
+        played = played < 0 ? 0 : (played > g->remaining ? g->remaining : played);
+        g->delay = g->delay > frames ? g->delay - frames : 0;
+        g->remaining -= played;
+        if (g->remaining > 0)
+        {
+            link = &g->next;
+            continue;
+        }
+        *link = g->next;
+        g->next = cloud.freeGrains;
+        cloud.freeGrains = g;
+        --cloud.activeCount;
+    }
+}
+
+void RenderGrains(GrainCloud& cloud, GrainKernelFn kernel, float* out, int frames)
+{
+    int channels = cloud.channels;
+    for (int start = 0; start < frames; start += kGrainChunk)
+    {
+        int count = frames - start < kGrainChunk ? frames - start : kGrainChunk;
+        ScheduleGrains(cloud, count);
+        if (!cloud.activeCount) continue;
+
+        for (int c = 0; c < channels; ++c) memset(cloud.accumulators[c], 0, count * sizeof(cloud.accumulators[c][0]));
+        kernel(cloud, count);
+        float* dst = out + start * channels;
+        for (int i = 0; i < count; ++i)
+        {
+            for (int c = 0; c < channels; ++c)
+            {
+                const float* lanes = cloud.accumulators[c][i];
+                float sum = 0.f;
+                for (int lane = 0; lane < kGrainBatch; ++lane) sum += lanes[lane];
+                dst[i * channels + c] += sum;
+            }
+        }
+        RetireGrains(cloud, count);
+    }
+}
@@ -0,0 +1,123 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+#include "SDL.h"
+#include "Phase.h"
+#include "Simd.h"
+
+// Granular synthesis: thousands of short grains a second, each a windowed snippet of a
+// source buffer read at its own rate (its pitch) and panned. A grain reads the source with
+// a 32.32 fixed-point position, like a phase that doesn't wrap, and its window with a Phase
+// running once from 0 across its length, through one of the constant window tables.
+//
+// Grains come from a fixed pool threaded on an intrusive list: a free grain's `next` links
+// the free list, a playing one's the active list, so starting and retiring a grain is a
+// couple of pointer moves and the audio thread never allocates. Rendering goes a chunk at a
+// time: the cloud's scheduler starts the grains due in the chunk, each at its exact frame,
+// then kernels take the active grains kGrainBatch at a time, load their state into lanes
+// (one grain per lane) and run the chunk, masking each lane to the frames its grain plays.
+// Lanes add into their own accumulator per frame, summed across lanes once per chunk.
+
+static const int kMaxGrains = 4096;
+static const int kGrainBatch = 8;       // lanes per accumulator frame (AVX2's 8, SSE2 runs 4 twice)
+static const int kGrainChunk = 256;     // frames per scheduling and rendering pass
+static const int kGrainWindowBits = 10;
+static const int kGrainWindowSize = 1 << kGrainWindowBits;
+
+enum GrainWindow
+{
+    WindowHann,
+    WindowTukey,    // flat, with cosine tapers over the outer quarters
+    WindowGauss,    // narrower and smoother, shifted to reach 0 at the ends
+    GrainWindowCount,
+};
+
+// kGrainWindowSize + 1 entries from 0 to the end of the grain, so interpolation never wraps
+const float* GetGrainWindow(GrainWindow window);
+
+struct Grain
+{
+    Grain* next;            // free list, or active list while it plays
+    Sint32 index;           // source position in samples...
+    Uint32 fraction;        // ...and below, in 2^-32 of one
+    Sint32 rateWhole;       // source samples per frame, the same way
+    Uint32 rateFraction;
+    Phase window;           // 0 at the start, just short of 2^32 at the last frame
+    Uint32 windowIncrement;
+    int windowOffset;       // of its table from the first one's
+    int delay;              // frames of the current chunk before it starts
+    int remaining;          // frames it still plays
+    float gains[2];         // left and right (mono: gains[0])
+};
+
+// what a grain starts with
+struct GrainParameters
+{
+    double position;        // in source samples
+    double rate;            // source samples per frame, > 0; 2 is an octave up
+    int length;             // frames
+    float gain;
+    float pan;              // 0 left, 0.5 centre, 1 right (equal power); ignored in mono
+    GrainWindow window;
+};
+
+// what the scheduler spawns; owned by whoever renders the cloud
+struct GrainCloudSettings
+{
+    float density = 0.f;        // grains per second, 0 for none
+    float seconds = 0.05f;      // per grain
+    float position = 0.5f;      // in the source, 0 .. 1
+    float spray = 0.f;          // random offset up to this either way, as a fraction of the source
+    float rate = 1.f;
+    float detune = 0.f;         // random, up to this many semitones either way
+    float spread = 0.f;         // random pan, up to this either side of centre (0 .. 0.5)
+    float gain = 0.1f;
+    GrainWindow window = WindowHann;
+};
+
+struct GrainCloud
+{
+    Grain grains[kMaxGrains];
+    Grain* freeGrains;
+    Grain* activeGrains = nullptr;
+    int activeCount = 0;
+    Uint32 dropped = 0;             // grains that found the pool empty
+    const float* source = nullptr;  // not owned; set before playing
+    int sourceLength = 0;
+    int channels = 1;               // 1, or 2 interleaved
+    float sampleRate = 44100.f;
+    GrainCloudSettings settings;
+    double nextSpawn = 0.0;         // frames from the current one to the next scheduled grain
+    Uint32 random = 1;              // xorshift state for the settings' random parts
+    alignas(32) float accumulators[2][kGrainChunk][kGrainBatch];    // [channel][frame][lane]
+
+    GrainCloud();
+
+    static void* operator new(size_t size) { return AlignedAlloc(size, 32); }
+    static void operator delete(void* memory) { AlignedFree(memory); }
+};
+
+// starts a grain `delay` frames into the next RenderGrains, cut short where it would read
+// past the source; false when the pool is empty or it wouldn't sound
+bool SpawnGrain(GrainCloud& cloud, const GrainParameters& grain, int delay);
+
+// adds every active grain's next `frames` (<= kGrainChunk) frames into the accumulators
+typedef void (*GrainKernelFn)(GrainCloud& cloud, int frames);
+
+struct GrainKernel
+{
+    const char* name;
+    SimdLevel level;
+    GrainKernelFn render;
+};
+
+extern const GrainKernel grainKernels[];
+extern const int grainKernelCount;
+
+const GrainKernel& SelectGrainKernel();
+
+// the scheduler's grains and any spawned directly, added into out (interleaved when the
+// cloud is stereo); grains that finish go back to the pool
+void RenderGrains(GrainCloud& cloud, GrainKernelFn kernel, float* out, int frames);
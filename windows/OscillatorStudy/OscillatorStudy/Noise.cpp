@@ -0,0 +1,217 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#include "stdafx.h"
+#include "Noise.h"
+
+#include <math.h>
+
+// Chris Wellons' lowbias32: two multiply-xorshift rounds, every output bit depends on every
+// input bit. Cheap enough to run per sample, per row
+static const Uint32 kHashMultiply1 = 0x7feb352du;
+static const Uint32 kHashMultiply2 = 0x846ca68bu;
+
+static inline Uint32 Hash(Uint32 x)
+{
+    x ^= x >> 16;
+    x *= kHashMultiply1;
+    x ^= x >> 15;
+    x *= kHashMultiply2;
+    x ^= x >> 16;
+    return x;
+}
+
+static const float kToUnit = 1.f / 2147483648.f;   // a hash read as signed -> [-1, 1)
+static const float kPinkGain = 0.25f / 2.309401f;   // sum of 16 uniforms has rms sqrt(16 / 3)
+static const float kBrownLeak = 0.998f;
+static const float kBrownGain = 0.02737f;           // 0.25 rms: sqrt(0.1875 * (1 - leak^2))
+
+void SeedNoise(NoiseState& state, Uint32 seed)
+{
+    for (int row = 0; row < kPinkRows; ++row) state.keys[row] = Hash(seed * kPinkRows + row + 0x9e3779b9u);
+    state.counter = 0;
+    state.brown = 0.f;
+}
+
+static inline float White(const NoiseState& state, Uint32 n)
+{
+    return (float)(Sint32)Hash(n ^ state.keys[0]) * kToUnit;
+}
+
+// row k holds for 2^k samples: row 0 changes every sample, the others where n has exactly
+// k - 1 trailing zeros
+static inline float Pink(const NoiseState& state, Uint32 n)
+{
+    float sum = 0.f;
+    for (int row = 0; row < kPinkRows; ++row)
+        sum += (float)(Sint32)Hash(((n + ((1u << row) >> 1)) >> row) ^ state.keys[row]) * kToUnit;
+    return sum * kPinkGain;
+}
+
+static void RenderNoiseScalar(NoiseColor color, NoiseState& state, float* out, int frames, Ramp amplitude)
+{
+    float amp = amplitude.start;
+    Uint32 n = state.counter;
+    for (int i = 0; i < frames; ++i, ++n)
+    {
+        float value;
+        if (color == NoisePink) value = Pink(state, n);
+        else if (color == NoiseBrown) value = state.brown = kBrownLeak * state.brown + kBrownGain * White(state, n);
+        else value = White(state, n);
+        out[i] = amp * value;
+        amp += amplitude.step;
+    }
+    state.counter = n;
+}
+
+// SSE2 has no 32-bit multiply keeping the low half; two 32x32->64 ones on the even and odd
+// lanes make it
+static inline __m128i MulLoSSE2(__m128i a, __m128i b)
+{
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static inline __m128i HashSSE2(__m128i x)
+{
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+    x = MulLoSSE2(x, _mm_set1_epi32((int)kHashMultiply1));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 15));
+    x = MulLoSSE2(x, _mm_set1_epi32((int)kHashMultiply2));
+    return _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+}
+
+static inline __m128 ToUnitSSE2(__m128i hash)
+{
+    return _mm_mul_ps(_mm_cvtepi32_ps(hash), _mm_set1_ps(kToUnit));
+}
+
+static inline __m128 PinkSSE2(const NoiseState& state, __m128i n)
+{
+    __m128 sum = _mm_setzero_ps();
+    for (int row = 0; row < kPinkRows; ++row)
+    {
+        __m128i hold = _mm_srli_epi32(_mm_add_epi32(n, _mm_set1_epi32((int)((1u << row) >> 1))), row);
+        sum = _mm_add_ps(sum, ToUnitSSE2(HashSSE2(_mm_xor_si128(hold, _mm_set1_epi32((int)state.keys[row])))));
+    }
+    return _mm_mul_ps(sum, _mm_set1_ps(kPinkGain));
+}
+
+// the leaky integrator over 4 lanes: y(i) = sum over j <= i of leak^(i - j) x(j) in two
+// shift-and-adds, then the previous sample carried in with leak^(i + 1)
+static inline __m128 IntegrateSSE2(__m128 x, float& carry)
+{
+    const float l = kBrownLeak;
+    x = _mm_add_ps(x, _mm_mul_ps(_mm_set1_ps(l), _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 4))));
+    x = _mm_add_ps(x, _mm_mul_ps(_mm_set1_ps(l * l), _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 8))));
+    x = _mm_add_ps(x, _mm_mul_ps(_mm_set_ps(l * l * l * l, l * l * l, l * l, l), _mm_set1_ps(carry)));
+    carry = _mm_cvtss_f32(_mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 3, 3, 3)));
+    return x;
+}
+
+static void RenderNoiseSSE2(NoiseColor color, NoiseState& state, float* out, int frames, Ramp amplitude)
+{
+    const __m128 lane = _mm_set_ps(3.f, 2.f, 1.f, 0.f);
+    __m128 amp = _mm_add_ps(_mm_set1_ps(amplitude.start), _mm_mul_ps(_mm_set1_ps(amplitude.step), lane));
+    __m128 ampStep = _mm_set1_ps(4.f * amplitude.step);
+    __m128i n = _mm_add_epi32(_mm_set1_epi32((int)state.counter), _mm_set_epi32(3, 2, 1, 0));
+    __m128i white = _mm_set1_epi32((int)state.keys[0]);
+
+    int i = 0;
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128 value;
+        if (color == NoisePink) value = PinkSSE2(state, n);
+        else if (color == NoiseBrown) value = IntegrateSSE2(_mm_mul_ps(_mm_set1_ps(kBrownGain), ToUnitSSE2(HashSSE2(_mm_xor_si128(n, white)))), state.brown);
+        else value = ToUnitSSE2(HashSSE2(_mm_xor_si128(n, white)));
+        _mm_storeu_ps(out + i, _mm_mul_ps(amp, value));
+        amp = _mm_add_ps(amp, ampStep);
+        n = _mm_add_epi32(n, _mm_set1_epi32(4));
+    }
+
+    state.counter += i;
+    amplitude.start += i * amplitude.step;
+    RenderNoiseScalar(color, state, out + i, frames - i, amplitude);
+}
+
+SIMD_TARGET_AVX2 static inline __m256i HashAVX2(__m256i x)
+{
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+    x = _mm256_mullo_epi32(x, _mm256_set1_epi32((int)kHashMultiply1));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 15));
+    x = _mm256_mullo_epi32(x, _mm256_set1_epi32((int)kHashMultiply2));
+    return _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+}
+
+SIMD_TARGET_AVX2 static inline __m256 ToUnitAVX2(__m256i hash)
+{
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(hash), _mm256_set1_ps(kToUnit));
+}
+
+SIMD_TARGET_AVX2 static inline __m256 PinkAVX2(const NoiseState& state, __m256i n)
+{
+    __m256 sum = _mm256_setzero_ps();
+    for (int row = 0; row < kPinkRows; ++row)
+    {
+        __m256i hold = _mm256_srli_epi32(_mm256_add_epi32(n, _mm256_set1_epi32((int)((1u << row) >> 1))), row);
+        sum = _mm256_add_ps(sum, ToUnitAVX2(HashAVX2(_mm256_xor_si256(hold, _mm256_set1_epi32((int)state.keys[row])))));
+    }
+    return _mm256_mul_ps(sum, _mm256_set1_ps(kPinkGain));
+}
+
+SIMD_TARGET_AVX2 static void RenderNoiseAVX2(NoiseColor color, NoiseState& state, float* out, int frames, Ramp amplitude)
+{
+    const __m256 lane = _mm256_set_ps(7.f, 6.f, 5.f, 4.f, 3.f, 2.f, 1.f, 0.f);
+    __m256 amp = _mm256_fmadd_ps(_mm256_set1_ps(amplitude.step), lane, _mm256_set1_ps(amplitude.start));
+    __m256 ampStep = _mm256_set1_ps(8.f * amplitude.step);
+    __m256i n = _mm256_add_epi32(_mm256_set1_epi32((int)state.counter), _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+    __m256i white = _mm256_set1_epi32((int)state.keys[0]);
+
+    int i = 0;
+    for (; i + 8 <= frames; i += 8)
+    {
+        __m256 value;
+        if (color == NoisePink)
+        {
+            value = PinkAVX2(state, n);
+        }
+        else if (color == NoiseBrown)
+        {
+            // the integrator crosses lanes, so it runs on the two halves in turn
+            __m256 x = _mm256_mul_ps(_mm256_set1_ps(kBrownGain), ToUnitAVX2(HashAVX2(_mm256_xor_si256(n, white))));
+            __m128 low = IntegrateSSE2(_mm256_castps256_ps128(x), state.brown);
+            __m128 high = IntegrateSSE2(_mm256_extractf128_ps(x, 1), state.brown);
+            value = _mm256_insertf128_ps(_mm256_castps128_ps256(low), high, 1);
+        }
+        else
+        {
+            value = ToUnitAVX2(HashAVX2(_mm256_xor_si256(n, white)));
+        }
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(amp, value));
+        amp = _mm256_add_ps(amp, ampStep);
+        n = _mm256_add_epi32(n, _mm256_set1_epi32(8));
+    }
+    _mm256_zeroupper();
+
+    state.counter += i;
+    amplitude.start += i * amplitude.step;
+    RenderNoiseScalar(color, state, out + i, frames - i, amplitude);
+}
+
+const NoiseKernel noiseKernels[] =
+{
+    { "scalar", SimdScalar, RenderNoiseScalar },
+    { "sse2", SimdSSE2, RenderNoiseSSE2 },
+    { "avx2", SimdAVX2, RenderNoiseAVX2 },
+};
+const int noiseKernelCount = sizeof(noiseKernels) / sizeof(noiseKernels[0]);
+
+const NoiseKernel& SelectNoiseKernel()
+{
+    SimdLevel level = DetectSimdLevel();
+    int best = 0;
+    for (int i = 1; i < noiseKernelCount; ++i)
+        if (noiseKernels[i].level <= level) best = i;
+    return noiseKernels[best];
+}
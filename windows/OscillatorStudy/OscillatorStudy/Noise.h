@@ -0,0 +1,53 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+#include "SDL.h"
+#include "Simd.h"
+#include "Smoothing.h"
+
+// Noise from a counter-based generator: sample n of a stream is a hash of n and the stream's
+// key, so there's no state to step from one sample to the next and 4 or 8 lanes compute
+// samples n .. n + 7 side by side. A seed always gives the same samples: white and pink bit
+// for bit whatever the kernel or block size, brown (see below) to within rounding.
+//
+// Pink is Voss-McCartney: kPinkRows white rows, row k holding its value for 2^k samples,
+// summed. Row 0 changes every sample and the others are staggered so exactly one of them
+// changes along with it (none at multiples of 2^15). Row k's value is again just a hash of
+// which hold it's in, so pink is as stateless as white. Brown is white through a
+// leaky integrator, the one part that depends on the previous sample: SIMD kernels make the
+// random numbers in lanes and run the integrator across them as a short prefix sum.
+
+static const int kPinkRows = 16;    // the lowest row changes every 2^15 samples, ~1.3 Hz
+
+enum NoiseColor
+{
+    NoiseWhite,     // uniform in [-1, 1)
+    NoisePink,      // -3 dB per octave, ~0.25 rms
+    NoiseBrown,     // -6 dB per octave above ~15 Hz, ~0.25 rms
+};
+
+struct NoiseState
+{
+    Uint32 keys[kPinkRows];     // one stream per pink row; white and brown use row 0's
+    Uint32 counter;             // next sample's n
+    float brown;                // the integrator
+};
+
+void SeedNoise(NoiseState& state, Uint32 seed);
+
+// writes `frames` samples of `color` to out, scaled by the amplitude ramp
+typedef void (*NoiseKernelFn)(NoiseColor color, NoiseState& state, float* out, int frames, Ramp amplitude);
+
+struct NoiseKernel
+{
+    const char* name;
+    SimdLevel level;
+    NoiseKernelFn render;
+};
+
+extern const NoiseKernel noiseKernels[];
+extern const int noiseKernelCount;
+
+const NoiseKernel& SelectNoiseKernel();
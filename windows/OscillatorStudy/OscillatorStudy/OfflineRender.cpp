@@ -0,0 +1,147 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#include "stdafx.h"
+#include "OfflineRender.h"
+
+#include <atomic>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+using namespace std;
+
+static const int kWavHeaderBytes = 58;  // RIFF + fmt (18 bytes, IEEE float) + fact + data headers
+static const Uint64 kMaxWavDataBytes = 0xFFFFFFFFull - kWavHeaderBytes; // RIFF sizes are 32 bit (~6.7 hours mono)
+static const int kChunkBlocks = 64;     // blocks per half of the double buffer
+
+static void Put16(Uint8*& p, Uint16 v) { p[0] = (Uint8)v; p[1] = (Uint8)(v >> 8); p += 2; }
+static void Put32(Uint8*& p, Uint32 v) { Put16(p, (Uint16)v); Put16(p, (Uint16)(v >> 16)); }
+static void PutTag(Uint8*& p, const char* tag) { memcpy(p, tag, 4); p += 4; }
+
+static void WriteWavHeader(FILE* file, int sampleRate, Uint32 frames)
+{
+    Uint8 header[kWavHeaderBytes];
+    Uint8* p = header;
+    Uint32 dataBytes = frames * (Uint32)sizeof(float);
+    PutTag(p, "RIFF"); Put32(p, kWavHeaderBytes - 8 + dataBytes); PutTag(p, "WAVE");
+    PutTag(p, "fmt "); Put32(p, 18);
+    Put16(p, 3);                                    // WAVE_FORMAT_IEEE_FLOAT
+    Put16(p, 1);                                    // mono
+    Put32(p, sampleRate);
+    Put32(p, sampleRate * (Uint32)sizeof(float));   // bytes per second
+    Put16(p, sizeof(float));                        // block align
+    Put16(p, 32);                                   // bits per sample
+    Put16(p, 0);                                    // no extension
+    PutTag(p, "fact"); Put32(p, 4); Put32(p, frames);
+    PutTag(p, "data"); Put32(p, dataBytes);
+    fseek(file, 0, SEEK_SET);
+    fwrite(header, 1, sizeof(header), file);
+}
+
+struct WavWriter
+{
+    FILE* file;
+    float* chunks[2];
+    int chunkFrames[2];
+    SDL_sem* filled;    // render -> writer: a chunk is ready
+    SDL_sem* free;      // writer -> render: a chunk can be reused
+    atomic<bool> failed { false };
+    Uint64 written = 0;
+};
+
+// writer thread: writes chunks in order until it's handed an empty one
+static int WriterThread(void* data)
+{
+    WavWriter* writer = reinterpret_cast<WavWriter*>(data);
+    for (int index = 0;; index ^= 1)
+    {
+        SDL_SemWait(writer->filled);
+        int frames = writer->chunkFrames[index];
+        if (frames == 0) break;
+        if (!writer->failed.load())
+        {
+            // only what actually reached the file counts, so the header never claims more
+            if (fwrite(writer->chunks[index], sizeof(float), frames, writer->file) == (size_t)frames) writer->written += frames;
+            else writer->failed.store(true);
+        }
+        SDL_SemPost(writer->free);
+    }
+    return 0;
+}
+
+OfflineRenderStats RenderToWav(AudioEngine& engine, const char* path, double seconds, int blockFrames)
+{
+    OfflineRenderStats stats = { 0, 0, false };
+    int sampleRate = (int)engine.sampleRate;
+    Uint64 totalFrames = (Uint64)(seconds * sampleRate);
+    if (totalFrames * sizeof(float) > kMaxWavDataBytes)
+    {
+        totalFrames = kMaxWavDataBytes / sizeof(float);
+        SDL_Log("WAV files top out at %.1f hours, rendering that much", (double)totalFrames / sampleRate / 3600);
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (!file)
+    {
+        SDL_Log("Can't open %s for writing", path);
+        return stats;
+    }
+    WriteWavHeader(file, sampleRate, 0); // placeholder, sizes get patched at the end
+
+    // everything the loop needs is allocated here, before the clock starts
+    vector<float> storage(2 * kChunkBlocks * blockFrames);
+    WavWriter writer;
+    writer.file = file;
+    writer.chunks[0] = storage.data();
+    writer.chunks[1] = storage.data() + kChunkBlocks * blockFrames;
+    writer.filled = SDL_CreateSemaphore(0);
+    writer.free = SDL_CreateSemaphore(2);
+    SDL_Thread* thread = writer.filled && writer.free ? SDL_CreateThread(WriterThread, "WavWriter", &writer) : nullptr;
+    if (!thread)
+    {
+        // without the writer the loop would wait on `free` forever after two chunks
+        SDL_Log("Can't start the writer thread: %s", SDL_GetError());
+        if (writer.filled) SDL_DestroySemaphore(writer.filled);
+        if (writer.free) SDL_DestroySemaphore(writer.free);
+        fclose(file);
+        remove(path);
+        return stats;
+    }
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    Uint64 rendered = 0;
+    int index = 0;
+    for (; rendered < totalFrames && !writer.failed.load(); index ^= 1)
+    {
+        SDL_SemWait(writer.free);
+        float* chunk = writer.chunks[index];
+        int frames = 0;
+        for (int block = 0; block < kChunkBlocks && rendered < totalFrames; ++block)
+        {
+            int count = totalFrames - rendered < (Uint64)blockFrames ? (int)(totalFrames - rendered) : blockFrames;
+            AudioCallback(&engine, reinterpret_cast<Uint8*>(chunk + frames), count * (int)sizeof(float));
+            frames += count;
+            rendered += count;
+        }
+        writer.chunkFrames[index] = frames;
+        SDL_SemPost(writer.filled);
+    }
+
+    // an empty chunk tells the writer we're done
+    SDL_SemWait(writer.free);
+    writer.chunkFrames[index] = 0;
+    SDL_SemPost(writer.filled);
+    SDL_WaitThread(thread, nullptr);
+    stats.wallSeconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+
+    SDL_DestroySemaphore(writer.filled);
+    SDL_DestroySemaphore(writer.free);
+
+    WriteWavHeader(file, sampleRate, (Uint32)writer.written);
+    bool closed = fclose(file) == 0;
+    stats.ok = closed && !writer.failed.load();
+    stats.frames = writer.written;
+    if (!stats.ok) SDL_Log("Writing %s failed", path);
+    return stats;
+}
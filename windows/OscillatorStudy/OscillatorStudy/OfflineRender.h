@@ -0,0 +1,21 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+#include "AudioEngine.h"
+
+// Faster-than-realtime rendering: drives AudioCallback in a tight loop (no audio device, so
+// it works on headless machines) and streams the result to a 32-bit float mono WAV file.
+// A writer thread does the file I/O from the other half of a double buffer, so the render
+// loop never waits on the disk unless the disk can't keep up.
+
+struct OfflineRenderStats
+{
+    Uint64 frames;          // actually written
+    double wallSeconds;
+    bool ok;
+};
+
+// renders `seconds` of audio at engine.sampleRate, in blocks of `blockFrames` like the device would
+OfflineRenderStats RenderToWav(AudioEngine& engine, const char* path, double seconds, int blockFrames);
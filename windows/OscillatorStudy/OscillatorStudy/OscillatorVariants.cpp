@@ -0,0 +1,216 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#include "stdafx.h"
+#include "OscillatorVariants.h"
+#include "SineKernel.h"
+
+#include <math.h>
+
+// same position split as the wavetable kernels: top bits index, the rest the fraction
+static const int kFractionBits = 32 - kWavetableBits;
+static const Uint32 kFractionMask = (1u << kFractionBits) - 1;
+static const float kFractionScale = 1.f / (float)(1u << kFractionBits);
+
+// cycles to phase units in two 16-bit halves, so the SIMD version can do exactly the same
+// with 32-bit conversions: exact for |cycles| < 32768
+static inline Uint32 ModulationOffset(float cycles)
+{
+    float scaled = cycles * 65536.f;
+    float whole = floorf(scaled);
+    return ((Uint32)(Sint32)whole << 16) + (Uint32)(Sint32)((scaled - whole) * 65536.f);
+}
+
+static inline __m128i ModulationOffsetSSE2(__m128 cycles)
+{
+    __m128 scaled = _mm_mul_ps(cycles, _mm_set1_ps(65536.f));
+    __m128 whole = _mm_cvtepi32_ps(_mm_cvttps_epi32(scaled));
+    whole = _mm_sub_ps(whole, _mm_and_ps(_mm_cmpgt_ps(whole, scaled), _mm_set1_ps(1.f))); // truncated -> floor
+    __m128i high = _mm_slli_epi32(_mm_cvttps_epi32(whole), 16);
+    __m128i low = _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(scaled, whole), _mm_set1_ps(65536.f)));
+    return _mm_add_epi32(high, low);
+}
+
+static inline void PanGains(float pan, float& left, float& right)
+{
+    float angle = 1.57079633f * (pan < 0.f ? 0.f : (pan > 1.f ? 1.f : pan));
+    left = cosf(angle);
+    right = sinf(angle);
+}
+
+static inline float Lookup(Interpolation interpolation, const float* data, Phase phase)
+{
+    Uint32 position = phase ^ 0x80000000u;
+    Uint32 index = position >> kFractionBits;
+    float f = (float)(position & kFractionMask) * kFractionScale;
+    const float* y = data + index;
+    if (interpolation == InterpolateNone) return y[0];
+    if (interpolation == InterpolateLinear) return y[0] + f * (y[1] - y[0]);
+    float c1 = 0.5f * (y[1] - y[-1]);
+    float c2 = y[-1] - 2.5f * y[0] + 2.f * y[1] - 0.5f * y[2];
+    float c3 = 0.5f * (y[2] - y[-1]) + 1.5f * (y[0] - y[1]);
+    return ((c3 * f + c2) * f + c1) * f + y[0];
+}
+
+static inline __m128 LookupSSE2(Interpolation interpolation, const float* data, __m128i phase)
+{
+    __m128i position = _mm_xor_si128(phase, _mm_set1_epi32((int)0x80000000u));
+    alignas(16) Uint32 index[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(index), _mm_srli_epi32(position, kFractionBits));
+    const float* y0 = data + index[0];
+    const float* y1 = data + index[1];
+    const float* y2 = data + index[2];
+    const float* y3 = data + index[3];
+    __m128 a = _mm_setr_ps(y0[0], y1[0], y2[0], y3[0]);
+    if (interpolation == InterpolateNone) return a;
+    __m128 f = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(position, _mm_set1_epi32((int)kFractionMask))), _mm_set1_ps(kFractionScale));
+    __m128 b = _mm_setr_ps(y0[1], y1[1], y2[1], y3[1]);
+    if (interpolation == InterpolateLinear) return _mm_add_ps(a, _mm_mul_ps(f, _mm_sub_ps(b, a)));
+    __m128 before = _mm_setr_ps(y0[-1], y1[-1], y2[-1], y3[-1]);
+    __m128 after = _mm_setr_ps(y0[2], y1[2], y2[2], y3[2]);
+    const __m128 half = _mm_set1_ps(0.5f);
+    __m128 c1 = _mm_mul_ps(half, _mm_sub_ps(b, before));
+    __m128 c2 = _mm_sub_ps(_mm_add_ps(before, _mm_mul_ps(_mm_set1_ps(2.f), b)), _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.5f), a), _mm_mul_ps(half, after)));
+    __m128 c3 = _mm_add_ps(_mm_mul_ps(half, _mm_sub_ps(after, before)), _mm_mul_ps(_mm_set1_ps(1.5f), _mm_sub_ps(a, b)));
+    return _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(c3, f), c2), f), c1), f), a);
+}
+
+// The instances and the generic loop compute the same thing; the instances just have every
+// choice as a constant, so each `if` on a template argument folds away and what's left is
+// 4 samples per step in SSE2 lanes (lane arithmetic as in the sine kernels). The generic
+// loop has to stay scalar, since what it does next depends on the variant.
+template <OscillatorShape Shape, Interpolation Interp, int Channels, bool Modulated>
+static Phase RenderVariantScalar(const OscillatorBlock& block, int begin, Phase phase, Uint32 increment, float amp, float left, float right, const float* data)
+{
+    float* out = block.out;
+    for (int i = begin; i < block.frames; ++i)
+    {
+        Phase p = phase;
+        if (Modulated) p += ModulationOffset(block.depth * block.modulation[i]);
+        float value = amp * (Shape == ShapeSine ? SinePoly(PhaseToCycles(p)) : Lookup(Interp, data, p));
+        if (Channels == 2)
+        {
+            out[2 * i] = left * value;
+            out[2 * i + 1] = right * value;
+        }
+        else
+        {
+            out[i] = value;
+        }
+        phase += increment;
+        increment += block.increment.step;
+        amp += block.amplitude.step;
+    }
+    return phase;
+}
+
+template <OscillatorShape Shape, Interpolation Interp, int Channels, bool Modulated>
+static Phase RenderVariant(const OscillatorBlock& block)
+{
+    const float* data = Shape == ShapeTable ? RampLevel(*block.table, block.increment, block.frames) : nullptr;
+    float left = 1.f, right = 1.f;
+    if (Channels == 2) PanGains(block.pan, left, right);
+
+    PhaseLanes lanes;
+    SpreadPhase(lanes, 4, block.phase, block.increment);
+    __m128i p = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.phase));
+    __m128i advance = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.advance));
+    __m128i advanceStep = _mm_set1_epi32((int)lanes.advanceStep);
+    const __m128 lane = _mm_setr_ps(0.f, 1.f, 2.f, 3.f);
+    __m128 amp = _mm_add_ps(_mm_set1_ps(block.amplitude.start), _mm_mul_ps(_mm_set1_ps(block.amplitude.step), lane));
+    __m128 ampStep = _mm_set1_ps(4.f * block.amplitude.step);
+    __m128 depth = _mm_set1_ps(block.depth);
+    __m128 leftGain = _mm_set1_ps(left), rightGain = _mm_set1_ps(right);
+
+    int i = 0;
+    for (; i + 4 <= block.frames; i += 4)
+    {
+        __m128i q = p;
+        if (Modulated) q = _mm_add_epi32(q, ModulationOffsetSSE2(_mm_mul_ps(depth, _mm_loadu_ps(block.modulation + i))));
+        __m128 value = Shape == ShapeSine ? SinePolySSE2(PhaseToCyclesSSE2(q)) : LookupSSE2(Interp, data, q);
+        value = _mm_mul_ps(amp, value);
+        if (Channels == 2)
+        {
+            __m128 l = _mm_mul_ps(leftGain, value), r = _mm_mul_ps(rightGain, value);
+            _mm_storeu_ps(block.out + 2 * i, _mm_unpacklo_ps(l, r));
+            _mm_storeu_ps(block.out + 2 * i + 4, _mm_unpackhi_ps(l, r));
+        }
+        else
+        {
+            _mm_storeu_ps(block.out + i, value);
+        }
+        p = _mm_add_epi32(p, advance);
+        advance = _mm_add_epi32(advance, advanceStep);
+        amp = _mm_add_ps(amp, ampStep);
+    }
+
+    Phase phase = i > 0 ? (Phase)_mm_cvtsi128_si32(p) : block.phase;
+    Uint32 increment = block.increment.start + (Uint32)i * block.increment.step;
+    float ampStart = block.amplitude.start + i * block.amplitude.step;
+    return RenderVariantScalar<Shape, Interp, Channels, Modulated>(block, i, phase, increment, ampStart, left, right, data);
+}
+
+Phase RenderOscillatorGeneric(const OscillatorVariant& variant, const OscillatorBlock& block)
+{
+    const float* data = variant.shape == ShapeTable ? RampLevel(*block.table, block.increment, block.frames) : nullptr;
+    float left = 1.f, right = 1.f;
+    if (variant.channels == 2) PanGains(block.pan, left, right);
+    float* out = block.out;
+    Phase phase = block.phase;
+    Uint32 increment = block.increment.start;
+    float amp = block.amplitude.start;
+    for (int i = 0; i < block.frames; ++i)
+    {
+        Phase p = phase;
+        if (variant.modulated) p += ModulationOffset(block.depth * block.modulation[i]);
+        float value;
+        switch (variant.shape)
+        {
+        case ShapeSine: value = SinePoly(PhaseToCycles(p)); break;
+        default: value = Lookup(variant.interpolation, data, p); break;
+        }
+        value *= amp;
+        switch (variant.channels)
+        {
+        case 2:
+            out[2 * i] = left * value;
+            out[2 * i + 1] = right * value;
+            break;
+        default:
+            out[i] = value;
+            break;
+        }
+        phase += increment;
+        increment += block.increment.step;
+        amp += block.amplitude.step;
+    }
+    return phase;
+}
+
+// [shape][interpolation][channels - 1][modulated]; the sine ignores the interpolation, its
+// three rows are the same instances
+static const OscillatorFn oscillatorVariants[ShapeCount][InterpolationCount][kMaxOscillatorChannels][2] =
+{
+    {
+        { { RenderVariant<ShapeSine, InterpolateNone, 1, false>, RenderVariant<ShapeSine, InterpolateNone, 1, true> },
+          { RenderVariant<ShapeSine, InterpolateNone, 2, false>, RenderVariant<ShapeSine, InterpolateNone, 2, true> } },
+        { { RenderVariant<ShapeSine, InterpolateNone, 1, false>, RenderVariant<ShapeSine, InterpolateNone, 1, true> },
+          { RenderVariant<ShapeSine, InterpolateNone, 2, false>, RenderVariant<ShapeSine, InterpolateNone, 2, true> } },
+        { { RenderVariant<ShapeSine, InterpolateNone, 1, false>, RenderVariant<ShapeSine, InterpolateNone, 1, true> },
+          { RenderVariant<ShapeSine, InterpolateNone, 2, false>, RenderVariant<ShapeSine, InterpolateNone, 2, true> } },
+    },
+    {
+        { { RenderVariant<ShapeTable, InterpolateNone, 1, false>, RenderVariant<ShapeTable, InterpolateNone, 1, true> },
+          { RenderVariant<ShapeTable, InterpolateNone, 2, false>, RenderVariant<ShapeTable, InterpolateNone, 2, true> } },
+        { { RenderVariant<ShapeTable, InterpolateLinear, 1, false>, RenderVariant<ShapeTable, InterpolateLinear, 1, true> },
+          { RenderVariant<ShapeTable, InterpolateLinear, 2, false>, RenderVariant<ShapeTable, InterpolateLinear, 2, true> } },
+        { { RenderVariant<ShapeTable, InterpolateCubic, 1, false>, RenderVariant<ShapeTable, InterpolateCubic, 1, true> },
+          { RenderVariant<ShapeTable, InterpolateCubic, 2, false>, RenderVariant<ShapeTable, InterpolateCubic, 2, true> } },
+    },
+};
+
+OscillatorFn SelectOscillator(const OscillatorVariant& variant)
+{
+    int channels = variant.channels == 2 ? 2 : 1;
+    return oscillatorVariants[variant.shape][variant.interpolation][channels - 1][variant.modulated ? 1 : 0];
+}
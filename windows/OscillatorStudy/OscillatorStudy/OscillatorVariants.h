@@ -0,0 +1,63 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+#include "Phase.h"
+#include "Smoothing.h"
+#include "Wavetable.h"
+
+// Oscillators that vary along several independent axes (shape, table interpolation, channel
+// count, phase modulation) as one template, instantiated for every combination. Each
+// instance is a straight SSE2 loop with the choices baked in, nothing is decided per sample;
+// the choice is made once per block, by indexing a table of the instances. The alternative,
+// one loop switching on the variant every sample, can't be vectorized and is kept as
+// RenderOscillatorGeneric, for the benchmark and as the reference.
+
+enum OscillatorShape
+{
+    ShapeSine,      // the polynomial, no table
+    ShapeTable,     // one of the band-limited wavetables
+    ShapeCount,
+};
+
+enum Interpolation
+{
+    InterpolateNone,    // the entry below the phase
+    InterpolateLinear,
+    InterpolateCubic,   // 4-point Hermite, using the tables' guard samples
+    InterpolationCount,
+};
+
+static const int kMaxOscillatorChannels = 2;
+
+struct OscillatorVariant
+{
+    OscillatorShape shape;
+    Interpolation interpolation;    // ShapeTable only
+    int channels;                   // 1, or 2 interleaved and panned
+    bool modulated;                 // phase modulation from a buffer
+};
+
+struct OscillatorBlock
+{
+    const Wavetable* table;         // ShapeTable; the mip level is picked for the whole block
+    float* out;                     // frames * channels
+    int frames;
+    Phase phase;
+    PhaseRamp increment;
+    Ramp amplitude;
+    const float* modulation;        // modulated: one value per frame...
+    float depth;                    // ...times this, in cycles
+    float pan;                      // stereo: 0 left, 0.5 centre, 1 right (equal power)
+};
+
+// returns the phase to continue from
+typedef Phase (*OscillatorFn)(const OscillatorBlock& block);
+
+// the instance for `variant`: a table lookup, cheap enough for every block
+OscillatorFn SelectOscillator(const OscillatorVariant& variant);
+
+// every variant in one scalar loop, switching per sample; the instances' output to within
+// rounding (their amplitude ramps are computed per lane)
+Phase RenderOscillatorGeneric(const OscillatorVariant& variant, const OscillatorBlock& block);
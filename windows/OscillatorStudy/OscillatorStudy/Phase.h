@@ -0,0 +1,134 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+#include "SDL.h"
+#include "Simd.h"
+#include "Smoothing.h"
+
+#include <math.h>
+
+// Oscillator phase as a 32-bit fraction of a cycle. The whole Uint32 range is one cycle, so
+// stepping is an integer add that wraps by itself and is exact: a float phase rounds on every
+// add and slowly walks away from the frequency it was asked for, this one never does. Read
+// as signed, phase / 2^32 is cycles in [-0.5, 0.5) like before, and the top bits of
+// phase ^ 0x80000000 index a table of any power-of-two size directly.
+
+typedef Uint32 Phase;
+
+static const float kPhaseToCycles = 1.f / 4294967296.f;
+static const double kCyclesToPhase = 4294967296.0;
+
+// per sample increment, start + i * step, in phase units; the step may be negative
+struct PhaseRamp
+{
+    Uint32 start;
+    Uint32 step;        // two's complement, wraps back the same way
+};
+
+static inline float PhaseToCycles(Phase phase) { return (float)(Sint32)phase * kPhaseToCycles; }
+
+// phase + 0.5 cycles as [0, 1), through the top 24 bits so the float is exact and never 1
+static inline float PhaseToUnit(Phase phase) { return (float)((phase ^ 0x80000000u) >> 8) * (1.f / 16777216.f); }
+
+// any number of cycles, wrapped
+static inline Phase CyclesToPhase(double cycles)
+{
+    return (Phase)(Uint64)((cycles - floor(cycles)) * kCyclesToPhase);
+}
+
+// rounded to the nearest unit (2^-32 cycles, i.e. ~10 uHz at 44.1 kHz)
+static inline Uint32 PhaseIncrement(double cycles)
+{
+    return (Uint32)(Sint64)floor(cycles * kCyclesToPhase + 0.5);
+}
+
+static inline PhaseRamp ConstantPhaseRamp(Uint32 increment)
+{
+    PhaseRamp ramp = { increment, 0 };
+    return ramp;
+}
+
+static inline PhaseRamp ToPhaseRamp(Ramp increment)
+{
+    PhaseRamp ramp = { PhaseIncrement(increment.start), PhaseIncrement(increment.step) };
+    return ramp;
+}
+
+// A 32-bit increment is still rounded, by up to 2^-33 cycles per sample: a few uHz, but over
+// a day that's a fraction of a cycle. For tones held that long the increment carries 32 more
+// bits below the unit; kernels step by `whole` every sample and the caller adds up what the
+// fractions come to once per block (CarryPhase), exact to ~2^-64 cycles per sample.
+struct FineIncrement
+{
+    Uint32 whole;
+    Uint32 fraction;    // 2^-64 cycles
+};
+
+static inline FineIncrement ToFineIncrement(double cycles)
+{
+    Uint64 fixed = (Uint64)(cycles * 18446744073709551616.0); // 2^64, cycles < 0.5
+    FineIncrement increment = { (Uint32)(fixed >> 32), (Uint32)fixed };
+    return increment;
+}
+
+// after `frames` samples stepped by increment.whole; `remainder` is the phase below the unit
+static inline Phase CarryPhase(Phase phase, Uint32& remainder, FineIncrement increment, int frames)
+{
+    Uint64 sum = (Uint64)remainder + (Uint64)increment.fraction * (Uint32)frames;
+    remainder = (Uint32)sum;
+    return phase + (Uint32)(sum >> 32);
+}
+
+// The SIMD kernels keep one phase per lane (samples n .. n + width - 1) and step every lane
+// by the sum of the next `width` increments. With increment(n) = inc + n * d, all in exact
+// modular arithmetic:
+//   phase(l)   = p + l * inc + d * l * (l - 1) / 2
+//   advance(l) = w * inc + d * (w * l + w * (w - 1) / 2),   advance += d * w * w per step
+// so a SIMD kernel lands on exactly the phases the scalar one does, ramps or not. Set up here
+// once per call; lanes past `width` are left alone.
+struct PhaseLanes
+{
+    alignas(32) Uint32 phase[8];
+    alignas(32) Uint32 advance[8];
+    alignas(32) Uint32 increment[8];    // each lane's own, for kernels whose shape depends on it
+    Uint32 advanceStep;
+    Uint32 incrementStep;
+};
+
+static inline void SpreadPhase(PhaseLanes& lanes, int width, Phase phase, PhaseRamp increment)
+{
+    Uint32 w = (Uint32)width;
+    Uint32 d = increment.step;
+    for (Uint32 l = 0; l < w; ++l)
+    {
+        lanes.phase[l] = phase + l * increment.start + d * (l * (l - 1) / 2);
+        lanes.advance[l] = w * increment.start + d * (w * l + w * (w - 1) / 2);
+        lanes.increment[l] = increment.start + l * d;
+    }
+    lanes.advanceStep = d * w * w;
+    lanes.incrementStep = d * w;
+}
+
+static inline __m128 PhaseToCyclesSSE2(__m128i phase)
+{
+    return _mm_mul_ps(_mm_cvtepi32_ps(phase), _mm_set1_ps(kPhaseToCycles));
+}
+
+static inline __m128 PhaseToUnitSSE2(__m128i phase)
+{
+    __m128i top = _mm_srli_epi32(_mm_xor_si128(phase, _mm_set1_epi32((int)0x80000000u)), 8);
+    return _mm_mul_ps(_mm_cvtepi32_ps(top), _mm_set1_ps(1.f / 16777216.f));
+}
+
+SIMD_TARGET_AVX2 static inline __m256 PhaseToCyclesAVX2(__m256i phase)
+{
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(phase), _mm256_set1_ps(kPhaseToCycles));
+}
+
+SIMD_TARGET_AVX2 static inline __m256 PhaseToUnitAVX2(__m256i phase)
+{
+    __m256i top = _mm256_srli_epi32(_mm256_xor_si256(phase, _mm256_set1_epi32((int)0x80000000u)), 8);
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(top), _mm256_set1_ps(1.f / 16777216.f));
+}
@@ -0,0 +1,287 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#include "stdafx.h"
+#include "PolyBlep.h"
+#include "Phase.h"
+
+#include <math.h>
+
+// keeps 1 / dt finite for a stopped oscillator; the corrections are then just very narrow
+static const float kMinIncrement = 1e-20f;
+
+static inline float Blep(float t, float invDt)
+{
+    float a = fmaxf(1.f - t * invDt, 0.f);
+    float b = fmaxf(1.f - (1.f - t) * invDt, 0.f);
+    return b * b - a * a;
+}
+
+static inline float Blamp(float t, float invDt)
+{
+    float a = fmaxf(1.f - t * invDt, 0.f);
+    float b = fmaxf(1.f - (1.f - t) * invDt, 0.f);
+    return (a * a * a + b * b * b) * (1.f / 3.f);
+}
+
+// a phase-like position, counted from where the Uint32 wraps, as [0, 1); exact in float
+static inline float Unit(Uint32 position) { return (float)(position >> 8) * (1.f / 16777216.f); }
+
+// One sample of the shape. Positions are worked out in phase units, where moving to another
+// point of the cycle is an add that wraps for free; only then do they become floats. The saw
+// jumps at t = phase + 0.5 cycles = 0, the pulse rises at phase 0 and falls at `width`, and
+// the triangle's corners are a quarter cycle either side of that. Its slope changes by 8 per
+// cycle at each, i.e. 8 * dt per sample, and the BLAMP above is normalized to a change of 2.
+template <int Shape>
+static inline float BlepSample(Phase phase, Uint32 increment, Uint32 width)
+{
+    float dt = (float)increment * kPhaseToCycles;
+    float invDt = 1.f / fmaxf(dt, kMinIncrement);
+    if (Shape == BlepSaw)
+    {
+        float t = Unit(phase + 0x80000000u);
+        return 2.f * t - 1.f - Blep(t, invDt);
+    }
+    if (Shape == BlepPulse)
+    {
+        float u = Unit(phase);
+        return (u < Unit(width) ? 1.f : -1.f) + Blep(u, invDt) - Blep(Unit(phase - width), invDt);
+    }
+    float v = Unit(phase + 0x40000000u);
+    return 1.f - 4.f * fabsf(v - 0.5f) + 4.f * dt * (Blamp(v, invDt) - Blamp(Unit(phase + 0xC0000000u), invDt));
+}
+
+template <int Shape>
+static Phase RenderShapeScalar(Uint32 width, float* out, int frames, Phase phase, PhaseRamp increment, Ramp amplitude)
+{
+    Uint32 inc = increment.start;
+    float amp = amplitude.start;
+    for (int i = 0; i < frames; ++i)
+    {
+        out[i] = amp * BlepSample<Shape>(phase, inc, width);
+        phase += inc;
+        inc += increment.step;
+        amp += amplitude.step;
+    }
+    return phase;
+}
+
+// The SIMD variants step their phases like the sine kernels (SpreadPhase) and carry each
+// lane's own increment alongside, since the correction width follows it.
+
+static inline __m128 UnitSSE2(__m128i position)
+{
+    return _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(position, 8)), _mm_set1_ps(1.f / 16777216.f));
+}
+
+static inline __m128 BlepSSE2(__m128 t, __m128 invDt)
+{
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 zero = _mm_setzero_ps();
+    __m128 a = _mm_max_ps(_mm_sub_ps(one, _mm_mul_ps(t, invDt)), zero);
+    __m128 b = _mm_max_ps(_mm_sub_ps(one, _mm_mul_ps(_mm_sub_ps(one, t), invDt)), zero);
+    return _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(a, a));
+}
+
+static inline __m128 BlampSSE2(__m128 t, __m128 invDt)
+{
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 zero = _mm_setzero_ps();
+    __m128 a = _mm_max_ps(_mm_sub_ps(one, _mm_mul_ps(t, invDt)), zero);
+    __m128 b = _mm_max_ps(_mm_sub_ps(one, _mm_mul_ps(_mm_sub_ps(one, t), invDt)), zero);
+    __m128 cubes = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(a, a), a), _mm_mul_ps(_mm_mul_ps(b, b), b));
+    return _mm_mul_ps(cubes, _mm_set1_ps(1.f / 3.f));
+}
+
+template <int Shape>
+static inline __m128 BlepSampleSSE2(__m128i phase, __m128i increment, __m128i width)
+{
+    const __m128 one = _mm_set1_ps(1.f);
+    __m128 dt = _mm_mul_ps(_mm_cvtepi32_ps(increment), _mm_set1_ps(kPhaseToCycles));
+    __m128 invDt = _mm_div_ps(one, _mm_max_ps(dt, _mm_set1_ps(kMinIncrement)));
+    if (Shape == BlepSaw)
+    {
+        __m128 t = UnitSSE2(_mm_add_epi32(phase, _mm_set1_epi32((int)0x80000000u)));
+        return _mm_sub_ps(_mm_sub_ps(_mm_add_ps(t, t), one), BlepSSE2(t, invDt));
+    }
+    if (Shape == BlepPulse)
+    {
+        // +1 / -1 by setting the sign bit where u >= width
+        __m128 u = UnitSSE2(phase);
+        __m128 level = _mm_or_ps(one, _mm_and_ps(_mm_cmpge_ps(u, UnitSSE2(width)), _mm_set1_ps(-0.f)));
+        __m128 fall = UnitSSE2(_mm_sub_epi32(phase, width));
+        return _mm_add_ps(level, _mm_sub_ps(BlepSSE2(u, invDt), BlepSSE2(fall, invDt)));
+    }
+    __m128 v = UnitSSE2(_mm_add_epi32(phase, _mm_set1_epi32(0x40000000)));
+    __m128 opposite = UnitSSE2(_mm_add_epi32(phase, _mm_set1_epi32((int)0xC0000000u)));
+    __m128 naive = _mm_sub_ps(one, _mm_mul_ps(_mm_set1_ps(4.f), _mm_andnot_ps(_mm_set1_ps(-0.f), _mm_sub_ps(v, _mm_set1_ps(0.5f)))));
+    __m128 corners = _mm_sub_ps(BlampSSE2(v, invDt), BlampSSE2(opposite, invDt));
+    return _mm_add_ps(naive, _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(4.f), dt), corners));
+}
+
+template <int Shape>
+static Phase RenderShapeSSE2(Uint32 width, float* out, int frames, Phase phase, PhaseRamp increment, Ramp amplitude)
+{
+    PhaseLanes lanes;
+    SpreadPhase(lanes, 4, phase, increment);
+    const __m128 lane = _mm_setr_ps(0, 1, 2, 3);
+    __m128i p = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.phase));
+    __m128i advance = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.advance));
+    __m128i advanceStep = _mm_set1_epi32((int)lanes.advanceStep);
+    __m128i inc = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.increment));
+    __m128i incStep = _mm_set1_epi32((int)lanes.incrementStep);
+    __m128 amp = _mm_add_ps(_mm_set1_ps(amplitude.start), _mm_mul_ps(_mm_set1_ps(amplitude.step), lane));
+    __m128 ampStep = _mm_set1_ps(4.f * amplitude.step);
+    __m128i w = _mm_set1_epi32((int)width);
+
+    int i = 0;
+    for (; i + 4 <= frames; i += 4)
+    {
+        _mm_storeu_ps(out + i, _mm_mul_ps(amp, BlepSampleSSE2<Shape>(p, inc, w)));
+        p = _mm_add_epi32(p, advance);
+        advance = _mm_add_epi32(advance, advanceStep);
+        inc = _mm_add_epi32(inc, incStep);
+        amp = _mm_add_ps(amp, ampStep);
+    }
+    if (i > 0) phase = (Phase)_mm_cvtsi128_si32(p);
+    increment.start += (Uint32)i * increment.step;
+    amplitude.start += i * amplitude.step;
+    return RenderShapeScalar<Shape>(width, out + i, frames - i, phase, increment, amplitude);
+}
+
+SIMD_TARGET_AVX2 static inline __m256 UnitAVX2(__m256i position)
+{
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(position, 8)), _mm256_set1_ps(1.f / 16777216.f));
+}
+
+SIMD_TARGET_AVX2 static inline __m256 BlepAVX2(__m256 t, __m256 invDt)
+{
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 a = _mm256_max_ps(_mm256_fnmadd_ps(t, invDt, one), zero);
+    __m256 b = _mm256_max_ps(_mm256_fnmadd_ps(_mm256_sub_ps(one, t), invDt, one), zero);
+    return _mm256_fmsub_ps(b, b, _mm256_mul_ps(a, a));
+}
+
+SIMD_TARGET_AVX2 static inline __m256 BlampAVX2(__m256 t, __m256 invDt)
+{
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 a = _mm256_max_ps(_mm256_fnmadd_ps(t, invDt, one), zero);
+    __m256 b = _mm256_max_ps(_mm256_fnmadd_ps(_mm256_sub_ps(one, t), invDt, one), zero);
+    __m256 cubes = _mm256_fmadd_ps(_mm256_mul_ps(a, a), a, _mm256_mul_ps(_mm256_mul_ps(b, b), b));
+    return _mm256_mul_ps(cubes, _mm256_set1_ps(1.f / 3.f));
+}
+
+template <int Shape>
+SIMD_TARGET_AVX2 static inline __m256 BlepSampleAVX2(__m256i phase, __m256i increment, __m256i width)
+{
+    const __m256 one = _mm256_set1_ps(1.f);
+    __m256 dt = _mm256_mul_ps(_mm256_cvtepi32_ps(increment), _mm256_set1_ps(kPhaseToCycles));
+    __m256 invDt = _mm256_div_ps(one, _mm256_max_ps(dt, _mm256_set1_ps(kMinIncrement)));
+    if (Shape == BlepSaw)
+    {
+        __m256 t = UnitAVX2(_mm256_add_epi32(phase, _mm256_set1_epi32((int)0x80000000u)));
+        return _mm256_sub_ps(_mm256_fmsub_ps(_mm256_set1_ps(2.f), t, one), BlepAVX2(t, invDt));
+    }
+    if (Shape == BlepPulse)
+    {
+        __m256 u = UnitAVX2(phase);
+        __m256 level = _mm256_blendv_ps(one, _mm256_set1_ps(-1.f), _mm256_cmp_ps(u, UnitAVX2(width), _CMP_GE_OQ));
+        __m256 fall = UnitAVX2(_mm256_sub_epi32(phase, width));
+        return _mm256_add_ps(level, _mm256_sub_ps(BlepAVX2(u, invDt), BlepAVX2(fall, invDt)));
+    }
+    __m256 v = UnitAVX2(_mm256_add_epi32(phase, _mm256_set1_epi32(0x40000000)));
+    __m256 opposite = UnitAVX2(_mm256_add_epi32(phase, _mm256_set1_epi32((int)0xC0000000u)));
+    __m256 naive = _mm256_fnmadd_ps(_mm256_set1_ps(4.f), _mm256_andnot_ps(_mm256_set1_ps(-0.f), _mm256_sub_ps(v, _mm256_set1_ps(0.5f))), one);
+    __m256 corners = _mm256_sub_ps(BlampAVX2(v, invDt), BlampAVX2(opposite, invDt));
+    return _mm256_fmadd_ps(_mm256_mul_ps(_mm256_set1_ps(4.f), dt), corners, naive);
+}
+
+template <int Shape>
+SIMD_TARGET_AVX2 static Phase RenderShapeAVX2(Uint32 width, float* out, int frames, Phase phase, PhaseRamp increment, Ramp amplitude)
+{
+    PhaseLanes lanes;
+    SpreadPhase(lanes, 8, phase, increment);
+    const __m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i p = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.phase));
+    __m256i advance = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.advance));
+    __m256i advanceStep = _mm256_set1_epi32((int)lanes.advanceStep);
+    __m256i inc = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.increment));
+    __m256i incStep = _mm256_set1_epi32((int)lanes.incrementStep);
+    __m256 amp = _mm256_fmadd_ps(_mm256_set1_ps(amplitude.step), lane, _mm256_set1_ps(amplitude.start));
+    __m256 ampStep = _mm256_set1_ps(8.f * amplitude.step);
+    __m256i w = _mm256_set1_epi32((int)width);
+
+    int i = 0;
+    for (; i + 8 <= frames; i += 8)
+    {
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(amp, BlepSampleAVX2<Shape>(p, inc, w)));
+        p = _mm256_add_epi32(p, advance);
+        advance = _mm256_add_epi32(advance, advanceStep);
+        inc = _mm256_add_epi32(inc, incStep);
+        amp = _mm256_add_ps(amp, ampStep);
+    }
+    if (i > 0) phase = (Phase)_mm_cvtsi128_si32(_mm256_castsi256_si128(p));
+    _mm256_zeroupper();
+    increment.start += (Uint32)i * increment.step;
+    amplitude.start += i * amplitude.step;
+    return RenderShapeScalar<Shape>(width, out + i, frames - i, phase, increment, amplitude);
+}
+
+static Uint32 WidthPhase(float width)
+{
+    return CyclesToPhase(width < 0.01f ? 0.01f : (width > 0.99f ? 0.99f : width));
+}
+
+// the shape is picked once per call, so each inner loop is compiled for exactly one of them
+
+static Phase RenderBlepScalar(BlepShape shape, float width, float* out, int frames, Phase phase, PhaseRamp increment, Ramp amplitude)
+{
+    Uint32 widthPhase = WidthPhase(width);
+    switch (shape)
+    {
+    case BlepPulse: return RenderShapeScalar<BlepPulse>(widthPhase, out, frames, phase, increment, amplitude);
+    case BlepTriangle: return RenderShapeScalar<BlepTriangle>(widthPhase, out, frames, phase, increment, amplitude);
+    default: return RenderShapeScalar<BlepSaw>(widthPhase, out, frames, phase, increment, amplitude);
+    }
+}
+
+static Phase RenderBlepSSE2(BlepShape shape, float width, float* out, int frames, Phase phase, PhaseRamp increment, Ramp amplitude)
+{
+    Uint32 widthPhase = WidthPhase(width);
+    switch (shape)
+    {
+    case BlepPulse: return RenderShapeSSE2<BlepPulse>(widthPhase, out, frames, phase, increment, amplitude);
+    case BlepTriangle: return RenderShapeSSE2<BlepTriangle>(widthPhase, out, frames, phase, increment, amplitude);
+    default: return RenderShapeSSE2<BlepSaw>(widthPhase, out, frames, phase, increment, amplitude);
+    }
+}
+
+static Phase RenderBlepAVX2(BlepShape shape, float width, float* out, int frames, Phase phase, PhaseRamp increment, Ramp amplitude)
+{
+    Uint32 widthPhase = WidthPhase(width);
+    switch (shape)
+    {
+    case BlepPulse: return RenderShapeAVX2<BlepPulse>(widthPhase, out, frames, phase, increment, amplitude);
+    case BlepTriangle: return RenderShapeAVX2<BlepTriangle>(widthPhase, out, frames, phase, increment, amplitude);
+    default: return RenderShapeAVX2<BlepSaw>(widthPhase, out, frames, phase, increment, amplitude);
+    }
+}
+
+const BlepKernel blepKernels[] =
+{
+    { "polyblep", SimdScalar, RenderBlepScalar },
+    { "polyblep-sse2", SimdSSE2, RenderBlepSSE2 },
+    { "polyblep-avx2", SimdAVX2, RenderBlepAVX2 },
+};
+const int blepKernelCount = sizeof(blepKernels) / sizeof(blepKernels[0]);
+
+const BlepKernel& SelectBlepKernel()
+{
+    SimdLevel level = DetectSimdLevel();
+    int best = 0;
+    for (int i = 1; i < blepKernelCount; ++i)
+        if (blepKernels[i].level <= level) best = i;
+    return blepKernels[best];
+}
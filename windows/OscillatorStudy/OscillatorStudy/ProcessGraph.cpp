@@ -0,0 +1,471 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#include "stdafx.h"
+#include "ProcessGraph.h"
+#include "AudioEngine.h"
+
+#include <math.h>
+#include <string.h>
+
+using namespace std;
+
+int ProcessGraph::add(NodeType type)
+{
+    GraphNode node;
+    node.type = type;
+    nodes.push_back(node);
+    return (int)nodes.size() - 1;
+}
+
+int ProcessGraph::addOscillator(float frequency, float amplitude, Waveform waveform)
+{
+    int id = add(NodeOscillator);
+    nodes[id].frequency = frequency;
+    nodes[id].amplitude = amplitude;
+    nodes[id].waveform = waveform;
+    return id;
+}
+
+int ProcessGraph::addLowpass(float cutoff)
+{
+    int id = add(NodeLowpass);
+    nodes[id].cutoff = cutoff;
+    return id;
+}
+
+int ProcessGraph::addFilter(FilterStructure structure, const FilterSettings& settings)
+{
+    int id = add(NodeFilter);
+    nodes[id].structure = structure;
+    nodes[id].filter = settings;
+    return id;
+}
+
+int ProcessGraph::addNoise(NoiseColor color, float amplitude, Uint32 seed)
+{
+    int id = add(NodeNoise);
+    nodes[id].color = color;
+    nodes[id].amplitude = amplitude;
+    nodes[id].seed = seed;
+    return id;
+}
+
+void ProcessGraph::connect(int from, int to, float gain)
+{
+    GraphInput input = { from, gain };
+    nodes[to].inputs.push_back(input);
+}
+
+void ProcessGraph::disconnect(int from, int to)
+{
+    vector<GraphInput>& inputs = nodes[to].inputs;
+    for (size_t i = 0; i < inputs.size();)
+    {
+        if (inputs[i].source == from) inputs.erase(inputs.begin() + i);
+        else ++i;
+    }
+}
+
+void ProcessGraph::remove(int node)
+{
+    nodes[node].removed = true;
+    nodes[node].inputs.clear();
+    for (int other = 0; other < (int)nodes.size(); ++other) disconnect(node, other);
+}
+
+CompiledGraph::~CompiledGraph()
+{
+    AlignedFree(buffers);
+}
+
+static CompiledGraph* Fail(const char* why)
+{
+    SDL_Log("Can't compile processing graph: %s", why);
+    return nullptr;
+}
+
+CompiledGraph* CompileGraph(const ProcessGraph& graph, float sampleRate, bool parallel)
+{
+    const vector<GraphNode>& nodes = graph.nodes;
+    int nodeCount = (int)nodes.size();
+
+    int output = -1;
+    int engineOscillators = 0, engineVoices = 0, engineFm = 0, engineAdditive = 0, engineGrains = 0, engineWaveguides = 0;
+    for (int n = 0; n < nodeCount; ++n)
+    {
+        if (nodes[n].removed) continue;
+        if (nodes[n].type == NodeOutput)
+        {
+            if (output >= 0) return Fail("more than one output");
+            output = n;
+        }
+        engineOscillators += nodes[n].type == NodeEngineOscillator;
+        engineVoices += nodes[n].type == NodeEngineVoices;
+        engineFm += nodes[n].type == NodeEngineFm;
+        engineAdditive += nodes[n].type == NodeEngineAdditive;
+        engineGrains += nodes[n].type == NodeEngineGrains;
+        engineWaveguides += nodes[n].type == NodeEngineWaveguides;
+    }
+    if (output < 0) return Fail("no output");
+    if (engineOscillators > 1 || engineVoices > 1 || engineFm > 1 || engineAdditive > 1 || engineGrains > 1 || engineWaveguides > 1) return Fail("engine nodes can only appear once"); // they'd advance the same state twice
+
+    // only what the output can hear gets scheduled
+    vector<bool> live(nodeCount, false);
+    vector<int> stack(1, output);
+    live[output] = true;
+    int liveCount = 1;
+    while (!stack.empty())
+    {
+        int n = stack.back();
+        stack.pop_back();
+        const GraphNode& node = nodes[n];
+        bool oneInput = node.type == NodeLowpass || node.type == NodeFilter || node.type == NodeOutput;
+        bool modulated = node.type == NodeOscillator && node.inputs.size() == 1;
+        if (node.type != NodeMixer && !modulated && node.inputs.size() != (oneInput ? 1u : 0u)) return Fail("wrong number of inputs");
+        if (modulated && node.waveform >= WavetableCount) return Fail("only sine and wavetable oscillators take phase modulation");
+        for (const GraphInput& input : node.inputs)
+        {
+            if (input.source < 0 || input.source >= nodeCount || nodes[input.source].removed) return Fail("input from a missing node");
+            if (!live[input.source])
+            {
+                live[input.source] = true;
+                ++liveCount;
+                stack.push_back(input.source);
+            }
+        }
+    }
+
+    // Kahn: a node is ready once everything it reads has been scheduled
+    vector<int> pendingInputs(nodeCount, 0);
+    vector<vector<int>> readers(nodeCount);
+    vector<int> order;
+    order.reserve(liveCount);
+    for (int n = 0; n < nodeCount; ++n)
+    {
+        if (!live[n]) continue;
+        pendingInputs[n] = (int)nodes[n].inputs.size();
+        for (const GraphInput& input : nodes[n].inputs) readers[input.source].push_back(n);
+        if (pendingInputs[n] == 0) order.push_back(n);
+    }
+    for (size_t next = 0; next < order.size(); ++next)
+        for (int reader : readers[order[next]])
+            if (--pendingInputs[reader] == 0) order.push_back(reader);
+    if ((int)order.size() != liveCount) return Fail("the graph has a cycle");
+
+    CompiledGraph* compiled = new CompiledGraph;
+    compiled->stepOfNode.assign(nodeCount, -1);
+    for (int s = 0; s < liveCount; ++s) compiled->stepOfNode[order[s]] = s;
+
+    // liveness: a node's buffer is free again once the last step reading it has run. Inputs
+    // are released before the output is picked, so a step may write over one of its own
+    // inputs: filters, output and modulated oscillators read each sample before writing it,
+    // the mixer checks.
+    vector<int> lastRead(nodeCount, -1);
+    for (int s = 0; s < liveCount; ++s)
+        for (const GraphInput& input : nodes[order[s]].inputs) lastRead[input.source] = s;
+
+    vector<int> bufferOf(nodeCount, -1);
+    vector<int> freeBuffers;
+    for (int s = 0; s < liveCount; ++s)
+    {
+        int n = order[s];
+        const GraphNode& node = nodes[n];
+        GraphStep step;
+        memset(&step, 0, sizeof(step));
+        step.type = node.type;
+        step.node = n;
+        step.firstInput = (int)compiled->inputs.size();
+        step.inputCount = (int)node.inputs.size();
+        for (const GraphInput& input : node.inputs)
+        {
+            GraphInput compiledInput = { bufferOf[input.source], input.gain };
+            compiled->inputs.push_back(compiledInput);
+        }
+        for (const GraphInput& input : node.inputs)
+        {
+            if (lastRead[input.source] == s && bufferOf[input.source] >= 0)
+            {
+                freeBuffers.push_back(bufferOf[input.source]);
+                bufferOf[input.source] = -1; // read twice by the same step: release once
+            }
+        }
+
+        if (node.type == NodeOutput)
+        {
+            step.output = -1;
+        }
+        else if (!freeBuffers.empty() && !parallel)
+        {
+            step.output = freeBuffers.back();
+            freeBuffers.pop_back();
+        }
+        else
+        {
+            step.output = compiled->bufferCount++;
+        }
+        bufferOf[n] = step.output;
+
+        double increment = (double)node.frequency / sampleRate;
+        step.increment = ToFineIncrement(increment >= 0.0 && increment < 0.5 ? increment : 0.0);
+        step.amplitude = node.amplitude;
+        step.waveform = node.waveform;
+        if (node.type == NodeOscillator && step.inputCount == 1)
+        {
+            OscillatorVariant variant = { node.waveform == WaveSine ? ShapeSine : ShapeTable, InterpolateLinear, 1, true };
+            step.modulated = SelectOscillator(variant);
+        }
+        step.coefficient = 1.f - expf(-2.f * 3.14159265f * node.cutoff / sampleRate);
+        step.color = node.color;
+        SeedNoise(step.noise, node.seed);
+        if (node.type == NodeFilter)
+        {
+            compiled->filters.emplace_back(new FilterBank(node.structure, 1, sampleRate, node.filter));
+            step.filter = compiled->filters.back().get();
+            step.filterKernel = SelectFilterKernel(node.structure).render;
+        }
+        compiled->steps.push_back(step);
+    }
+
+    // who reads each step, for the parallel executor's dependency counts
+    for (int s = 0; s < liveCount; ++s)
+    {
+        GraphStep& step = compiled->steps[s];
+        step.firstReader = (int)compiled->readers.size();
+        for (int reader : readers[order[s]]) compiled->readers.push_back(compiled->stepOfNode[reader]);
+        step.readerCount = (int)compiled->readers.size() - step.firstReader;
+        if (step.inputCount == 0) compiled->sources.push_back(s);
+    }
+    if (parallel)
+    {
+        compiled->parallel = true;
+        compiled->pendingInputs.reset(new atomic<int>[liveCount]);
+        for (WorkDeque& deque : compiled->deques) deque.reserve(liveCount);
+    }
+
+    size_t bytes = (size_t)(compiled->bufferCount > 0 ? compiled->bufferCount : 1) * kGraphBlockFrames * sizeof(float);
+    compiled->buffers = reinterpret_cast<float*>(AlignedAlloc(bytes, 32));
+    memset(compiled->buffers, 0, bytes);
+    return compiled;
+}
+
+GraphSlot::~GraphSlot()
+{
+    delete pending.load();
+    delete retired.load();
+    delete current;
+}
+
+void SubmitGraph(GraphSlot& slot, CompiledGraph* graph)
+{
+    CollectGraphs(slot);
+    delete slot.pending.exchange(graph); // never picked up, so the audio thread never saw it
+}
+
+void CollectGraphs(GraphSlot& slot)
+{
+    delete slot.retired.exchange(nullptr);
+}
+
+CompiledGraph* AcquireGraph(GraphSlot& slot)
+{
+    if (slot.retired.load(memory_order_acquire) || !slot.pending.load(memory_order_relaxed)) return slot.current;
+    CompiledGraph* next = slot.pending.exchange(nullptr, memory_order_acq_rel);
+    if (!next) return slot.current;
+
+    if (CompiledGraph* previous = slot.current)
+    {
+        int carried = (int)(previous->stepOfNode.size() < next->stepOfNode.size() ? previous->stepOfNode.size() : next->stepOfNode.size());
+        for (int n = 0; n < carried; ++n)
+        {
+            int from = previous->stepOfNode[n], to = next->stepOfNode[n];
+            if (from < 0 || to < 0) continue;
+            next->steps[to].phase = previous->steps[from].phase;
+            next->steps[to].phaseRemainder = previous->steps[from].phaseRemainder;
+            next->steps[to].z = previous->steps[from].z;
+            next->steps[to].noise.counter = previous->steps[from].noise.counter;
+            next->steps[to].noise.brown = previous->steps[from].noise.brown;
+            if (next->steps[to].filter && previous->steps[from].filter) ContinueFilter(*next->steps[to].filter, *previous->steps[from].filter);
+        }
+        slot.retired.store(previous, memory_order_release);
+    }
+    slot.current = next;
+    return next;
+}
+
+// `onWorker`: the step is one of many running in parallel, so it mustn't use the pool itself
+static void RenderStep(GraphStep& step, CompiledGraph& graph, AudioEngine& engine, float* out, int frames, bool onWorker)
+{
+    float* dst = step.output >= 0 ? graph.buffers + step.output * kGraphBlockFrames : nullptr;
+    const GraphInput* inputs = graph.inputs.data() + step.firstInput;
+    switch (step.type)
+    {
+    case NodeEngineOscillator:
+        RenderOscillator(engine, dst, frames);
+        break;
+    case NodeEngineVoices:
+        memset(dst, 0, frames * sizeof(float));
+        if (!onWorker) RenderVoices(engine, dst, frames);
+        else if (engine.voices.activeCount) engine.renderVoices(engine.voices, 0, engine.voices.renderCount(), dst, frames);
+        break;
+    case NodeEngineFm:
+        memset(dst, 0, frames * sizeof(float));
+        RenderFm(engine, dst, frames);
+        break;
+    case NodeEngineAdditive:
+        memset(dst, 0, frames * sizeof(float));
+        if (engine.additive) RenderAdditive(*engine.additive, engine.renderAdditive, onWorker ? nullptr : &engine.workers, dst, frames);
+        break;
+    case NodeEngineGrains:
+        memset(dst, 0, frames * sizeof(float));
+        if (engine.grains) RenderGrains(*engine.grains, engine.renderGrains, dst, frames);
+        break;
+    case NodeEngineWaveguides:
+        memset(dst, 0, frames * sizeof(float));
+        if (engine.strings) RenderWaveguides(*engine.strings, engine.renderStrings, dst, frames);
+        if (engine.tubes) RenderWaveguides(*engine.tubes, engine.renderTubes, dst, frames);
+        break;
+    case NodeOscillator:
+        if (step.modulated)
+        {
+            OscillatorBlock block = { &GetWavetable(step.waveform), dst, frames, step.phase, ConstantPhaseRamp(step.increment.whole),
+                ConstantRamp(step.amplitude), graph.buffers + inputs[0].source * kGraphBlockFrames, inputs[0].gain, 0.5f };
+            step.phase = step.modulated(block);
+            step.phase = CarryPhase(step.phase, step.phaseRemainder, step.increment, frames);
+            break;
+        }
+        step.phase = RenderWaveform(engine, step.waveform, 0.5f, dst, frames, step.phase, ConstantPhaseRamp(step.increment.whole), ConstantRamp(step.amplitude));
+        step.phase = CarryPhase(step.phase, step.phaseRemainder, step.increment, frames);
+        break;
+    case NodeNoise:
+        engine.renderNoise(step.color, step.noise, dst, frames, ConstantRamp(step.amplitude));
+        break;
+    case NodeLowpass:
+    {
+        const float* x = graph.buffers + inputs[0].source * kGraphBlockFrames;
+        float z = step.z;
+        for (int i = 0; i < frames; ++i)
+        {
+            z += step.coefficient * (x[i] - z);
+            dst[i] = z;
+        }
+        step.z = z;
+        break;
+    }
+    case NodeFilter:
+        RenderFilters(*step.filter, step.filterKernel, graph.buffers + inputs[0].source * kGraphBlockFrames, dst, frames);
+        break;
+    case NodeMixer:
+    {
+        // the output may be one of the inputs' buffers: scale that one in place first, so
+        // nothing gets overwritten before it's read
+        float inPlace = 0.f;
+        bool aliased = false;
+        for (int k = 0; k < step.inputCount; ++k)
+        {
+            if (inputs[k].source != step.output) continue;
+            inPlace += inputs[k].gain;
+            aliased = true;
+        }
+        if (aliased) for (int i = 0; i < frames; ++i) dst[i] *= inPlace;
+        else memset(dst, 0, frames * sizeof(float));
+        for (int k = 0; k < step.inputCount; ++k)
+        {
+            if (inputs[k].source == step.output) continue;
+            const float* x = graph.buffers + inputs[k].source * kGraphBlockFrames;
+            float gain = inputs[k].gain;
+            for (int i = 0; i < frames; ++i) dst[i] += gain * x[i];
+        }
+        break;
+    }
+    case NodeOutput:
+        // a worker might finish it after the callback has given up on the block, see RunGraphParallel
+        if (!onWorker) memcpy(out, graph.buffers + inputs[0].source * kGraphBlockFrames, frames * sizeof(float));
+        break;
+    }
+}
+
+struct ParallelRun
+{
+    CompiledGraph* graph;
+    AudioEngine* engine;
+    int frames;
+    int threads;
+    Uint64 waitTicks;
+};
+
+// one per thread taking part: work from its own deque, steal when that's empty, and make
+// each step's readers ready as it finishes, until every step of the block has run. Nothing
+// ready for as long as the callback would wait for a late worker means one is: everyone
+// stops after their current step, and the callback gives up on the job.
+static void RunGraphTask(void* context, int thread)
+{
+    ParallelRun& run = *reinterpret_cast<ParallelRun*>(context);
+    CompiledGraph& graph = *run.graph;
+    WorkDeque& own = graph.deques[thread];
+    Uint64 idleSince = 0;
+    while (graph.remaining.load(memory_order_acquire) > 0 && !graph.abandoned.load(memory_order_relaxed))
+    {
+        int s = own.pop();
+        for (int k = 1; s < 0 && k < run.threads; ++k) s = graph.deques[(thread + k) % run.threads].steal();
+        if (s < 0)
+        {
+            // everything ready is being worked on
+            Uint64 now = SDL_GetPerformanceCounter();
+            if (!idleSince) idleSince = now;
+            else if (run.waitTicks && now - idleSince > run.waitTicks) graph.abandoned.store(true, memory_order_relaxed);
+            _mm_pause();
+            continue;
+        }
+        idleSince = 0;
+
+        GraphStep& step = graph.steps[s];
+        RenderStep(step, graph, *run.engine, nullptr, run.frames, true);
+        const int* readers = graph.readers.data() + step.firstReader;
+        for (int r = 0; r < step.readerCount; ++r)
+            if (graph.pendingInputs[readers[r]].fetch_sub(1, memory_order_acq_rel) == 1) own.push(readers[r]);
+        graph.remaining.fetch_sub(1, memory_order_release);
+    }
+}
+
+static bool RunGraphParallel(CompiledGraph& graph, AudioEngine& engine, float* out, int frames)
+{
+    // nobody is touching the counters or deques between blocks
+    int stepCount = (int)graph.steps.size();
+    int threads = engine.workers.workerCount + 1;
+    for (int s = 0; s < stepCount; ++s) graph.pendingInputs[s].store(graph.steps[s].inputCount, memory_order_relaxed);
+    graph.remaining.store(stepCount, memory_order_relaxed);
+    graph.abandoned.store(false, memory_order_relaxed);
+    for (int t = 0; t < threads; ++t) graph.deques[t].reset();
+    for (size_t i = 0; i < graph.sources.size(); ++i) graph.deques[i % threads].push(graph.sources[i]);
+
+    ParallelRun run = { &graph, &engine, frames, threads, engine.workers.waitTicks };
+    if (!RunParallel(engine.workers, RunGraphTask, &run, sizeof(run), threads)) return false;
+    if (graph.abandoned.load(memory_order_relaxed))
+    {
+        ++engine.workers.lateJobs; // the late one made it after all, but by then everyone had stopped
+        return false;
+    }
+
+    // everything live feeds the output, so it's the last step; only now is its input complete
+    RenderStep(graph.steps.back(), graph, engine, out, frames, false);
+    return true;
+}
+
+void RunGraph(CompiledGraph& graph, AudioEngine& engine, float* out, int frames)
+{
+    bool parallel = graph.parallel && engine.workers.workerCount > 0;
+    for (int start = 0; start < frames; start += kGraphBlockFrames)
+    {
+        int count = frames - start < kGraphBlockFrames ? frames - start : kGraphBlockFrames;
+        if (!parallel)
+        {
+            for (GraphStep& step : graph.steps) RenderStep(step, graph, engine, out + start, count, false);
+        }
+        else if (!RunGraphParallel(graph, engine, out + start, count))
+        {
+            memset(out + start, 0, (frames - start) * sizeof(float)); // see RenderBlock
+            return;
+        }
+    }
+}
@@ -0,0 +1,157 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+#include "Filter.h"
+#include "Noise.h"
+#include "OscillatorVariants.h"
+#include "Wavetable.h"
+#include "WorkDeque.h"
+#include "WorkerPool.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// A node-based processing graph. The control thread edits a ProcessGraph (a plain list of
+// nodes and their inputs) and compiles it into a CompiledGraph: a flat list of steps in
+// topological order, with every intermediate signal assigned to a buffer by liveness, so a
+// buffer is reused as soon as its last reader has run. The audio thread only ever walks the
+// step list. New graphs reach it through a GraphSlot, which swaps them in atomically between
+// blocks and hands the old one back to the control thread to free.
+
+struct AudioEngine;
+
+enum NodeType
+{
+    NodeEngineOscillator,   // the engine's own oscillator, driven by the parameter queue
+    NodeEngineVoices,       // the engine's voice pool
+    NodeEngineFm,           // the engine's FM voices
+    NodeEngineAdditive,     // the engine's additive bank, silent without one
+    NodeEngineGrains,       // the engine's grain cloud, silent without one
+    NodeEngineWaveguides,   // the engine's strings and tubes, silent without them
+    NodeOscillator,         // a fixed tone with its own phase; an input phase-modulates it
+    NodeNoise,              // white, pink or brown noise from its own seed
+    NodeLowpass,            // one-pole lowpass, exactly one input
+    NodeFilter,             // resonant state-variable or biquad filter, exactly one input
+    NodeMixer,              // sum of its inputs, each scaled by its gain
+    NodeOutput,             // exactly one input, copied to the device buffer; one per graph
+};
+
+struct GraphInput
+{
+    int source;     // node id in a ProcessGraph, buffer index once compiled
+    float gain;     // mixers, and oscillators: the modulation depth in cycles
+};
+
+struct GraphNode
+{
+    NodeType type;
+    bool removed = false;
+    float frequency = 440.f;        // NodeOscillator, Hz
+    float amplitude = 1.f;          // NodeOscillator, NodeNoise
+    Waveform waveform = WaveSine;   // NodeOscillator
+    NoiseColor color = NoiseWhite;  // NodeNoise
+    Uint32 seed = 1;                // NodeNoise
+    float cutoff = 1000.f;          // NodeLowpass, Hz
+    FilterStructure structure = FilterSvf;  // NodeFilter
+    FilterSettings filter;                  // NodeFilter; a change glides over a block
+    std::vector<GraphInput> inputs;
+};
+
+// Control thread only. Node ids are indices into `nodes` and stay valid for the life of the
+// graph (removing a node just marks it), which is what lets a recompiled graph pick up
+// each node's phase and filter memory from the one it replaces.
+struct ProcessGraph
+{
+    std::vector<GraphNode> nodes;
+
+    int add(NodeType type);
+    int addOscillator(float frequency, float amplitude, Waveform waveform);
+    int addLowpass(float cutoff);
+    int addFilter(FilterStructure structure, const FilterSettings& settings);
+    int addNoise(NoiseColor color, float amplitude, Uint32 seed);
+    void connect(int from, int to, float gain = 1.f);
+    void disconnect(int from, int to);
+    void remove(int node);          // and every connection to it
+};
+
+// longest stretch a compiled graph renders at once; longer calls are done in pieces
+static const int kGraphBlockFrames = 1024;
+
+struct GraphStep
+{
+    NodeType type;
+    int node;           // id in the ProcessGraph it was compiled from
+    int output;         // buffer index, -1 for NodeOutput
+    int firstInput;     // into CompiledGraph::inputs
+    int inputCount;
+    int firstReader;    // into CompiledGraph::readers, the steps that read this one
+    int readerCount;
+
+    // settings baked in at compile time
+    FineIncrement increment;    // NodeOscillator
+    float amplitude;
+    Waveform waveform;
+    OscillatorFn modulated;     // NodeOscillator with an input, picked from the variants
+    float coefficient;  // NodeLowpass
+    FilterKernelFn filterKernel;    // NodeFilter
+    NoiseColor color;   // NodeNoise
+
+    // state, carried over by node id when a new graph is swapped in
+    Phase phase;
+    Uint32 phaseRemainder;
+    float z;
+    NoiseState noise;   // keys from the node's seed; only the counter and integrator carry over
+    FilterBank* filter; // one channel, owned by the CompiledGraph; continues the one it replaces
+};
+
+struct CompiledGraph
+{
+    std::vector<GraphStep> steps;
+    std::vector<GraphInput> inputs;
+    std::vector<int> readers;
+    std::vector<int> stepOfNode;    // -1 for nodes that were removed or don't reach the output
+    float* buffers = nullptr;       // bufferCount * kGraphBlockFrames, 32-byte aligned
+    std::vector<std::unique_ptr<FilterBank>> filters;   // the NodeFilter steps'
+    int bufferCount = 0;
+
+    // parallel graphs only: run on the engine's workers, each ready step going to whichever
+    // thread is free. Every step gets its own buffer, since any two without a path between
+    // them may run at the same time.
+    bool parallel = false;
+    std::vector<int> sources;                   // steps without inputs, ready at the start of a block
+    std::unique_ptr<std::atomic<int>[]> pendingInputs;
+    std::atomic<int> remaining { 0 };
+    std::atomic<bool> abandoned { false };      // a step's thread was late; the rest of the block is dropped
+    WorkDeque deques[kMaxWorkers + 1];          // one per thread taking part, the callback's is 0
+
+    ~CompiledGraph();
+};
+
+// Kahn's algorithm over the nodes that reach the output, then a linear scan for buffers.
+// Returns nullptr (and logs why) for graphs that can't run: cycles, no output, wrong inputs.
+CompiledGraph* CompileGraph(const ProcessGraph& graph, float sampleRate, bool parallel = false);
+
+struct GraphSlot
+{
+    std::atomic<CompiledGraph*> pending { nullptr };    // control -> audio
+    std::atomic<CompiledGraph*> retired { nullptr };    // audio -> control
+    CompiledGraph* current = nullptr;                   // audio thread only
+
+    ~GraphSlot();   // once the audio thread has stopped
+};
+
+// control thread: queues `graph` for the next block, frees whatever the audio thread retired
+// and any earlier graph it never got round to picking up
+void SubmitGraph(GraphSlot& slot, CompiledGraph* graph);
+void CollectGraphs(GraphSlot& slot);
+
+// audio thread, once per callback: swaps in a pending graph, moving node state across; it
+// waits for the control thread to collect the previous retiree, so it never frees anything
+CompiledGraph* AcquireGraph(GraphSlot& slot);
+
+// audio thread: renders `frames` samples of the graph into out, on the workers if the graph
+// was compiled to be parallel and any are running
+void RunGraph(CompiledGraph& graph, AudioEngine& engine, float* out, int frames);
@@ -0,0 +1,230 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#include "stdafx.h"
+#include "RealtimeGuard.h"
+
+#include <atomic>
+#include <iostream>
+#include <new>
+#include <stdlib.h>
+
+#if defined(REALTIME_GUARD) && defined(__linux__)
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define CALL_SITE() _ReturnAddress()
+#else
+#define CALL_SITE() __builtin_return_address(0)
+#endif
+
+using namespace std;
+
+static const char* violationNames[ViolationKindCount] = { "operator new", "operator delete", "malloc", "free", "mutex lock" };
+
+// Open addressing on (site, kind), slots claimed with one compare-and-swap. 256 distinct sites
+// is far more than a regression ever produces; past that they're only counted in the total.
+static const int kSiteSlots = 256;
+
+struct ViolationSite
+{
+    atomic<Uint64> key;         // site << 3 | kind, 0 = free (user space addresses fit in 61 bits)
+    atomic<Uint32> count;
+};
+
+static ViolationSite sites[kSiteSlots];
+static atomic<Uint32> totalViolations { 0 };
+
+Uint32 RealtimeViolationCount()
+{
+    return totalViolations.load();
+}
+
+#if defined(REALTIME_GUARD)
+
+static thread_local int realtimeDepth = 0;
+
+void EnterRealtime() { ++realtimeDepth; }
+void LeaveRealtime() { --realtimeDepth; }
+
+static void Record(RealtimeViolation kind, void* site)
+{
+    if (realtimeDepth <= 0) return;
+    totalViolations.fetch_add(1, memory_order_relaxed);
+    Uint64 key = (Uint64)(uintptr_t)site << 3 | (Uint64)kind;
+    Uint32 slot = (Uint32)((key >> 3) * 2654435761u) % kSiteSlots;
+    for (int probe = 0; probe < kSiteSlots; ++probe, slot = (slot + 1) % kSiteSlots)
+    {
+        Uint64 existing = sites[slot].key.load(memory_order_acquire);
+        if (existing == 0 && sites[slot].key.compare_exchange_strong(existing, key, memory_order_acq_rel)) existing = key;
+        if (existing == key)
+        {
+            sites[slot].count.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+// The allocator underneath operator new. On Linux that's glibc's own entry points rather than
+// malloc, so one `new` isn't also counted as a malloc from inside this file.
+#if defined(__linux__)
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void __libc_free(void* memory);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* memory, size_t size);
+extern "C" void* __libc_memalign(size_t alignment, size_t size);
+#define RAW_MALLOC __libc_malloc
+#define RAW_FREE __libc_free
+#else
+#define RAW_MALLOC malloc
+#define RAW_FREE free
+#endif
+
+static void* Allocate(size_t size, void* site)
+{
+    Record(ViolationNew, site);
+    void* memory = RAW_MALLOC(size ? size : 1);
+    if (!memory) throw bad_alloc();
+    return memory;
+}
+
+static void Release(void* memory, void* site)
+{
+    if (!memory) return;
+    Record(ViolationDelete, site);
+    RAW_FREE(memory);
+}
+
+void* operator new(size_t size) { return Allocate(size, CALL_SITE()); }
+void* operator new[](size_t size) { return Allocate(size, CALL_SITE()); }
+void* operator new(size_t size, const nothrow_t&) noexcept
+{
+    Record(ViolationNew, CALL_SITE());
+    return RAW_MALLOC(size ? size : 1);
+}
+void* operator new[](size_t size, const nothrow_t&) noexcept
+{
+    Record(ViolationNew, CALL_SITE());
+    return RAW_MALLOC(size ? size : 1);
+}
+void operator delete(void* memory) noexcept { Release(memory, CALL_SITE()); }
+void operator delete[](void* memory) noexcept { Release(memory, CALL_SITE()); }
+void operator delete(void* memory, size_t) noexcept { Release(memory, CALL_SITE()); }
+void operator delete[](void* memory, size_t) noexcept { Release(memory, CALL_SITE()); }
+void operator delete(void* memory, const nothrow_t&) noexcept { Release(memory, CALL_SITE()); }
+void operator delete[](void* memory, const nothrow_t&) noexcept { Release(memory, CALL_SITE()); }
+
+#if defined(__linux__)
+
+// defined in the executable, so they win over libc's for every caller in the process
+extern "C" void* malloc(size_t size) noexcept
+{
+    Record(ViolationMalloc, CALL_SITE());
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) noexcept
+{
+    Record(ViolationMalloc, CALL_SITE());
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* memory, size_t size) noexcept
+{
+    Record(ViolationMalloc, CALL_SITE());
+    return __libc_realloc(memory, size);
+}
+
+// the aligned ones too: AlignedAlloc is posix_memalign, and the C library's aligned_alloc
+// doesn't go through malloc
+extern "C" int posix_memalign(void** memory, size_t alignment, size_t size) noexcept
+{
+    Record(ViolationMalloc, CALL_SITE());
+    if (alignment % sizeof(void*) || (alignment & (alignment - 1))) return EINVAL;
+    void* aligned = __libc_memalign(alignment, size);
+    if (!aligned) return ENOMEM;
+    *memory = aligned;
+    return 0;
+}
+
+extern "C" void* aligned_alloc(size_t alignment, size_t size) noexcept
+{
+    Record(ViolationMalloc, CALL_SITE());
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void* memalign(size_t alignment, size_t size) noexcept
+{
+    Record(ViolationMalloc, CALL_SITE());
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void free(void* memory) noexcept
+{
+    if (memory) Record(ViolationFree, CALL_SITE());
+    __libc_free(memory);
+}
+
+typedef int (*MutexFn)(pthread_mutex_t*);
+
+// looked up before main(), so the first lock on the audio thread doesn't go through dlsym
+static MutexFn realMutexLock = (MutexFn)dlsym(RTLD_NEXT, "pthread_mutex_lock");
+static MutexFn realMutexTrylock = (MutexFn)dlsym(RTLD_NEXT, "pthread_mutex_trylock");
+
+extern "C" int pthread_mutex_lock(pthread_mutex_t* mutex) noexcept
+{
+    Record(ViolationMutex, CALL_SITE());
+    if (!realMutexLock) realMutexLock = (MutexFn)dlsym(RTLD_NEXT, "pthread_mutex_lock");
+    return realMutexLock(mutex);
+}
+
+extern "C" int pthread_mutex_trylock(pthread_mutex_t* mutex) noexcept
+{
+    Record(ViolationMutex, CALL_SITE());
+    if (!realMutexTrylock) realMutexTrylock = (MutexFn)dlsym(RTLD_NEXT, "pthread_mutex_trylock");
+    return realMutexTrylock(mutex);
+}
+
+#endif // __linux__
+
+#endif // REALTIME_GUARD
+
+static void PrintSite(Uint64 key, Uint32 count)
+{
+    void* site = (void*)(uintptr_t)(key >> 3);
+    cout << "    " << count << " x " << violationNames[key & 7] << " from " << site;
+#if defined(REALTIME_GUARD) && defined(__linux__)
+    Dl_info info;
+    if (dladdr(site, &info) && info.dli_fname)
+    {
+        if (info.dli_sname) cout << " in " << info.dli_sname; // executables need -rdynamic for this
+        cout << " (" << info.dli_fname << " +0x" << hex << (uintptr_t)site - (uintptr_t)info.dli_fbase << dec << ")";
+    }
+#endif
+    cout << '\n';
+}
+
+void PrintRealtimeViolations()
+{
+    if (!kRealtimeGuard)
+    {
+        cout << "Real-time guard not built in (define REALTIME_GUARD)\n";
+        return;
+    }
+    Uint32 total = totalViolations.load();
+    cout << "Real-time violations: " << total << '\n';
+    Uint32 listed = 0;
+    for (const ViolationSite& slot : sites)
+    {
+        Uint64 key = slot.key.load();
+        if (!key) continue;
+        Uint32 count = slot.count.load();
+        PrintSite(key, count);
+        listed += count;
+    }
+    if (listed < total) cout << "    " << total - listed << " more from sites that didn't fit in the table\n";
+}
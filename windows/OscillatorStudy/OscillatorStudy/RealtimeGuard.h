@@ -0,0 +1,55 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+#include "SDL.h"
+
+// Diagnostic build only (define REALTIME_GUARD): proof that the audio path never allocates,
+// frees or locks. Code running audio is wrapped in a RealtimeScope; while a thread is inside
+// one, every operator new/delete is counted against its call site, and on Linux so are
+// malloc/calloc/realloc/free, posix_memalign/aligned_alloc/memalign (so AlignedAlloc) and
+// pthread_mutex_lock/trylock (interposed by defining them in the executable). The hooks never
+// allocate themselves: sites go into a fixed table.
+// On Windows only operator new/delete are caught: the CRT's malloc, _aligned_malloc (what
+// AlignedAlloc calls there) and their frees can't be replaced by defining them, so the gate
+// to trust is the Linux build.
+// Without REALTIME_GUARD all of this compiles away to nothing.
+
+enum RealtimeViolation
+{
+    ViolationNew,
+    ViolationDelete,
+    ViolationMalloc,
+    ViolationFree,
+    ViolationMutex,
+    ViolationKindCount,
+};
+
+#if defined(REALTIME_GUARD)
+
+void EnterRealtime();
+void LeaveRealtime();
+
+static const bool kRealtimeGuard = true;
+
+#else
+
+inline void EnterRealtime() {}
+inline void LeaveRealtime() {}
+
+static const bool kRealtimeGuard = false;
+
+#endif
+
+// marks the current thread real-time until the end of the scope; nests
+struct RealtimeScope
+{
+    RealtimeScope() { EnterRealtime(); }
+    ~RealtimeScope() { LeaveRealtime(); }
+};
+
+// everything counted so far, and the breakdown by call site (with symbols where the platform
+// can find them; otherwise module + offset, for addr2line)
+Uint32 RealtimeViolationCount();
+void PrintRealtimeViolations();
@@ -0,0 +1,115 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#include "stdafx.h"
+#include "RealtimeSetup.h"
+#include "SDL.h"
+#include "Simd.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+static const int kStackPrefaultBytes = 64 * 1024;
+static const size_t kPageBytes = 4096;
+
+void FlushDenormals(bool on)
+{
+    const unsigned int ftzDaz = 0x8040; // _MM_FLUSH_ZERO_ON | _MM_DENORMALS_ZERO_ON
+    unsigned int csr = _mm_getcsr();
+    _mm_setcsr(on ? csr | ftzDaz : csr & ~ftzDaz);
+}
+
+// separate and not inlined, so the array really lives below the caller's frame
+#if defined(_MSC_VER)
+__declspec(noinline)
+#else
+__attribute__((noinline))
+#endif
+static void PrefaultStack()
+{
+    char stack[kStackPrefaultBytes];
+    volatile char* touch = stack; // the writes can't be dropped, and the array counts as used
+    for (int i = 0; i < kStackPrefaultBytes; i += (int)kPageBytes) touch[i] = 0;
+}
+
+static bool TryFifo()
+{
+#if defined(__linux__)
+    // half way up the range: above anything ordinary, below the kernel's own threads
+    sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = (sched_get_priority_min(SCHED_FIFO) + sched_get_priority_max(SCHED_FIFO)) / 2;
+    return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+#else
+    return false; // SDL's HIGH is as far as Windows goes without MMCSS
+#endif
+}
+
+int PrepareRealtimeThread()
+{
+    int flags = 0;
+    if (SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH) == 0) flags |= RealtimeHighPriority;
+    if (TryFifo()) flags |= RealtimeFifo;
+    FlushDenormals(true);
+    if (_mm_getcsr() & 0x8040) flags |= RealtimeDenormalsOff;
+    PrefaultStack();
+    flags |= RealtimeStackFaulted;
+    return flags;
+}
+
+static bool LockRegion(const void* region, size_t bytes)
+{
+    bool locked = false;
+#if defined(__linux__)
+    (void)region; // mlockall covers everything, now and later
+    (void)bytes;
+    static bool lockedAll = mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+    locked = lockedAll;
+#elif defined(_WIN32)
+    SIZE_T minimum, maximum;
+    HANDLE process = GetCurrentProcess();
+    if (GetProcessWorkingSetSize(process, &minimum, &maximum))
+        SetProcessWorkingSetSize(process, minimum + bytes, maximum + bytes);
+    locked = VirtualLock(const_cast<void*>(region), bytes) != 0;
+#endif
+    return locked;
+}
+
+bool LockMemory(void* region, size_t bytes)
+{
+    bool locked = LockRegion(region, bytes);
+
+    // writing the bytes that are already there: faults every page in without changing them
+    volatile char* p = reinterpret_cast<volatile char*>(region);
+    for (size_t i = 0; i < bytes; i += kPageBytes) p[i] = p[i];
+    if (bytes) p[bytes - 1] = p[bytes - 1];
+    return locked;
+}
+
+bool LockMemory(const void* region, size_t bytes)
+{
+    bool locked = LockRegion(region, bytes);
+    volatile const char* p = reinterpret_cast<volatile const char*>(region);
+    char sink = 0;
+    for (size_t i = 0; i < bytes; i += kPageBytes) sink ^= p[i];
+    if (bytes) sink ^= p[bytes - 1];
+    (void)sink;
+    return locked;
+}
+
+void DescribeRealtimeFlags(int flags, char* text, size_t size)
+{
+    snprintf(text, size, "%s%s, denormals %s, stack %s",
+        flags & RealtimeHighPriority ? "high priority" : "normal priority",
+        flags & RealtimeFifo ? ", SCHED_FIFO" : "",
+        flags & RealtimeDenormalsOff ? "off" : "on",
+        flags & RealtimeStackFaulted ? "pre-faulted" : "not pre-faulted");
+}
@@ -0,0 +1,39 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+#include <stddef.h>
+
+// Getting the machine out of the audio path's way. Every thread that renders audio (the
+// device callback, voice workers, the render-ahead thread) calls PrepareRealtimeThread once
+// when it starts; main() locks memory before the device opens. Each step is best effort:
+// what worked is returned so it can be reported, nothing fails if it didn't.
+
+enum RealtimeFlag
+{
+    RealtimeHighPriority = 1,   // SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH)
+    RealtimeFifo = 2,           // SCHED_FIFO (Linux, needs CAP_SYS_NICE or an rtprio limit)
+    RealtimeDenormalsOff = 4,   // FTZ and DAZ set in this thread's MXCSR
+    RealtimeStackFaulted = 8,   // the first 64 KB of stack touched, so it can't page fault later
+};
+
+// on the thread to prepare; returns the RealtimeFlags it managed
+int PrepareRealtimeThread();
+
+// Flush-to-zero and denormals-are-zero for this thread. A decaying filter tail that reaches
+// the denormal range (below ~1e-38) makes every multiply take a slow microcode path, 10-100x
+// the normal cost; with these set the tail just becomes 0.
+void FlushDenormals(bool on);
+
+// Linux: mlockall, current and future pages. Windows: grows the working set and VirtualLocks
+// the region. Either way every page of the region is written once so it's resident before
+// audio starts. Call before the device opens
+bool LockMemory(void* region, size_t bytes);
+
+// the same for read-only data, like the wavetables: its pages are read instead, since writing
+// them would fault
+bool LockMemory(const void* region, size_t bytes);
+
+// "high priority, SCHED_FIFO, denormals off, stack pre-faulted"
+void DescribeRealtimeFlags(int flags, char* text, size_t size);
@@ -0,0 +1,93 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#include "stdafx.h"
+#include "RenderAhead.h"
+#include "AudioEngine.h"
+#include "RealtimeSetup.h"
+
+#include <string.h>
+#include <vector>
+
+using namespace std;
+
+// renders blocks until the ring holds the lookahead plus the block the device takes next
+static void TopUp(AudioEngine& engine, float* block)
+{
+    RenderAhead& ahead = engine.renderAhead;
+    unsigned target = (unsigned)(ahead.lookaheadFrames + ahead.blockFrames);
+    while (ahead.ring.readable() < target && ahead.ring.writable() >= (unsigned)ahead.blockFrames)
+    {
+        if (!RenderBlock(engine, block, ahead.blockFrames)) ahead.lateBlocks.fetch_add(1, memory_order_relaxed);
+        ahead.activeVoices.store(engine.voices.activeCount, memory_order_relaxed);
+        ahead.ring.write(block, ahead.blockFrames);
+    }
+}
+
+static int RenderThread(void* data)
+{
+    AudioEngine& engine = *reinterpret_cast<AudioEngine*>(data);
+    RenderAhead& ahead = engine.renderAhead;
+    ahead.realtimeFlags.store(PrepareRealtimeThread());
+    vector<float> block(ahead.blockFrames);
+    while (ahead.running.load(memory_order_relaxed))
+    {
+        TopUp(engine, block.data());
+        SDL_SemWaitTimeout(ahead.wake, 10); // the timeout only matters if the device stops
+    }
+    return 0;
+}
+
+bool StartRenderAhead(AudioEngine& engine, int blockFrames, int lookaheadFrames)
+{
+    RenderAhead& ahead = engine.renderAhead;
+    if (ahead.thread || blockFrames <= 0) return false;
+    ahead.blockFrames = blockFrames;
+    ahead.lookaheadFrames = lookaheadFrames < 0 ? 0 : lookaheadFrames;
+    ahead.ring.reserve(ahead.lookaheadFrames + 3 * blockFrames);
+    ahead.underruns.store(0);
+    ahead.lateBlocks.store(0);
+    ahead.lateReported = 0;
+    ahead.played = engine.sampleClock.load(); // the first block rendered is the first one played
+
+    // the device isn't running yet, so this thread can render the first blocks itself
+    vector<float> block(blockFrames);
+    TopUp(engine, block.data());
+
+    ahead.wake = SDL_CreateSemaphore(0);
+    ahead.running.store(true);
+    ahead.thread = ahead.wake ? SDL_CreateThread(RenderThread, "RenderAhead", &engine) : nullptr;
+    if (!ahead.thread)
+    {
+        ahead.running.store(false);
+        if (ahead.wake) SDL_DestroySemaphore(ahead.wake);
+        ahead.wake = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void StopRenderAhead(AudioEngine& engine)
+{
+    RenderAhead& ahead = engine.renderAhead;
+    if (!ahead.thread) return;
+    ahead.running.store(false);
+    SDL_SemPost(ahead.wake);
+    SDL_WaitThread(ahead.thread, nullptr);
+    SDL_DestroySemaphore(ahead.wake);
+    ahead.thread = nullptr;
+    ahead.wake = nullptr;
+}
+
+bool ReadRenderedAudio(RenderAhead& ahead, float* out, int frames)
+{
+    unsigned got = ahead.ring.read(out, (unsigned)frames);
+    if (got < (unsigned)frames)
+    {
+        memset(out + got, 0, (frames - got) * sizeof(float));
+        ahead.underruns.store(ahead.underruns.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+    ahead.played += frames;
+    SDL_SemPost(ahead.wake); // never blocks
+    return got == (unsigned)frames;
+}
@@ -0,0 +1,44 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+#include "SDL.h"
+#include "SampleRing.h"
+
+#include <atomic>
+
+// Optional decoupling of rendering from the device. A dedicated high-priority thread renders
+// blocks ahead of time into a SampleRing and the audio callback only copies out of it, so
+// a render that's late by less than the lookahead (the OS parked the thread, another process
+// hogged the core) no longer means a dropout. The price is the lookahead in extra latency.
+
+struct AudioEngine;
+
+struct RenderAhead
+{
+    SampleRing ring;
+    int blockFrames = 0;                // rendered per pass, the device's block size
+    int lookaheadFrames = 0;            // kept in the ring on top of the block being played
+
+    std::atomic<bool> running { false };
+    std::atomic<Uint32> underruns { 0 };    // callbacks that found less than a block waiting
+    std::atomic<Uint32> lateBlocks { 0 };   // blocks a late worker left partly silent, see RenderBlock
+    std::atomic<int> activeVoices { 0 };    // as of the latest block rendered, for the xrun reports
+    std::atomic<int> realtimeFlags { -1 };  // what the render thread's setup managed
+    SDL_sem* wake = nullptr;            // posted by the callback after each read
+    SDL_Thread* thread = nullptr;
+
+    // audio callback only
+    Uint64 played = 0;                  // frames handed to the device, on the engine's sample clock
+    Uint32 lateReported = 0;
+};
+
+// control thread, before the device is unpaused: fills the ring, then starts the thread
+bool StartRenderAhead(AudioEngine& engine, int blockFrames, int lookaheadFrames);
+// after the device has stopped calling back
+void StopRenderAhead(AudioEngine& engine);
+
+// audio callback: copies the next `frames` samples out, silence for whatever isn't there yet.
+// False on such an underrun.
+bool ReadRenderedAudio(RenderAhead& ahead, float* out, int frames);
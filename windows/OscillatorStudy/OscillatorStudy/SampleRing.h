@@ -0,0 +1,70 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <string.h>
+
+// Wait-free single-producer / single-consumer ring of samples, SpscQueue's sibling for audio:
+// reads and writes move whole runs of floats with at most two memcpys. The capacity is set
+// once with reserve() (a power of two, rounded up) before either side starts using it.
+
+class SampleRing
+{
+public:
+    void reserve(unsigned capacity)
+    {
+        unsigned size = 1;
+        while (size < capacity) size *= 2;
+        samples.assign(size, 0.f);
+        mask = size - 1;
+        readIndex.store(0);
+        writeIndex.store(0);
+    }
+
+    unsigned capacity() const { return mask + 1; }
+    // either side: what's there to read / room to write right now (the other side only ever
+    // makes these bigger)
+    unsigned readable() const { return writeIndex.load(std::memory_order_acquire) - readIndex.load(std::memory_order_acquire); }
+    unsigned writable() const { return capacity() - readable(); }
+
+    // producer: writes as much of `in` as fits, returns how much that was
+    unsigned write(const float* in, unsigned count)
+    {
+        unsigned write = writeIndex.load(std::memory_order_relaxed);
+        unsigned room = capacity() - (write - readIndex.load(std::memory_order_acquire));
+        if (count > room) count = room;
+        unsigned start = write & mask;
+        unsigned first = count < capacity() - start ? count : capacity() - start;
+        memcpy(samples.data() + start, in, first * sizeof(float));
+        memcpy(samples.data(), in + first, (count - first) * sizeof(float));
+        writeIndex.store(write + count, std::memory_order_release);
+        return count;
+    }
+
+    // consumer: reads up to `count` samples into out, returns how many it got
+    unsigned read(float* out, unsigned count)
+    {
+        unsigned read = readIndex.load(std::memory_order_relaxed);
+        unsigned available = writeIndex.load(std::memory_order_acquire) - read;
+        if (count > available) count = available;
+        unsigned start = read & mask;
+        unsigned first = count < capacity() - start ? count : capacity() - start;
+        memcpy(out, samples.data() + start, first * sizeof(float));
+        memcpy(out + first, samples.data(), (count - first) * sizeof(float));
+        readIndex.store(read + count, std::memory_order_release);
+        return count;
+    }
+
+private:
+    // indices on their own cache lines, as in SpscQueue
+    char padding0[64];
+    std::atomic<unsigned> readIndex { 0 };
+    char padding1[64];
+    std::atomic<unsigned> writeIndex { 0 };
+    char padding2[64];
+    std::vector<float> samples;
+    unsigned mask = 0;
+};
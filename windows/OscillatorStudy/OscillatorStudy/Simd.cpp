@@ -0,0 +1,47 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#include "stdafx.h"
+#include "Simd.h"
+#include "SDL.h"
+
+#include <stdlib.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+SimdLevel DetectSimdLevel()
+{
+    static const SimdLevel level = SDL_HasAVX2() ? SimdAVX2 : SDL_HasAVX() ? SimdAVX : SDL_HasSSE2() ? SimdSSE2 : SimdScalar;
+    return level;
+}
+
+const char* SimdLevelName(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdSSE2: return "SSE2";
+    case SimdAVX: return "AVX";
+    case SimdAVX2: return "AVX2";
+    default: return "scalar";
+    }
+}
+
+void* AlignedAlloc(size_t size, size_t alignment)
+{
+#ifdef _WIN32
+    return _aligned_malloc(size, alignment);
+#else
+    void* memory = nullptr;
+    return posix_memalign(&memory, alignment, size) == 0 ? memory : nullptr;
+#endif
+}
+
+void AlignedFree(void* memory)
+{
+#ifdef _WIN32
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+}
@@ -0,0 +1,38 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+// Everything x86 SIMD in one place. SSE2 is the baseline (every x64 CPU has it); the AVX
+// and AVX2 paths are compiled into the same binary and only picked at runtime, after
+// SDL_HasAVX / SDL_HasAVX2 say the CPU can run them.
+
+#include <emmintrin.h>
+#include <immintrin.h>
+#include <stddef.h>
+
+// MSVC lets any function use any intrinsic; gcc/clang need to be told per function
+#if defined(__GNUC__) || defined(__clang__)
+#define SIMD_TARGET_AVX __attribute__((target("avx")))
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define SIMD_TARGET_AVX
+#define SIMD_TARGET_AVX2
+#endif
+
+enum SimdLevel
+{
+    SimdScalar,
+    SimdSSE2,
+    SimdAVX,
+    SimdAVX2,   // AVX2 + FMA3 (SDL 2.0.8 can't ask for FMA separately; every AVX2 part has it)
+};
+
+// asks SDL once, then remembers
+SimdLevel DetectSimdLevel();
+const char* SimdLevelName(SimdLevel level);
+
+// for structs with alignas(32) members: C++14 `new` only guarantees 16 bytes, so those
+// structs (or whatever owns them) route operator new/delete through here
+void* AlignedAlloc(size_t size, size_t alignment);
+void AlignedFree(void* memory);
@@ -0,0 +1,145 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#include "stdafx.h"
+#include "SineKernel.h"
+
+static const float kTwoPi = 6.28318530718f;
+
+// the reference everything else is measured against
+static Phase RenderSineLibm(float* out, int frames, Phase phase, PhaseRamp increment, Ramp amplitude)
+{
+    Uint32 inc = increment.start;
+    float amp = amplitude.start;
+    for (int i = 0; i < frames; ++i)
+    {
+        out[i] = amp * sinf(kTwoPi * PhaseToCycles(phase));
+        phase += inc;
+        inc += increment.step;
+        amp += amplitude.step;
+    }
+    return phase;
+}
+
+static Phase RenderSineScalar(float* out, int frames, Phase phase, PhaseRamp increment, Ramp amplitude)
+{
+    Uint32 inc = increment.start;
+    float amp = amplitude.start;
+    for (int i = 0; i < frames; ++i)
+    {
+        out[i] = amp * SinePoly(PhaseToCycles(phase));
+        phase += inc;
+        inc += increment.step;
+        amp += amplitude.step;
+    }
+    return phase;
+}
+
+// Every SIMD variant keeps one phase per lane and steps them all at once (see SpreadPhase in
+// Phase.h), so there's no serial dependency between samples, and a ramping frequency costs
+// one more integer add per iteration. Leftovers (frames not a multiple of the width, e.g.
+// after a parameter change split the block) go through the scalar polynomial, continuing from
+// lane 0 on exactly the phase and increment the scalar kernel would have reached.
+
+static Phase RenderSineSSE2(float* out, int frames, Phase phase, PhaseRamp increment, Ramp amplitude)
+{
+    PhaseLanes lanes;
+    SpreadPhase(lanes, 4, phase, increment);
+    const __m128 lane = _mm_setr_ps(0, 1, 2, 3);
+    __m128i p = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.phase));
+    __m128i advance = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.advance));
+    __m128i advanceStep = _mm_set1_epi32((int)lanes.advanceStep);
+    __m128 amp = _mm_add_ps(_mm_set1_ps(amplitude.start), _mm_mul_ps(_mm_set1_ps(amplitude.step), lane));
+    __m128 ampStep = _mm_set1_ps(4.f * amplitude.step);
+
+    int i = 0;
+    for (; i + 4 <= frames; i += 4)
+    {
+        _mm_storeu_ps(out + i, _mm_mul_ps(amp, SinePolySSE2(PhaseToCyclesSSE2(p))));
+        p = _mm_add_epi32(p, advance);
+        advance = _mm_add_epi32(advance, advanceStep);
+        amp = _mm_add_ps(amp, ampStep);
+    }
+    if (i > 0) phase = (Phase)_mm_cvtsi128_si32(p);
+    increment.start += (Uint32)i * increment.step;
+    amplitude.start += i * amplitude.step;
+    return RenderSineScalar(out + i, frames - i, phase, increment, amplitude);
+}
+
+// plain AVX has no 256-bit integer adds, so the phases step as two SSE2 halves
+SIMD_TARGET_AVX static Phase RenderSineAVX(float* out, int frames, Phase phase, PhaseRamp increment, Ramp amplitude)
+{
+    PhaseLanes lanes;
+    SpreadPhase(lanes, 8, phase, increment);
+    const __m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    __m128i p0 = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.phase));
+    __m128i p1 = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.phase + 4));
+    __m128i advance0 = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.advance));
+    __m128i advance1 = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.advance + 4));
+    __m128i advanceStep = _mm_set1_epi32((int)lanes.advanceStep);
+    __m256 amp = _mm256_add_ps(_mm256_set1_ps(amplitude.start), _mm256_mul_ps(_mm256_set1_ps(amplitude.step), lane));
+    __m256 ampStep = _mm256_set1_ps(8.f * amplitude.step);
+    __m256 toCycles = _mm256_set1_ps(kPhaseToCycles);
+
+    int i = 0;
+    for (; i + 8 <= frames; i += 8)
+    {
+        __m256i p = _mm256_insertf128_si256(_mm256_castsi128_si256(p0), p1, 1);
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(amp, SinePolyAVX(_mm256_mul_ps(_mm256_cvtepi32_ps(p), toCycles))));
+        p0 = _mm_add_epi32(p0, advance0);
+        p1 = _mm_add_epi32(p1, advance1);
+        advance0 = _mm_add_epi32(advance0, advanceStep);
+        advance1 = _mm_add_epi32(advance1, advanceStep);
+        amp = _mm256_add_ps(amp, ampStep);
+    }
+    if (i > 0) phase = (Phase)_mm_cvtsi128_si32(p0);
+    _mm256_zeroupper();
+    increment.start += (Uint32)i * increment.step;
+    amplitude.start += i * amplitude.step;
+    return RenderSineScalar(out + i, frames - i, phase, increment, amplitude);
+}
+
+SIMD_TARGET_AVX2 static Phase RenderSineAVX2(float* out, int frames, Phase phase, PhaseRamp increment, Ramp amplitude)
+{
+    PhaseLanes lanes;
+    SpreadPhase(lanes, 8, phase, increment);
+    const __m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i p = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.phase));
+    __m256i advance = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.advance));
+    __m256i advanceStep = _mm256_set1_epi32((int)lanes.advanceStep);
+    __m256 amp = _mm256_fmadd_ps(_mm256_set1_ps(amplitude.step), lane, _mm256_set1_ps(amplitude.start));
+    __m256 ampStep = _mm256_set1_ps(8.f * amplitude.step);
+
+    int i = 0;
+    for (; i + 8 <= frames; i += 8)
+    {
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(amp, SinePolyAVX2(PhaseToCyclesAVX2(p))));
+        p = _mm256_add_epi32(p, advance);
+        advance = _mm256_add_epi32(advance, advanceStep);
+        amp = _mm256_add_ps(amp, ampStep);
+    }
+    if (i > 0) phase = (Phase)_mm_cvtsi128_si32(_mm256_castsi256_si128(p));
+    _mm256_zeroupper();
+    increment.start += (Uint32)i * increment.step;
+    amplitude.start += i * amplitude.step;
+    return RenderSineScalar(out + i, frames - i, phase, increment, amplitude);
+}
+
+const SineKernel sineKernels[] =
+{
+    { "sinf", SimdScalar, RenderSineLibm },
+    { "poly", SimdScalar, RenderSineScalar },
+    { "poly-sse2", SimdSSE2, RenderSineSSE2 },
+    { "poly-avx", SimdAVX, RenderSineAVX },
+    { "poly-avx2", SimdAVX2, RenderSineAVX2 },
+};
+const int sineKernelCount = sizeof(sineKernels) / sizeof(sineKernels[0]);
+
+const SineKernel& SelectSineKernel()
+{
+    SimdLevel level = DetectSimdLevel();
+    int best = 1; // scalar polynomial
+    for (int i = 2; i < sineKernelCount; ++i)
+        if (sineKernels[i].level <= level) best = i;
+    return sineKernels[best];
+}
@@ -0,0 +1,97 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+#include "Phase.h"
+#include "Simd.h"
+#include "Smoothing.h"
+
+#include <math.h>
+
+// Sine oscillator kernels. Phase is a Phase (Phase.h), which as cycles is always in
+// [-0.5, 0.5], so sin(2*pi*phase) only needs folding into [-0.25, 0.25] and an odd 9th order
+// polynomial (max error ~2e-7, i.e. below -130 dB) instead of a call to sinf per sample.
+
+// fills out[0..frames) with amplitude * sin(2*pi*phase), advancing phase by increment
+// (0 <= increment < half a cycle) every sample; both may ramp across the block.
+// Returns the phase to continue from
+typedef Phase (*SineKernelFn)(float* out, int frames, Phase phase, PhaseRamp increment, Ramp amplitude);
+
+struct SineKernel
+{
+    const char* name;
+    SimdLevel level;
+    SineKernelFn render;
+};
+
+extern const SineKernel sineKernels[];   // every variant, for the benchmark
+extern const int sineKernelCount;
+
+// fastest variant this CPU can run, decided once at startup
+const SineKernel& SelectSineKernel();
+
+// minimax fit of sin(2*pi*x) on [-0.25, 0.25]
+static const float kSineC1 = 6.28318516f;
+static const float kSineC3 = -41.3416550f;
+static const float kSineC5 = 81.6010041f;
+static const float kSineC7 = -76.5497823f;
+static const float kSineC9 = 39.5367061f;
+
+// x in cycles, [-0.5, 0.5]
+static inline float SinePoly(float x)
+{
+    if (x > 0.25f) x = 0.5f - x;
+    else if (x < -0.25f) x = -0.5f - x;
+    float x2 = x * x;
+    return x * ((((kSineC9 * x2 + kSineC7) * x2 + kSineC5) * x2 + kSineC3) * x2 + kSineC1);
+}
+
+// the same on 4 lanes; the fold is done with sign-bit masks so no lane ever branches
+static inline __m128 SinePolySSE2(__m128 x)
+{
+    const __m128 signBit = _mm_set1_ps(-0.f);
+    const __m128 quarter = _mm_set1_ps(0.25f);
+    __m128 sign = _mm_and_ps(x, signBit);
+    __m128 a = _mm_andnot_ps(signBit, x);
+    a = _mm_sub_ps(quarter, _mm_andnot_ps(signBit, _mm_sub_ps(a, quarter)));
+    x = _mm_or_ps(a, sign);
+    __m128 x2 = _mm_mul_ps(x, x);
+    __m128 p = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(kSineC9), x2), _mm_set1_ps(kSineC7));
+    p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(kSineC5));
+    p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(kSineC3));
+    p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(kSineC1));
+    return _mm_mul_ps(p, x);
+}
+
+SIMD_TARGET_AVX static inline __m256 SinePolyAVX(__m256 x)
+{
+    const __m256 signBit = _mm256_set1_ps(-0.f);
+    const __m256 quarter = _mm256_set1_ps(0.25f);
+    __m256 sign = _mm256_and_ps(x, signBit);
+    __m256 a = _mm256_andnot_ps(signBit, x);
+    a = _mm256_sub_ps(quarter, _mm256_andnot_ps(signBit, _mm256_sub_ps(a, quarter)));
+    x = _mm256_or_ps(a, sign);
+    __m256 x2 = _mm256_mul_ps(x, x);
+    __m256 p = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(kSineC9), x2), _mm256_set1_ps(kSineC7));
+    p = _mm256_add_ps(_mm256_mul_ps(p, x2), _mm256_set1_ps(kSineC5));
+    p = _mm256_add_ps(_mm256_mul_ps(p, x2), _mm256_set1_ps(kSineC3));
+    p = _mm256_add_ps(_mm256_mul_ps(p, x2), _mm256_set1_ps(kSineC1));
+    return _mm256_mul_ps(p, x);
+}
+
+SIMD_TARGET_AVX2 static inline __m256 SinePolyAVX2(__m256 x)
+{
+    const __m256 signBit = _mm256_set1_ps(-0.f);
+    const __m256 quarter = _mm256_set1_ps(0.25f);
+    __m256 sign = _mm256_and_ps(x, signBit);
+    __m256 a = _mm256_andnot_ps(signBit, x);
+    a = _mm256_sub_ps(quarter, _mm256_andnot_ps(signBit, _mm256_sub_ps(a, quarter)));
+    x = _mm256_or_ps(a, sign);
+    __m256 x2 = _mm256_mul_ps(x, x);
+    __m256 p = _mm256_fmadd_ps(_mm256_set1_ps(kSineC9), x2, _mm256_set1_ps(kSineC7));
+    p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(kSineC5));
+    p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(kSineC3));
+    p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(kSineC1));
+    return _mm256_mul_ps(p, x);
+}
@@ -0,0 +1,42 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#include "stdafx.h"
+#include "Smoothing.h"
+
+#include <math.h>
+
+void SmoothedValue::setTarget(float value, float sampleRate)
+{
+    if (!started)
+    {
+        current = target = value;
+        started = true;
+        return;
+    }
+    if (value == target) return;
+    target = value;
+    float frames = time * sampleRate;
+    slope = fabsf(target - current) / (frames > 1.f ? frames : 1.f);
+}
+
+Ramp SmoothedValue::next(int frames, float sampleRate)
+{
+    Ramp ramp = { current, 0.f };
+    if (current == target || frames <= 0) return ramp;
+
+    float end;
+    if (shape == RampLinear)
+    {
+        float distance = slope * frames;
+        end = target > current ? fminf(current + distance, target) : fmaxf(current - distance, target);
+    }
+    else
+    {
+        end = target + (current - target) * expf(-frames / (time * sampleRate));
+        if (fabsf(end - target) <= 1e-6f * fmaxf(fabsf(target), 1e-3f)) end = target; // close enough, stop ramping
+    }
+    ramp.step = (end - current) / frames;
+    current = end;
+    return ramp;
+}
@@ -0,0 +1,48 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+// Zipper-free parameter changes without a per-sample smoother. A one-pole filter per sample
+// would put a serial dependency in every kernel's inner loop; instead, once per block, each
+// smoothed value works out where it should be by the end of the block and hands the kernel
+// a straight line to get there. Kernels evaluate start + i * step per lane, which vectorizes
+// like any other input. Exponential smoothing becomes piecewise linear at block resolution,
+// which is inaudible at 1024 frames and below.
+
+// value at sample i of the block is start + i * step
+struct Ramp
+{
+    float start;
+    float step;
+};
+
+static inline Ramp ConstantRamp(float value)
+{
+    Ramp ramp = { value, 0.f };
+    return ramp;
+}
+
+enum RampShape
+{
+    RampLinear,         // constant slope, reaches any new target in `time` seconds
+    RampExponential,    // approaches the target with time constant `time`
+};
+
+struct SmoothedValue
+{
+    SmoothedValue(RampShape shape = RampExponential, float time = 0.01f) : shape(shape), time(time) {}
+
+    RampShape shape;
+    float time;                 // seconds
+
+    // audio thread; the first target is jumped to, later ones are ramped to
+    void setTarget(float value, float sampleRate);
+    // the line covering the next `frames` samples; advances the value to its end
+    Ramp next(int frames, float sampleRate);
+
+    float current = 0.f;
+    float target = 0.f;
+    float slope = 0.f;          // linear only, per sample
+    bool started = false;
+};
@@ -0,0 +1,52 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+#include <atomic>
+
+// Wait-free single-producer / single-consumer FIFO with a fixed, power-of-two capacity.
+// One thread may call push(), one other thread may call front()/pop(); neither ever blocks
+// or allocates, which is what makes it safe to read from inside AudioCallback.
+
+template <typename T, unsigned Capacity>
+class SpscQueue
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    // producer: false when the queue is full (the item is dropped, the caller decides what to do)
+    bool push(const T& item)
+    {
+        unsigned tail = tailIndex.load(std::memory_order_relaxed);
+        if (tail - headIndex.load(std::memory_order_acquire) == Capacity) return false;
+        items[tail & (Capacity - 1)] = item;
+        tailIndex.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer: oldest item or nullptr, stays valid until pop()
+    const T* front() const
+    {
+        unsigned head = headIndex.load(std::memory_order_relaxed);
+        if (head == tailIndex.load(std::memory_order_acquire)) return nullptr;
+        return &items[head & (Capacity - 1)];
+    }
+
+    void pop()
+    {
+        headIndex.store(headIndex.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    unsigned size() const { return tailIndex.load(std::memory_order_acquire) - headIndex.load(std::memory_order_acquire); }
+
+private:
+    // each index on its own cache line so producer and consumer don't fight over it
+    // (padding rather than alignas, so the queue can live in plain `new`ed memory)
+    char padding0[64];
+    std::atomic<unsigned> headIndex { 0 };
+    char padding1[64];
+    std::atomic<unsigned> tailIndex { 0 };
+    char padding2[64];
+    T items[Capacity];
+};
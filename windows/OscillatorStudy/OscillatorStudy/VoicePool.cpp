@@ -0,0 +1,175 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#include "stdafx.h"
+#include "VoicePool.h"
+#include "SineKernel.h"
+
+#include <string.h>
+
+VoicePool::VoicePool()
+{
+    memset(phases, 0, sizeof(phases));
+    memset(increments, 0, sizeof(increments));
+    memset(gains, 0, sizeof(gains));
+    memset(notes, 0, sizeof(notes));
+    memset(ages, 0, sizeof(ages));
+}
+
+int VoicePool::noteOn(int note, double increment, float gain)
+{
+    int slot = activeCount;
+    if (activeCount < kMaxVoices)
+    {
+        ++activeCount;
+    }
+    else
+    {
+        slot = 0;
+        for (int i = 1; i < kMaxVoices; ++i)
+            if ((Sint32)(ages[i] - ages[slot]) < 0) slot = i;
+    }
+
+    phases[slot] = 0;
+    increments[slot] = PhaseIncrement(increment);
+    gains[slot] = gain;
+    notes[slot] = note;
+    ages[slot] = nextAge++;
+    return slot;
+}
+
+void VoicePool::noteOff(int note)
+{
+    for (int i = 0; i < activeCount; ++i)
+    {
+        if (notes[i] == note)
+        {
+            remove(i);
+            return;
+        }
+    }
+}
+
+void VoicePool::allNotesOff()
+{
+    while (activeCount) remove(activeCount - 1);
+}
+
+// moves the last active voice into the hole so the active range stays packed
+void VoicePool::remove(int slot)
+{
+    int last = --activeCount;
+    phases[slot] = phases[last];
+    increments[slot] = increments[last];
+    gains[slot] = gains[last];
+    notes[slot] = notes[last];
+    ages[slot] = ages[last];
+    gains[last] = 0.f;
+    increments[last] = 0;
+}
+
+// The kernels work through the block in chunks. For each group of voices the chunk's samples
+// are accumulated per lane into `sums` (one register's worth per sample), and only when every
+// group is done does each sample get its single horizontal add. Phases are integers that wrap
+// by themselves, so the only serial dependency between samples is one integer add.
+
+static const int kVoiceChunk = 64;
+
+static void RenderVoicesScalar(VoicePool& pool, int begin, int end, float* out, int frames)
+{
+    for (int v = begin; v < end; ++v)
+    {
+        Phase phase = pool.phases[v];
+        Uint32 increment = pool.increments[v];
+        float gain = pool.gains[v];
+        for (int i = 0; i < frames; ++i)
+        {
+            out[i] += gain * SinePoly(PhaseToCycles(phase));
+            phase += increment;
+        }
+        pool.phases[v] = phase;
+    }
+}
+
+static void RenderVoicesSSE2(VoicePool& pool, int begin, int end, float* out, int frames)
+{
+    alignas(16) float sums[kVoiceChunk * 4];
+    for (int start = 0; start < frames; start += kVoiceChunk)
+    {
+        int count = frames - start < kVoiceChunk ? frames - start : kVoiceChunk;
+        for (int i = 0; i < count; ++i) _mm_store_ps(sums + 4 * i, _mm_setzero_ps());
+
+        for (int v = begin; v < end; v += 4)
+        {
+            __m128i phase = _mm_load_si128(reinterpret_cast<const __m128i*>(pool.phases + v));
+            __m128i increment = _mm_load_si128(reinterpret_cast<const __m128i*>(pool.increments + v));
+            __m128 gain = _mm_load_ps(pool.gains + v);
+            for (int i = 0; i < count; ++i)
+            {
+                __m128 sine = SinePolySSE2(PhaseToCyclesSSE2(phase));
+                _mm_store_ps(sums + 4 * i, _mm_add_ps(_mm_load_ps(sums + 4 * i), _mm_mul_ps(gain, sine)));
+                phase = _mm_add_epi32(phase, increment);
+            }
+            _mm_store_si128(reinterpret_cast<__m128i*>(pool.phases + v), phase);
+        }
+
+        for (int i = 0; i < count; ++i)
+        {
+            __m128 s = _mm_load_ps(sums + 4 * i);
+            s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+            s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+            out[start + i] += _mm_cvtss_f32(s);
+        }
+    }
+}
+
+SIMD_TARGET_AVX2 static void RenderVoicesAVX2(VoicePool& pool, int begin, int end, float* out, int frames)
+{
+    alignas(32) float sums[kVoiceChunk * 8];
+    for (int start = 0; start < frames; start += kVoiceChunk)
+    {
+        int count = frames - start < kVoiceChunk ? frames - start : kVoiceChunk;
+        for (int i = 0; i < count; ++i) _mm256_store_ps(sums + 8 * i, _mm256_setzero_ps());
+
+        for (int v = begin; v < end; v += 8)
+        {
+            __m256i phase = _mm256_load_si256(reinterpret_cast<const __m256i*>(pool.phases + v));
+            __m256i increment = _mm256_load_si256(reinterpret_cast<const __m256i*>(pool.increments + v));
+            __m256 gain = _mm256_load_ps(pool.gains + v);
+            for (int i = 0; i < count; ++i)
+            {
+                __m256 sine = SinePolyAVX2(PhaseToCyclesAVX2(phase));
+                _mm256_store_ps(sums + 8 * i, _mm256_fmadd_ps(gain, sine, _mm256_load_ps(sums + 8 * i)));
+                phase = _mm256_add_epi32(phase, increment);
+            }
+            _mm256_store_si256(reinterpret_cast<__m256i*>(pool.phases + v), phase);
+        }
+
+        for (int i = 0; i < count; ++i)
+        {
+            __m256 s8 = _mm256_load_ps(sums + 8 * i);
+            __m128 s = _mm_add_ps(_mm256_castps256_ps128(s8), _mm256_extractf128_ps(s8, 1));
+            s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+            s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+            out[start + i] += _mm_cvtss_f32(s);
+        }
+    }
+    _mm256_zeroupper();
+}
+
+const VoiceKernel voiceKernels[] =
+{
+    { "scalar", SimdScalar, RenderVoicesScalar },
+    { "sse2", SimdSSE2, RenderVoicesSSE2 },
+    { "avx2", SimdAVX2, RenderVoicesAVX2 },
+};
+const int voiceKernelCount = sizeof(voiceKernels) / sizeof(voiceKernels[0]);
+
+const VoiceKernel& SelectVoiceKernel()
+{
+    SimdLevel level = DetectSimdLevel();
+    int best = 0;
+    for (int i = 1; i < voiceKernelCount; ++i)
+        if (voiceKernels[i].level <= level) best = i;
+    return voiceKernels[best];
+}
@@ -0,0 +1,57 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+#include "SDL.h"
+#include "Phase.h"
+#include "Simd.h"
+
+// Polyphonic sine voices in structure-of-arrays form: each property is its own 32-byte aligned
+// array, so one AVX load picks up the same property of 8 neighbouring voices. Active voices
+// are kept packed at [0, activeCount) and everything past them has zero gain, so the kernels
+// can always work on whole groups of kVoiceGroup voices without checking who's playing.
+// Fixed capacity, nothing is ever allocated once the pool exists.
+
+static const int kMaxVoices = 256;
+static const int kVoiceGroup = 8;
+
+struct VoicePool
+{
+    alignas(32) Phase phases[kMaxVoices];
+    alignas(32) Uint32 increments[kMaxVoices];  // phase units per sample
+    alignas(32) float gains[kMaxVoices];
+    int notes[kMaxVoices];                      // caller's id from noteOn, to find the voice again
+    Uint32 ages[kMaxVoices];                    // start order, oldest gets stolen first
+    int activeCount = 0;
+    Uint32 nextAge = 0;
+
+    VoicePool();
+
+    // starts a voice (increment in cycles per sample); when all are busy the oldest is
+    // stolen. Returns its slot
+    int noteOn(int note, double increment, float gain);
+    void noteOff(int note);
+    void allNotesOff();
+
+    // how many voices a kernel has to touch: activeCount rounded up to whole groups
+    int renderCount() const { return (activeCount + kVoiceGroup - 1) / kVoiceGroup * kVoiceGroup; }
+
+private:
+    void remove(int slot);
+};
+
+// adds voices [begin, end) (multiples of kVoiceGroup) into out[0..frames)
+typedef void (*VoiceKernelFn)(VoicePool& pool, int begin, int end, float* out, int frames);
+
+struct VoiceKernel
+{
+    const char* name;
+    SimdLevel level;
+    VoiceKernelFn render;
+};
+
+extern const VoiceKernel voiceKernels[];
+extern const int voiceKernelCount;
+
+const VoiceKernel& SelectVoiceKernel();
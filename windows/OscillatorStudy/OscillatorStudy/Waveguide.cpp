@@ -0,0 +1,504 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#include "stdafx.h"
+#include "Waveguide.h"
+
+#include <math.h>
+#include <string.h>
+
+static const float kStringSeconds = 4.f;    // to fall 60 dB, before the average's own losses
+static const float kDampedSeconds = 0.15f;  // after note off
+static const float kPluckBrightness = 0.5f; // one-pole on the pluck's noise, 1 is white
+static const float kBreathPressure = 0.8f;
+static const float kBreathSeconds = 0.02f;  // attack and release
+static const float kBreathNoise = 0.2f;     // turbulence, relative to the pressure
+static const float kBoreReflection = 0.95f;
+static const float kReedOffset = 0.7f;      // the reed's opening at rest...
+static const float kReedSlope = -0.3f;      // ...and how it closes with the pressure difference
+static const float kSilence = 1e-4f;        // a string quieter than this retires, a tube once released
+
+// a free block's list links live in its first two samples
+static inline int GetLink(const DelayArena& arena, int offset, int which)
+{
+    Sint32 link;
+    memcpy(&link, &arena.samples[offset + which], sizeof(link));
+    return link;
+}
+
+static inline void SetLink(DelayArena& arena, int offset, int which, int link)
+{
+    Sint32 value = link;
+    memcpy(&arena.samples[offset + which], &value, sizeof(value));
+}
+
+DelayArena::DelayArena()
+{
+    memset(samples, 0, sizeof(samples));
+    memset(freeOrders, -1, sizeof(freeOrders));
+    for (int order = 0; order <= kMaxDelayBits; ++order) freeLists[order] = -1;
+    for (int offset = (1 << kDelayArenaBits) - (1 << kMaxDelayBits); offset >= 0; offset -= 1 << kMaxDelayBits)
+        push(offset, kMaxDelayBits);
+}
+
+void DelayArena::push(int offset, int order)
+{
+    int head = freeLists[order];
+    SetLink(*this, offset, 0, head);
+    SetLink(*this, offset, 1, -1);
+    if (head >= 0) SetLink(*this, head, 1, offset);
+    freeLists[order] = offset;
+    freeOrders[offset >> kMinDelayBits] = (Sint8)order;
+}
+
+void DelayArena::unlink(int offset, int order)
+{
+    int next = GetLink(*this, offset, 0);
+    int previous = GetLink(*this, offset, 1);
+    if (previous >= 0) SetLink(*this, previous, 0, next);
+    else freeLists[order] = next;
+    if (next >= 0) SetLink(*this, next, 1, previous);
+    freeOrders[offset >> kMinDelayBits] = -1;
+}
+
+int DelayArena::allocate(int order)
+{
+    int from = order;
+    while (from <= kMaxDelayBits && freeLists[from] < 0) ++from;
+    if (from > kMaxDelayBits) return -1;
+    int offset = freeLists[from];
+    unlink(offset, from);
+    while (from > order) // the upper halves of what's left over go back, each a size down
+    {
+        --from;
+        push(offset + (1 << from), from);
+    }
+    return offset;
+}
+
+void DelayArena::release(int offset, int order)
+{
+    // merge with the buddy (the other half of the block one size up) for as long as it's free
+    while (order < kMaxDelayBits)
+    {
+        int buddy = offset ^ (1 << order);
+        if (freeOrders[buddy >> kMinDelayBits] != order) break;
+        unlink(buddy, order);
+        offset &= ~(1 << order);
+        ++order;
+    }
+    push(offset, order);
+}
+
+static inline Uint32 XorShift(Uint32 x)
+{
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+static const float kToUnit = 1.f / 2147483648.f;   // xorshift state read as signed -> [-1, 1)
+
+WaveguideVoices::WaveguideVoices(WaveguideModel model, float sampleRate) : model(model), sampleRate(sampleRate)
+{
+    sink = arena.allocate(kMinDelayBits);
+    memset(arena.samples + sink, 0, (1 << kMinDelayBits) * sizeof(float));
+    memset(mix, 0, sizeof(mix));
+    for (int slot = 0; slot < kMaxWaveguideVoices; ++slot) lines[slot] = sink;
+    activeCount = kMaxWaveguideVoices;
+    allNotesOff(); // leaves every slot idle
+}
+
+// the oldest voice's slot; only called with voices playing
+static int OldestVoice(const WaveguideVoices& voices)
+{
+    int oldest = 0;
+    for (int i = 1; i < voices.activeCount; ++i)
+        if ((Sint32)(voices.ages[i] - voices.ages[oldest]) < 0) oldest = i;
+    return oldest;
+}
+
+int WaveguideVoices::noteOn(int note, double increment, float gain)
+{
+    if (!(increment > 0.0)) return -1;
+
+    // the loop is the line, the allpass and the average's half sample: one period, or for
+    // the bore half of one. The allpass is kept between 0.5 and 1.5 samples, where its
+    // delay is flattest across frequency
+    double period = 1.0 / increment;
+    double loop = (model == WaveguideTube ? 0.5 * period : period) - 0.5;
+    int delay = (int)(loop - 0.5);
+    int longest = (1 << kMaxDelayBits) - 1;
+    delay = delay < 2 ? 2 : (delay > longest ? longest : delay);
+    double fraction = loop - delay;
+    fraction = fraction < 0.5 ? 0.5 : (fraction > 1.5 ? 1.5 : fraction);
+    int order = kMinDelayBits;
+    while ((1 << order) <= delay) ++order; // the write lands `delay` samples ahead of the read
+
+    int line = arena.allocate(order);
+    while (line < 0 && activeCount)
+    {
+        remove(OldestVoice(*this));
+        line = arena.allocate(order);
+    }
+    if (line < 0) return -1;
+    if (activeCount == kMaxWaveguideVoices) remove(OldestVoice(*this));
+    int slot = activeCount++;
+
+    lines[slot] = line;
+    masks[slot] = (1 << order) - 1;
+    orders[slot] = (Uint8)order;
+    delays[slot] = delay;
+    writes[slot] = delay; // so the first reads are samples 0 .. delay - 1
+    allpass[slot] = (float)((1.0 - fraction) / (1.0 + fraction));
+    allpassIn[slot] = 0.f;
+    allpassOut[slot] = 0.f;
+    loopGains[slot] = (float)pow(10.0, -3.0 * period / (kStringSeconds * sampleRate));
+    gains[slot] = gain;
+    peaks[slot] = 0.f;
+    noise[slot] = XorShift(0x9e3779b9u ^ (nextAge * 0x85ebca6bu)) | 1; // never 0, xorshift would stay there
+    notes[slot] = note;
+    ages[slot] = nextAge++;
+    released[slot] = 0;
+
+    float* samples = arena.samples + line;
+    if (model == WaveguideString)
+    {
+        // the pluck: lowpassed noise, without its DC, which would otherwise ring forever
+        float y = 0.f, sum = 0.f;
+        Uint32 random = noise[slot];
+        for (int i = 0; i < delay; ++i)
+        {
+            random = XorShift(random);
+            y += kPluckBrightness * ((float)(Sint32)random * kToUnit - y);
+            samples[i] = y;
+            sum += y;
+        }
+        float mean = sum / delay;
+        for (int i = 0; i < delay; ++i) samples[i] -= mean;
+        breath[slot] = breathTargets[slot] = breathRates[slot] = 0.f;
+    }
+    else
+    {
+        memset(samples, 0, delay * sizeof(float));
+        breath[slot] = 0.f;
+        breathTargets[slot] = kBreathPressure;
+        breathRates[slot] = kBreathPressure / (kBreathSeconds * sampleRate);
+    }
+    return slot;
+}
+
+void WaveguideVoices::noteOff(int note)
+{
+    for (int i = 0; i < activeCount; ++i)
+    {
+        if (notes[i] == note && !released[i])
+        {
+            // g^(T / T') falls 60 dB in T' where g took T
+            if (model == WaveguideString) loopGains[i] = powf(loopGains[i], kStringSeconds / kDampedSeconds);
+            breathTargets[i] = 0.f;
+            released[i] = 1;
+            return;
+        }
+    }
+}
+
+void WaveguideVoices::allNotesOff()
+{
+    while (activeCount) remove(activeCount - 1);
+}
+
+// returns the line to the arena and moves the last active voice into the hole; the last
+// slot is left idle, reading and writing silence on the sink
+void WaveguideVoices::remove(int slot)
+{
+    int last = --activeCount;
+    if (lines[slot] != sink) arena.release(lines[slot], orders[slot]);
+    lines[slot] = lines[last];
+    masks[slot] = masks[last];
+    writes[slot] = writes[last];
+    delays[slot] = delays[last];
+    allpass[slot] = allpass[last];
+    allpassIn[slot] = allpassIn[last];
+    allpassOut[slot] = allpassOut[last];
+    loopGains[slot] = loopGains[last];
+    gains[slot] = gains[last];
+    breath[slot] = breath[last];
+    breathTargets[slot] = breathTargets[last];
+    breathRates[slot] = breathRates[last];
+    noise[slot] = noise[last];
+    peaks[slot] = peaks[last];
+    notes[slot] = notes[last];
+    ages[slot] = ages[last];
+    orders[slot] = orders[last];
+    released[slot] = released[last];
+
+    lines[last] = sink;
+    masks[last] = (1 << kMinDelayBits) - 1;
+    writes[last] = 0;
+    delays[last] = 2;
+    allpass[last] = allpassIn[last] = allpassOut[last] = 0.f;
+    loopGains[last] = gains[last] = 0.f;
+    breath[last] = breathTargets[last] = breathRates[last] = 0.f;
+    noise[last] = 0;
+    peaks[last] = 0.f;
+    orders[last] = kMinDelayBits;
+    released[last] = 1;
+}
+
+template <WaveguideModel Model>
+static void RenderWaveguidesScalar(WaveguideVoices& voices, int begin, int end, int frames)
+{
+    for (int v = begin; v < end; ++v)
+    {
+        float* line = voices.arena.samples + voices.lines[v];
+        Sint32 mask = voices.masks[v];
+        Sint32 write = voices.writes[v];
+        Sint32 delay = voices.delays[v];
+        float c = voices.allpass[v];
+        float in1 = voices.allpassIn[v];
+        float out1 = voices.allpassOut[v];
+        float loopGain = voices.loopGains[v];
+        float gain = voices.gains[v];
+        float breath = voices.breath[v];
+        float target = voices.breathTargets[v];
+        float rate = voices.breathRates[v];
+        Uint32 noise = voices.noise[v];
+        float peak = 0.f;
+        int lane = v % kWaveguideGroup;
+        for (int i = 0; i < frames; ++i, ++write)
+        {
+            float x = line[(write - delay) & mask];
+            float ap = c * (x - out1) + in1;
+            float average = 0.5f * (ap + out1);
+            in1 = x;
+            out1 = ap;
+            float y;
+            if (Model == WaveguideString)
+            {
+                y = loopGain * average;
+                line[write & mask] = y;
+            }
+            else
+            {
+                float step = target - breath;
+                breath += step > rate ? rate : (step < -rate ? -rate : step);
+                noise = XorShift(noise);
+                float pressure = breath + breath * kBreathNoise * ((float)(Sint32)noise * kToUnit);
+                float difference = -kBoreReflection * average - pressure;
+                float reed = kReedOffset + kReedSlope * difference;
+                reed = reed > 1.f ? 1.f : (reed < -1.f ? -1.f : reed);
+                line[write & mask] = pressure + difference * reed;
+                y = ap;
+            }
+            voices.mix[i][lane] += gain * y;
+            peak = fabsf(y) > peak ? fabsf(y) : peak;
+        }
+        voices.writes[v] = write & mask; // a tube can be held for days; the count mustn't overflow
+        voices.allpassIn[v] = in1;
+        voices.allpassOut[v] = out1;
+        voices.breath[v] = breath;
+        voices.noise[v] = noise;
+        voices.peaks[v] = peak;
+    }
+}
+
+static inline __m128i XorShiftSSE2(__m128i x)
+{
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+    return _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+}
+
+// 4 voices at a time, the two halves of a group in turn; no gathers or scatters, so each
+// lane's read and write go through memory on their own
+template <WaveguideModel Model>
+static void RenderWaveguidesSSE2(WaveguideVoices& voices, int begin, int end, int frames)
+{
+    const float* samples = voices.arena.samples;
+    const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    for (int v = begin; v < end; v += 4)
+    {
+        __m128i line = _mm_load_si128(reinterpret_cast<const __m128i*>(voices.lines + v));
+        __m128i mask = _mm_load_si128(reinterpret_cast<const __m128i*>(voices.masks + v));
+        __m128i write = _mm_load_si128(reinterpret_cast<const __m128i*>(voices.writes + v));
+        __m128i delay = _mm_load_si128(reinterpret_cast<const __m128i*>(voices.delays + v));
+        __m128 c = _mm_load_ps(voices.allpass + v);
+        __m128 in1 = _mm_load_ps(voices.allpassIn + v);
+        __m128 out1 = _mm_load_ps(voices.allpassOut + v);
+        __m128 loopGain = _mm_load_ps(voices.loopGains + v);
+        __m128 gain = _mm_load_ps(voices.gains + v);
+        __m128 breath = _mm_load_ps(voices.breath + v);
+        __m128 target = _mm_load_ps(voices.breathTargets + v);
+        __m128 rate = _mm_load_ps(voices.breathRates + v);
+        __m128i noise = _mm_load_si128(reinterpret_cast<const __m128i*>(voices.noise + v));
+        __m128 peak = _mm_setzero_ps();
+        int half = v % kWaveguideGroup;
+        alignas(16) Sint32 reads[4];
+        alignas(16) Sint32 writes[4];
+        alignas(16) float values[4];
+
+        for (int i = 0; i < frames; ++i)
+        {
+            _mm_store_si128(reinterpret_cast<__m128i*>(reads), _mm_add_epi32(line, _mm_and_si128(_mm_sub_epi32(write, delay), mask)));
+            __m128 x = _mm_set_ps(samples[reads[3]], samples[reads[2]], samples[reads[1]], samples[reads[0]]);
+            __m128 ap = _mm_add_ps(_mm_mul_ps(c, _mm_sub_ps(x, out1)), in1);
+            __m128 average = _mm_mul_ps(_mm_set1_ps(0.5f), _mm_add_ps(ap, out1));
+            in1 = x;
+            out1 = ap;
+            __m128 y, written;
+            if (Model == WaveguideString)
+            {
+                y = written = _mm_mul_ps(loopGain, average);
+            }
+            else
+            {
+                breath = _mm_add_ps(breath, _mm_max_ps(_mm_sub_ps(_mm_setzero_ps(), rate), _mm_min_ps(rate, _mm_sub_ps(target, breath))));
+                noise = XorShiftSSE2(noise);
+                __m128 turbulence = _mm_mul_ps(_mm_cvtepi32_ps(noise), _mm_set1_ps(kBreathNoise * kToUnit));
+                __m128 pressure = _mm_add_ps(breath, _mm_mul_ps(breath, turbulence));
+                __m128 difference = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(-kBoreReflection), average), pressure);
+                __m128 reed = _mm_add_ps(_mm_set1_ps(kReedOffset), _mm_mul_ps(_mm_set1_ps(kReedSlope), difference));
+                reed = _mm_max_ps(_mm_set1_ps(-1.f), _mm_min_ps(_mm_set1_ps(1.f), reed));
+                written = _mm_add_ps(pressure, _mm_mul_ps(difference, reed));
+                y = ap;
+            }
+            _mm_store_si128(reinterpret_cast<__m128i*>(writes), _mm_add_epi32(line, _mm_and_si128(write, mask)));
+            _mm_store_ps(values, written);
+            for (int lane = 0; lane < 4; ++lane) voices.arena.samples[writes[lane]] = values[lane];
+            write = _mm_add_epi32(write, _mm_set1_epi32(1));
+
+            float* mix = voices.mix[i] + half;
+            _mm_store_ps(mix, _mm_add_ps(_mm_load_ps(mix), _mm_mul_ps(gain, y)));
+            peak = _mm_max_ps(peak, _mm_and_ps(y, signMask));
+        }
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(voices.writes + v), _mm_and_si128(write, mask));
+        _mm_store_ps(voices.allpassIn + v, in1);
+        _mm_store_ps(voices.allpassOut + v, out1);
+        _mm_store_ps(voices.breath + v, breath);
+        _mm_store_si128(reinterpret_cast<__m128i*>(voices.noise + v), noise);
+        _mm_store_ps(voices.peaks + v, peak);
+    }
+}
+
+SIMD_TARGET_AVX2 static inline __m256i XorShiftAVX2(__m256i x)
+{
+    x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+    return _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+}
+
+// 8 voices at a time. The reads go lane by lane like the writes: a gather measured no faster
+// for the tubes and three times slower for the strings than eight plain loads
+template <WaveguideModel Model>
+SIMD_TARGET_AVX2 static void RenderWaveguidesAVX2(WaveguideVoices& voices, int begin, int end, int frames)
+{
+    float* samples = voices.arena.samples;
+    const __m256 signMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    for (int v = begin; v < end; v += 8)
+    {
+        __m256i line = _mm256_load_si256(reinterpret_cast<const __m256i*>(voices.lines + v));
+        __m256i mask = _mm256_load_si256(reinterpret_cast<const __m256i*>(voices.masks + v));
+        __m256i write = _mm256_load_si256(reinterpret_cast<const __m256i*>(voices.writes + v));
+        __m256i delay = _mm256_load_si256(reinterpret_cast<const __m256i*>(voices.delays + v));
+        __m256 c = _mm256_load_ps(voices.allpass + v);
+        __m256 in1 = _mm256_load_ps(voices.allpassIn + v);
+        __m256 out1 = _mm256_load_ps(voices.allpassOut + v);
+        __m256 loopGain = _mm256_load_ps(voices.loopGains + v);
+        __m256 gain = _mm256_load_ps(voices.gains + v);
+        __m256 breath = _mm256_load_ps(voices.breath + v);
+        __m256 target = _mm256_load_ps(voices.breathTargets + v);
+        __m256 rate = _mm256_load_ps(voices.breathRates + v);
+        __m256i noise = _mm256_load_si256(reinterpret_cast<const __m256i*>(voices.noise + v));
+        __m256 peak = _mm256_setzero_ps();
+        alignas(32) Sint32 reads[8];
+        alignas(32) Sint32 writes[8];
+        alignas(32) float values[8];
+
+        for (int i = 0; i < frames; ++i)
+        {
+            _mm256_store_si256(reinterpret_cast<__m256i*>(reads), _mm256_add_epi32(line, _mm256_and_si256(_mm256_sub_epi32(write, delay), mask)));
+            __m256 x = _mm256_setr_ps(samples[reads[0]], samples[reads[1]], samples[reads[2]], samples[reads[3]],
+                samples[reads[4]], samples[reads[5]], samples[reads[6]], samples[reads[7]]);
+            __m256 ap = _mm256_fmadd_ps(c, _mm256_sub_ps(x, out1), in1);
+            __m256 average = _mm256_mul_ps(_mm256_set1_ps(0.5f), _mm256_add_ps(ap, out1));
+            in1 = x;
+            out1 = ap;
+            __m256 y, written;
+            if (Model == WaveguideString)
+            {
+                y = written = _mm256_mul_ps(loopGain, average);
+            }
+            else
+            {
+                breath = _mm256_add_ps(breath, _mm256_max_ps(_mm256_sub_ps(_mm256_setzero_ps(), rate), _mm256_min_ps(rate, _mm256_sub_ps(target, breath))));
+                noise = XorShiftAVX2(noise);
+                __m256 turbulence = _mm256_mul_ps(_mm256_cvtepi32_ps(noise), _mm256_set1_ps(kBreathNoise * kToUnit));
+                __m256 pressure = _mm256_fmadd_ps(breath, turbulence, breath);
+                __m256 difference = _mm256_fmsub_ps(_mm256_set1_ps(-kBoreReflection), average, pressure);
+                __m256 reed = _mm256_fmadd_ps(_mm256_set1_ps(kReedSlope), difference, _mm256_set1_ps(kReedOffset));
+                reed = _mm256_max_ps(_mm256_set1_ps(-1.f), _mm256_min_ps(_mm256_set1_ps(1.f), reed));
+                written = _mm256_fmadd_ps(difference, reed, pressure);
+                y = ap;
+            }
+            _mm256_store_si256(reinterpret_cast<__m256i*>(writes), _mm256_add_epi32(line, _mm256_and_si256(write, mask)));
+            _mm256_store_ps(values, written);
+            for (int lane = 0; lane < 8; ++lane) samples[writes[lane]] = values[lane];
+            write = _mm256_add_epi32(write, _mm256_set1_epi32(1));
+
+            float* mix = voices.mix[i];
+            _mm256_store_ps(mix, _mm256_fmadd_ps(gain, y, _mm256_load_ps(mix)));
+            peak = _mm256_max_ps(peak, _mm256_and_ps(y, signMask));
+        }
+
+        _mm256_store_si256(reinterpret_cast<__m256i*>(voices.writes + v), _mm256_and_si256(write, mask));
+        _mm256_store_ps(voices.allpassIn + v, in1);
+        _mm256_store_ps(voices.allpassOut + v, out1);
+        _mm256_store_ps(voices.breath + v, breath);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(voices.noise + v), noise);
+        _mm256_store_ps(voices.peaks + v, peak);
+    }
+    _mm256_zeroupper();
+}
+
+const WaveguideKernel waveguideKernels[] =
+{
+    { "string-scalar", SimdScalar, WaveguideString, RenderWaveguidesScalar<WaveguideString> },
+    { "string-sse2", SimdSSE2, WaveguideString, RenderWaveguidesSSE2<WaveguideString> },
+    { "string-avx2", SimdAVX2, WaveguideString, RenderWaveguidesAVX2<WaveguideString> },
+    { "tube-scalar", SimdScalar, WaveguideTube, RenderWaveguidesScalar<WaveguideTube> },
+    { "tube-sse2", SimdSSE2, WaveguideTube, RenderWaveguidesSSE2<WaveguideTube> },
+    { "tube-avx2", SimdAVX2, WaveguideTube, RenderWaveguidesAVX2<WaveguideTube> },
+};
+const int waveguideKernelCount = sizeof(waveguideKernels) / sizeof(waveguideKernels[0]);
+
+const WaveguideKernel& SelectWaveguideKernel(WaveguideModel model)
+{
+    SimdLevel level = DetectSimdLevel();
+    int best = -1;
+    for (int i = 0; i < waveguideKernelCount; ++i)
+        if (waveguideKernels[i].model == model && waveguideKernels[i].level <= level) best = i;
+    return waveguideKernels[best];
+}
+
+void RenderWaveguides(WaveguideVoices& voices, WaveguideKernelFn kernel, float* out, int frames)
+{
+    for (int start = 0; start < frames && voices.activeCount; start += kWaveguideChunk)
+    {
+        int count = frames - start < kWaveguideChunk ? frames - start : kWaveguideChunk;
+        memset(voices.mix, 0, count * sizeof(voices.mix[0]));
+        kernel(voices, 0, voices.renderCount(), count);
+        for (int i = 0; i < count; ++i)
+        {
+            float sum = 0.f;
+            for (int lane = 0; lane < kWaveguideGroup; ++lane) sum += voices.mix[i][lane];
+            out[start + i] += sum;
+        }
+
+        // a string that has rung out, or a tube that's been let go and gone quiet
+        for (int v = voices.activeCount - 1; v >= 0; --v)
+            if (voices.peaks[v] < kSilence && (voices.model == WaveguideString || voices.released[v])) voices.remove(v);
+    }
+}
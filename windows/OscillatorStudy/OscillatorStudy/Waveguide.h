@@ -0,0 +1,125 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+#include "SDL.h"
+#include "Simd.h"
+
+// Physical models built on one recirculating delay line per voice. A plucked string is
+// Karplus-Strong: the line starts full of filtered noise, and every pass through it goes
+// through a two-point average (the string's losses, more at high frequencies) and a little
+// gain below 1. A tube is the reed-and-bore loop of a clarinet: breath pressure against the
+// wave coming back down the bore, through a reed that closes as the difference grows, the
+// difference sent back in; the bore's delay is half the period, so it sounds the odd
+// harmonics, and it sounds only while it's being blown.
+//
+// A delay line is a power-of-two ring buffer read at write - delay, both masked, so nothing
+// ever compares against the end. The loop's length rarely comes out a whole number of
+// samples; the fraction is a first-order allpass (delay between 0.5 and 1.5 samples, flat
+// gain, so it tunes the loop without damping it).
+//
+// Lines come from a DelayArena, one block owned by the voices, split buddy-style into
+// power-of-two blocks: a line is exactly its own size and hundreds of short lines pack
+// together instead of each sitting at the start of a maximum-length slot. Voices are
+// structure-of-arrays like FmVoices, one voice per lane; the kernels load each lane's
+// read and store its write separately, since every lane has its own line.
+
+static const int kMaxWaveguideVoices = 256;
+static const int kWaveguideGroup = 8;
+static const int kWaveguideChunk = 256;     // frames per pass; quiet voices retire between
+static const int kMinDelayBits = 4;
+static const int kMaxDelayBits = 12;        // 4096 samples: a string down to ~11 Hz at 44.1 kHz
+static const int kDelayArenaBits = 19;      // 2 MB, 128 of the longest lines or far more short ones
+
+struct DelayArena
+{
+    alignas(64) float samples[1 << kDelayArenaBits];
+    Sint8 freeOrders[1 << (kDelayArenaBits - kMinDelayBits)];   // of the free block starting here, -1 if none
+    int freeLists[kMaxDelayBits + 1];   // offset of the first free block of each order, -1 if none;
+                                        // a free block's first two samples link it to the others
+
+    DelayArena();
+
+    // offset of a block of 2^order samples (kMinDelayBits <= order <= kMaxDelayBits), -1
+    // when nothing that big is free; its contents are whatever was there
+    int allocate(int order);
+    void release(int offset, int order);
+
+private:
+    void push(int offset, int order);
+    void unlink(int offset, int order);
+};
+
+enum WaveguideModel
+{
+    WaveguideString,    // plucked at note on, damped at note off
+    WaveguideTube,      // blown from note on to note off
+};
+
+// fixed capacity, nothing is allocated once it exists; owned by the audio thread once playing
+struct WaveguideVoices
+{
+    DelayArena arena;
+    alignas(32) Sint32 lines[kMaxWaveguideVoices];      // arena offsets
+    alignas(32) Sint32 masks[kMaxWaveguideVoices];
+    alignas(32) Sint32 writes[kMaxWaveguideVoices];     // within the mask between passes
+    alignas(32) Sint32 delays[kMaxWaveguideVoices];     // whole samples, the allpass adds the rest
+    alignas(32) float allpass[kMaxWaveguideVoices];     // coefficient
+    alignas(32) float allpassIn[kMaxWaveguideVoices];   // last sample in and out
+    alignas(32) float allpassOut[kMaxWaveguideVoices];
+    alignas(32) float loopGains[kMaxWaveguideVoices];   // string: per pass
+    alignas(32) float gains[kMaxWaveguideVoices];       // output
+    alignas(32) float breath[kMaxWaveguideVoices];      // tube: pressure, gliding to the target
+    alignas(32) float breathTargets[kMaxWaveguideVoices];
+    alignas(32) float breathRates[kMaxWaveguideVoices]; // per sample
+    alignas(32) Uint32 noise[kMaxWaveguideVoices];      // tube: xorshift state for the breath's turbulence
+    alignas(32) float peaks[kMaxWaveguideVoices];       // loudest output of the last pass
+    alignas(32) float mix[kWaveguideChunk][kWaveguideGroup];   // each lane's sum, per frame
+    int notes[kMaxWaveguideVoices];
+    Uint32 ages[kMaxWaveguideVoices];
+    Uint8 orders[kMaxWaveguideVoices];                  // of each line's arena block
+    Uint8 released[kMaxWaveguideVoices];
+    int activeCount = 0;
+    Uint32 nextAge = 0;
+    int sink;           // where idle lanes read and write: a minimum block nobody else gets
+    WaveguideModel model;
+    float sampleRate;
+
+    WaveguideVoices(WaveguideModel model, float sampleRate);
+
+    // starts a voice at `increment` (cycles per sample). When every voice is busy, or the
+    // arena has no room for its line, the oldest are stolen. Returns its slot
+    int noteOn(int note, double increment, float gain);
+    // a string is damped, a tube stops being blown; either rings out and then retires
+    void noteOff(int note);
+    void allNotesOff();
+    // silences a voice at once, moving the last one into its slot
+    void remove(int slot);
+
+    int renderCount() const { return (activeCount + kWaveguideGroup - 1) / kWaveguideGroup * kWaveguideGroup; }
+
+    static void* operator new(size_t size) { return AlignedAlloc(size, 64); }
+    static void operator delete(void* memory) { AlignedFree(memory); }
+};
+
+// runs voices [begin, end) (multiples of kWaveguideGroup) for `frames` (<= kWaveguideChunk),
+// adding each voice into its lane of `mix` (voice v into lane v % kWaveguideGroup)
+typedef void (*WaveguideKernelFn)(WaveguideVoices& voices, int begin, int end, int frames);
+
+struct WaveguideKernel
+{
+    const char* name;
+    SimdLevel level;
+    WaveguideModel model;
+    WaveguideKernelFn render;
+};
+
+extern const WaveguideKernel waveguideKernels[];
+extern const int waveguideKernelCount;
+
+// the fastest kernel the CPU runs for the model
+const WaveguideKernel& SelectWaveguideKernel(WaveguideModel model);
+
+// adds the active voices into out, then retires the ones that have gone quiet
+void RenderWaveguides(WaveguideVoices& voices, WaveguideKernelFn kernel, float* out, int frames);
@@ -0,0 +1,199 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#include "stdafx.h"
+#include "Wavetable.h"
+#include "ConstMath.h"
+
+#include <math.h>
+#include <string.h>
+
+// harmonic k's amplitude, 0 if the waveform doesn't have it
+static constexpr double HarmonicAmplitude(Waveform waveform, int k)
+{
+    return waveform == WaveSine ? (k == 1 ? 1.0 : 0.0)
+        : waveform == WaveSaw ? (k & 1 ? 2.0 : -2.0) / (kConstPi * k)
+        : waveform == WaveSquare ? (k & 1 ? 4.0 / (kConstPi * k) : 0.0)
+        : 0.0;
+}
+
+static constexpr int ReverseBits(int index)
+{
+    int reversed = 0;
+    for (int bit = 0; bit < kWavetableBits; ++bit) reversed |= ((index >> bit) & 1) << (kWavetableBits - 1 - bit);
+    return reversed;
+}
+
+// out[j] = sum over k = 1 .. harmonics of amplitudes[k] sin(2 pi k j / N): the imaginary
+// part of the inverse DFT of that spectrum, by radix-2 FFT. This runs in the compiler (see
+// ConstMath.h), whose evaluator is a few hundred times slower than compiled code and has a
+// budget of operations; summing every harmonic at every sample, as this used to at startup,
+// would take 100 times more of them than the FFTs do.
+static constexpr void SineSeries(const double* amplitudes, int harmonics, const double* sine, double* out)
+{
+    double re[kWavetableSize] = {};
+    double im[kWavetableSize] = {};
+    for (int k = 1; k <= harmonics; ++k) re[ReverseBits(k)] = amplitudes[k];
+
+    for (int size = 2; size <= kWavetableSize; size *= 2)
+    {
+        int stride = kWavetableSize / size;
+        for (int start = 0; start < kWavetableSize; start += size)
+        {
+            for (int k = 0; k < size / 2; ++k)
+            {
+                // twiddle e^(2 pi i k / size), both parts from the sine table
+                double c = sine[(k * stride + kWavetableSize / 4) & (kWavetableSize - 1)];
+                double s = sine[k * stride];
+                int a = start + k;
+                int b = a + size / 2;
+                double tr = re[b] * c - im[b] * s;
+                double ti = re[b] * s + im[b] * c;
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+    }
+    for (int j = 0; j < kWavetableSize; ++j) out[j] = im[j];
+}
+
+static constexpr Wavetable MakeWavetable(Waveform waveform)
+{
+    double sine[kWavetableSize] = {};
+    for (int j = 0; j < kWavetableSize; ++j) sine[j] = ConstSin(2.0 * kConstPi * j / kWavetableSize);
+
+    double amplitudes[kWavetableSize / 2 + 1] = {};
+    for (int k = 1; k <= kWavetableSize / 2; ++k) amplitudes[k] = HarmonicAmplitude(waveform, k);
+
+    Wavetable table = {};
+    double peak = 0;
+    for (int m = 0; m < kWavetableLevels; ++m)
+    {
+        double level[kWavetableSize] = {};
+        SineSeries(amplitudes, (kWavetableSize / 2) >> m, sine, level);
+        for (int j = 0; j < kWavetableSize; ++j)
+        {
+            table.levels[m][1 + j] = (float)level[j];
+            if (ConstAbs(level[j]) > peak) peak = ConstAbs(level[j]);
+        }
+    }
+
+    // one gain for every level (Gibbs overshoot differs per level, loudness shouldn't jump)
+    float gain = (float)(1.0 / peak);
+    for (int m = 0; m < kWavetableLevels; ++m)
+    {
+        float* data = table.levels[m] + 1;
+        for (int j = 0; j < kWavetableSize; ++j) data[j] *= gain;
+        data[-1] = data[kWavetableSize - 1];
+        for (int j = 0; j < 3; ++j) data[kWavetableSize + j] = data[j];
+    }
+    return table;
+}
+
+// each its own constant expression, so each gets the evaluator's whole budget
+static constexpr Wavetable sineTable = MakeWavetable(WaveSine);
+static constexpr Wavetable sawTable = MakeWavetable(WaveSaw);
+static constexpr Wavetable squareTable = MakeWavetable(WaveSquare);
+
+const Wavetable& GetWavetable(Waveform waveform)
+{
+    return waveform == WaveSaw ? sawTable : waveform == WaveSquare ? squareTable : sineTable;
+}
+
+int WavetableLevel(float increment)
+{
+    // level m is clean while (1024 >> m) * increment <= 0.5, i.e. m >= log2(2048 * increment)
+    int exponent;
+    float mantissa = frexpf(increment * kWavetableSize, &exponent); // value = mantissa * 2^exponent, mantissa in [0.5, 1)
+    int m = mantissa == 0.5f ? exponent - 1 : exponent;
+    return m < 0 ? 0 : (m >= kWavetableLevels ? kWavetableLevels - 1 : m);
+}
+
+const float* RampLevel(const Wavetable& table, PhaseRamp increment, int frames)
+{
+    Uint32 last = increment.start + (Uint32)frames * increment.step;
+    Uint32 fastest = (Sint32)last > (Sint32)increment.start ? last : increment.start;
+    return table.level(WavetableLevel((float)fastest * kPhaseToCycles));
+}
+
+// The table starts at phase -0.5, so the position is phase ^ 0x80000000: its top
+// kWavetableBits bits are the index and the rest the fraction between two entries.
+static const int kFractionBits = 32 - kWavetableBits;
+static const Uint32 kFractionMask = (1u << kFractionBits) - 1;
+static const float kFractionScale = 1.f / (float)(1u << kFractionBits);
+
+static Phase RenderLevelScalar(const float* data, float* out, int frames, Phase phase, PhaseRamp increment, Ramp amplitude)
+{
+    Uint32 inc = increment.start;
+    float amp = amplitude.start;
+    for (int i = 0; i < frames; ++i)
+    {
+        Uint32 position = phase ^ 0x80000000u;
+        Uint32 index = position >> kFractionBits;
+        float frac = (float)(position & kFractionMask) * kFractionScale;
+        out[i] = amp * (data[index] + frac * (data[index + 1] - data[index]));
+        phase += inc;
+        inc += increment.step;
+        amp += amplitude.step;
+    }
+    return phase;
+}
+
+static Phase RenderWavetableScalar(const Wavetable& table, float* out, int frames, Phase phase, PhaseRamp increment, Ramp amplitude)
+{
+    return RenderLevelScalar(RampLevel(table, increment, frames), out, frames, phase, increment, amplitude);
+}
+
+// 8 phases per register like the sine kernels (same lane arithmetic), table reads are AVX2 gathers
+SIMD_TARGET_AVX2 static Phase RenderWavetableAVX2(const Wavetable& table, float* out, int frames, Phase phase, PhaseRamp increment, Ramp amplitude)
+{
+    const float* data = RampLevel(table, increment, frames);
+    PhaseLanes lanes;
+    SpreadPhase(lanes, 8, phase, increment);
+    const __m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i p = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.phase));
+    __m256i advance = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.advance));
+    __m256i advanceStep = _mm256_set1_epi32((int)lanes.advanceStep);
+    __m256 amp = _mm256_fmadd_ps(_mm256_set1_ps(amplitude.step), lane, _mm256_set1_ps(amplitude.start));
+    __m256 ampStep = _mm256_set1_ps(8.f * amplitude.step);
+    __m256i offset = _mm256_set1_epi32((int)0x80000000u);
+    __m256i fractionMask = _mm256_set1_epi32((int)kFractionMask);
+    __m256 fractionScale = _mm256_set1_ps(kFractionScale);
+
+    int i = 0;
+    for (; i + 8 <= frames; i += 8)
+    {
+        __m256i position = _mm256_xor_si256(p, offset);
+        __m256i index = _mm256_srli_epi32(position, kFractionBits);
+        __m256 frac = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(position, fractionMask)), fractionScale);
+        __m256 a = _mm256_i32gather_ps(data, index, 4);
+        __m256 b = _mm256_i32gather_ps(data + 1, index, 4);
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(amp, _mm256_fmadd_ps(frac, _mm256_sub_ps(b, a), a)));
+        p = _mm256_add_epi32(p, advance);
+        advance = _mm256_add_epi32(advance, advanceStep);
+        amp = _mm256_add_ps(amp, ampStep);
+    }
+    if (i > 0) phase = (Phase)_mm_cvtsi128_si32(_mm256_castsi256_si128(p));
+    _mm256_zeroupper();
+    increment.start += (Uint32)i * increment.step;
+    amplitude.start += i * amplitude.step;
+    return RenderLevelScalar(data, out + i, frames - i, phase, increment, amplitude);
+}
+
+const WavetableKernel wavetableKernels[] =
+{
+    { "linear", SimdScalar, RenderWavetableScalar },
+    { "linear-avx2", SimdAVX2, RenderWavetableAVX2 },
+};
+const int wavetableKernelCount = sizeof(wavetableKernels) / sizeof(wavetableKernels[0]);
+
+const WavetableKernel& SelectWavetableKernel()
+{
+    SimdLevel level = DetectSimdLevel();
+    int best = 0;
+    for (int i = 1; i < wavetableKernelCount; ++i)
+        if (wavetableKernels[i].level <= level) best = i;
+    return wavetableKernels[best];
+}
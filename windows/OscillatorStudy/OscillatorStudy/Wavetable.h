@@ -0,0 +1,64 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+#include "Phase.h"
+#include "Simd.h"
+#include "Smoothing.h"
+
+// Band-limited wavetables, one mip level per octave. Level m holds harmonics 1 .. 1024 >> m,
+// so it can be played up to an increment of 0.5 / (1024 >> m) before its top harmonic
+// crosses Nyquist. The tables are computed by the compiler and are constants in the program's
+// read-only data, so any number of voices (and processes) share them: a voice is just a
+// phase, and playing it is a table lookup per sample.
+
+enum Waveform
+{
+    WaveSine,
+    WaveSaw,
+    WaveSquare,
+    WavetableCount,                     // the ones above have a table (the sine's is only for comparison)
+    WaveAnalogSaw = WavetableCount,     // PolyBLEP, computed per sample (PolyBlep.h)
+    WaveAnalogPulse,
+    WaveAnalogTriangle,
+    WaveformCount,
+};
+
+static const int kWavetableBits = 11;
+static const int kWavetableSize = 1 << kWavetableBits;  // 2048
+static const int kWavetableLevels = 11;
+
+struct Wavetable
+{
+    // one guard sample before and three after each level, so interpolation never wraps
+    float levels[kWavetableLevels][kWavetableSize + 4];
+
+    const float* level(int m) const { return levels[m] + 1; }
+};
+
+// a constant, nothing is built at runtime
+const Wavetable& GetWavetable(Waveform waveform);
+
+// mip level that keeps every harmonic below Nyquist at this increment (cycles per sample)
+int WavetableLevel(float increment);
+
+// a ramp can cross an octave boundary mid-block; the level that's clean at its fastest point
+// is clean for all of it
+const float* RampLevel(const Wavetable& table, PhaseRamp increment, int frames);
+
+// same contract as SineKernelFn; the mip level is picked once per call, for the highest
+// increment the ramp reaches
+typedef Phase (*WavetableKernelFn)(const Wavetable& table, float* out, int frames, Phase phase, PhaseRamp increment, Ramp amplitude);
+
+struct WavetableKernel
+{
+    const char* name;
+    SimdLevel level;
+    WavetableKernelFn render;
+};
+
+extern const WavetableKernel wavetableKernels[];
+extern const int wavetableKernelCount;
+
+const WavetableKernel& SelectWavetableKernel();
@@ -0,0 +1,83 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+#include "SDL.h"
+
+#include <atomic>
+#include <vector>
+
+// Chase-Lev work-stealing deque of ints (after Le, Pop, Cohen & Zappa Nardelli's C11 version).
+// The owning thread pushes and pops at the bottom, like a stack, so it keeps working on what
+// it just made ready while that's still in cache; other threads steal from the top. Fixed
+// capacity: it's sized once, off the audio thread, for the most items a job can ever hold,
+// and reset between jobs while nobody is looking at it.
+class WorkDeque
+{
+public:
+    void reserve(int capacity)
+    {
+        int size = 1;
+        while (size < capacity) size *= 2;
+        items = std::vector<std::atomic<int>>(size);
+        mask = size - 1;
+    }
+
+    // only while no thread is using the deque
+    void reset()
+    {
+        top.store(0, std::memory_order_relaxed);
+        bottom.store(0, std::memory_order_relaxed);
+    }
+
+    // owner only
+    void push(int item)
+    {
+        Sint64 b = bottom.load(std::memory_order_relaxed);
+        items[b & mask].store(item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // owner only; -1 when empty
+    int pop()
+    {
+        Sint64 b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        Sint64 t = top.load(std::memory_order_relaxed);
+        if (t > b)
+        {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return -1;
+        }
+        int item = items[b & mask].load(std::memory_order_relaxed);
+        if (t == b)
+        {
+            // the last item: a thief may be after it too
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) item = -1;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // any thread; -1 when empty or when another thread got there first
+    int steal()
+    {
+        Sint64 t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        Sint64 b = bottom.load(std::memory_order_acquire);
+        if (t >= b) return -1;
+        int item = items[t & mask].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) return -1;
+        return item;
+    }
+
+private:
+    std::atomic<Sint64> top { 0 };
+    char padding[64];                   // thieves hammer `top`, the owner `bottom`
+    std::atomic<Sint64> bottom { 0 };
+    std::vector<std::atomic<int>> items;
+    Sint64 mask = 0;
+};
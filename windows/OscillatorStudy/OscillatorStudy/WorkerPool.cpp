@@ -0,0 +1,189 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#include "stdafx.h"
+#include "WorkerPool.h"
+#include "RealtimeGuard.h"
+#include "RealtimeSetup.h"
+#include "Simd.h"
+
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+
+static const Uint64 kCountShift = 16;
+static const Uint64 kTaskMask = 0xFFFF;
+
+// SDL 2.0.8 has no affinity call
+static void PinCurrentThread(int cpu)
+{
+#if defined(_WIN32)
+    SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu);
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)cpu;
+#endif
+}
+
+// claims and runs tasks of the job in `word` until there are none left (or it's been replaced)
+static void WorkOn(WorkerPool& pool, Uint64 word)
+{
+    Uint32 epoch = (Uint32)(word >> 32);
+    for (;;)
+    {
+        int count = (int)((word >> kCountShift) & kTaskMask);
+        int next = (int)(word & kTaskMask);
+        if ((Uint32)(word >> 32) != epoch || next >= count) return;
+        if (!pool.claim.compare_exchange_weak(word, word + 1, memory_order_acquire, memory_order_acquire)) continue;
+        // nothing new goes out before this task is done, even if the callback gives up on it
+        {
+            RealtimeScope realtime;
+            pool.task(pool.context, next);
+        }
+        pool.finished.fetch_add(1, memory_order_release);
+        word = pool.claim.load(memory_order_acquire);
+    }
+}
+
+struct WorkerStart
+{
+    WorkerPool* pool;
+    int cpu;
+};
+
+static int WorkerThread(void* data)
+{
+    WorkerStart start = *reinterpret_cast<WorkerStart*>(data);
+    delete reinterpret_cast<WorkerStart*>(data);
+    WorkerPool& pool = *start.pool;
+    PinCurrentThread(start.cpu);
+    pool.realtimeFlags.fetch_and(PrepareRealtimeThread());
+
+    Uint32 seen = (Uint32)(pool.claim.load() >> 32);
+    int backoff = 1;
+    while (pool.running.load(memory_order_relaxed))
+    {
+        Uint64 word = pool.claim.load(memory_order_acquire);
+        if ((Uint32)(word >> 32) != seen)
+        {
+            seen = (Uint32)(word >> 32);
+            WorkOn(pool, word);
+            backoff = 1;
+            continue;
+        }
+
+        if (SDL_GetPerformanceCounter() - pool.publishedAt.load(memory_order_relaxed) < pool.spinTicks)
+        {
+            for (int i = 0; i < backoff; ++i) _mm_pause();
+            if (backoff < 64) backoff *= 2;
+            continue;
+        }
+
+        // Park. Either RunParallel sees `parked` and posts, or this sees its job and doesn't
+        // wait (both sides are sequentially consistent); a post nobody waited for only costs
+        // one wakeup that finds nothing to do.
+        pool.parked.fetch_add(1);
+        if ((Uint32)(pool.claim.load() >> 32) == seen) SDL_SemWait(pool.wake);
+    }
+    return 0;
+}
+
+void StartWorkers(WorkerPool& pool, int count, double blockSeconds)
+{
+    if (pool.workerCount || pool.wake) return;
+    count = count < 0 ? 0 : (count > kMaxWorkers ? kMaxWorkers : count);
+    if (!count) return;
+    double ticksPerSecond = (double)SDL_GetPerformanceFrequency();
+    pool.spinTicks = (Uint64)(0.25 * blockSeconds * ticksPerSecond);
+    pool.waitTicks = (Uint64)(0.5 * blockSeconds * ticksPerSecond);
+    pool.wake = SDL_CreateSemaphore(0);
+    if (!pool.wake) return;
+    pool.running.store(true);
+    int cpus = SDL_GetCPUCount();
+    for (int w = 0; w < count; ++w)
+    {
+        WorkerStart* start = new WorkerStart;
+        start->pool = &pool;
+        start->cpu = (w + 1) % (cpus > 0 ? cpus : 1);
+        pool.threads[w] = SDL_CreateThread(WorkerThread, "AudioWorker", start);
+        if (!pool.threads[w])
+        {
+            delete start;
+            break;
+        }
+        ++pool.workerCount;
+    }
+}
+
+void StopWorkers(WorkerPool& pool)
+{
+    if (!pool.wake) return;
+    pool.running.store(false);
+    for (int w = 0; w < pool.workerCount; ++w) SDL_SemPost(pool.wake);
+    for (int w = 0; w < pool.workerCount; ++w) SDL_WaitThread(pool.threads[w], nullptr);
+    SDL_DestroySemaphore(pool.wake);
+    pool.wake = nullptr;
+    pool.workerCount = 0;
+}
+
+bool RunParallel(WorkerPool& pool, WorkerTaskFn task, const void* context, size_t contextBytes, int count)
+{
+    if (pool.unfinished) return false; // a late worker is still inside the last job
+    if (pool.workerCount == 0 || count <= 1 || contextBytes > sizeof(pool.context))
+    {
+        for (int i = 0; i < count; ++i) task(const_cast<void*>(context), i);
+        return true;
+    }
+
+    // only this thread ever publishes, and the previous job is fully finished
+    Uint32 epoch = (Uint32)(pool.claim.load(memory_order_relaxed) >> 32) + 1;
+    pool.task = task;
+    memcpy(pool.context, context, contextBytes);
+    pool.finished.store(0, memory_order_relaxed);
+    Uint64 word = (Uint64)epoch << 32 | (Uint64)count << kCountShift;
+    pool.publishedAt.store(SDL_GetPerformanceCounter(), memory_order_relaxed);
+    pool.claim.store(word);
+    if (pool.parked.load() > 0)
+        for (int parked = pool.parked.exchange(0); parked > 0; --parked) SDL_SemPost(pool.wake);
+
+    WorkOn(pool, word);
+
+    // whatever's left was claimed by a worker that is already running it, unless it's been
+    // preempted since: then it could be a whole timeslice, and the device won't wait that long
+    Uint64 deadline = SDL_GetPerformanceCounter() + pool.waitTicks;
+    while (pool.finished.load(memory_order_acquire) < count)
+    {
+        if (pool.waitTicks && SDL_GetPerformanceCounter() > deadline)
+        {
+            pool.unfinished = count;
+            ++pool.lateJobs;
+            return false;
+        }
+        _mm_pause();
+    }
+    return true;
+}
+
+bool JoinWorkers(WorkerPool& pool)
+{
+    if (!pool.unfinished) return true;
+    Uint64 deadline = SDL_GetPerformanceCounter() + pool.waitTicks;
+    while (pool.finished.load(memory_order_acquire) < pool.unfinished)
+    {
+        if (pool.waitTicks && SDL_GetPerformanceCounter() > deadline) return false;
+        _mm_pause();
+    }
+    pool.unfinished = 0;
+    return true;
+}
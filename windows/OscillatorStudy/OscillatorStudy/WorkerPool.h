@@ -0,0 +1,67 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+#include "SDL.h"
+
+#include <atomic>
+
+// Helper threads for the audio callback, each pinned to its own core. One block can hand out
+// several jobs (the voices, then the partials, then again for every segment a parameter
+// change splits off), so after a job a worker spins, with a growing pause, until a quarter
+// of a period has passed since the latest job was published: the rest of the block's jobs
+// are noticed within a few hundred nanoseconds. Then it parks on a semaphore, and the next
+// job posts it, which is one post per parked worker and usually once per block; the core is
+// free for everything else for the rest of the period. A worker woken late simply misses
+// out: jobs are split into tasks that whoever is free claims, and the callback claims them
+// too, so anything a worker hasn't started by then gets rendered inline.
+//
+// A worker that has claimed a task but then gets preempted can't be waited for forever:
+// tasks render in place, so nobody else can take its task over either. The callback waits
+// half a period and then gives up on the job, which counts as an xrun; the late worker
+// finishes on its own, and until JoinWorkers has seen it done nothing else goes out.
+
+static const int kMaxWorkers = 8;
+static const int kWorkerContextBytes = 64;
+
+typedef void (*WorkerTaskFn)(void* context, int task);
+
+struct WorkerPool
+{
+    // the whole job in one word, so claiming a task is one compare-and-swap that can't mix
+    // up two jobs: epoch << 32 | task count << 16 | next task
+    std::atomic<Uint64> claim { 0 };
+    std::atomic<int> finished { 0 };
+    WorkerTaskFn task = nullptr;        // written before `claim` publishes the job
+    alignas(16) char context[kWorkerContextBytes]; // a copy, since a late worker may outlive the caller's
+
+    std::atomic<Uint64> publishedAt { 0 };  // performance counter when the latest job went out
+    std::atomic<int> parked { 0 };      // workers that are (about to be) waiting on `wake`
+    SDL_sem* wake = nullptr;
+
+    std::atomic<bool> running { false };
+    std::atomic<int> realtimeFlags { -1 };  // RealtimeFlags every worker managed
+    SDL_Thread* threads[kMaxWorkers];
+    int workerCount = 0;
+    Uint64 spinTicks = 0;               // how long after a job's publication idle workers spin
+    Uint64 waitTicks = 0;               // how long the callback waits for a late worker; 0 waits it out (benches)
+
+    // audio thread only
+    int unfinished = 0;                 // tasks in the job given up on, until JoinWorkers sees them done
+    Uint32 lateJobs = 0;
+};
+
+// control thread; workers are pinned to cores 1..count (the callback usually lands on 0)
+void StartWorkers(WorkerPool& pool, int count, double blockSeconds);
+void StopWorkers(WorkerPool& pool);
+
+// audio thread: runs task(context, 0 .. count - 1) on the workers and the calling thread,
+// with a copy of the `contextBytes` at `context`, returning true once all have finished.
+// Inline when there are no workers. False when it gave up on a late worker, or one is still
+// at it: the caller must leave everything the job touches alone until JoinWorkers.
+bool RunParallel(WorkerPool& pool, WorkerTaskFn task, const void* context, size_t contextBytes, int count);
+
+// audio thread, before anything a job could touch: true once no late worker is left, after
+// waiting up to `waitTicks` for one
+bool JoinWorkers(WorkerPool& pool);
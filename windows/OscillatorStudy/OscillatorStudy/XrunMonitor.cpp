@@ -0,0 +1,75 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#include "stdafx.h"
+#include "XrunMonitor.h"
+
+using namespace std;
+
+void XrunMonitor::check(const CallbackProfiler& profiler, Uint64 sampleTime, int activeVoices, bool workerLate, bool underrun)
+{
+    Uint32 index = callbacks++;
+    if (profiler.lastBudget == 0) return;
+
+    bool overrun = profiler.lastDuration > profiler.lastBudget;
+    bool late = profiler.lastInterval > profiler.lastBudget * lateThreshold;
+    if (!overrun && !late && !workerLate && !underrun) return;
+
+    xruns.store(xruns.load(memory_order_relaxed) + 1, memory_order_relaxed);
+
+    XrunEvent event;
+    event.kind = underrun ? XrunUnderrun : (workerLate ? XrunWorker : (overrun ? XrunOverrun : XrunLate));
+    event.callback = index;
+    event.sampleTime = sampleTime;
+    event.durationMs = (float)(profiler.lastDuration * ticksToMs);
+    event.intervalMs = (float)(profiler.lastInterval * ticksToMs);
+    event.budgetMs = (float)(profiler.lastBudget * ticksToMs);
+    event.activeVoices = activeVoices;
+    if (!events.push(event)) dropped.store(dropped.load(memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+static void LogEvent(const XrunEvent& event)
+{
+    static const char* const kinds[] = { "overrun", "late", "late worker", "render-ahead underrun" }; // by XrunKind
+    SDL_Log("xrun (%s) at callback %u, sample %llu: took %.2f ms of %.2f ms, %.2f ms after the previous one, %d voices",
+        kinds[event.kind], event.callback, (unsigned long long)event.sampleTime,
+        event.durationMs, event.budgetMs, event.intervalMs, event.activeVoices);
+}
+
+static int LoggerThread(void* data)
+{
+    XrunMonitor* monitor = reinterpret_cast<XrunMonitor*>(data);
+    Uint32 droppedReported = 0;
+    for (bool running = true; running;)
+    {
+        running = monitor->logging.load();  // one more pass after Stop so nothing queued is lost
+        while (const XrunEvent* event = monitor->events.front())
+        {
+            LogEvent(*event);
+            monitor->events.pop();
+        }
+        Uint32 dropped = monitor->dropped.load();
+        if (dropped != droppedReported)
+        {
+            SDL_Log("%u xrun reports were dropped (queue full)", dropped - droppedReported);
+            droppedReported = dropped;
+        }
+        if (running) SDL_Delay(100);
+    }
+    return 0;
+}
+
+void StartXrunLogging(XrunMonitor& monitor)
+{
+    if (monitor.logger) return;
+    monitor.logging.store(true);
+    monitor.logger = SDL_CreateThread(LoggerThread, "XrunLogger", &monitor);
+}
+
+void StopXrunLogging(XrunMonitor& monitor)
+{
+    if (!monitor.logger) return;
+    monitor.logging.store(false);
+    SDL_WaitThread(monitor.logger, nullptr);
+    monitor.logger = nullptr;
+}
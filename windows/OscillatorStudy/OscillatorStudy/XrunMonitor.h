@@ -0,0 +1,61 @@
+﻿// Handmade Audio Workshop
+// Microsoft 2018
+
+#pragma once
+
+#include "SDL.h"
+#include "CallbackProfiler.h"
+#include "SpscQueue.h"
+
+#include <atomic>
+
+// Xrun detection on top of CallbackProfiler's timestamps. A callback counts as an xrun when
+// it ran longer than the audio it produced (overrun: we're too slow), or when it started so
+// long after the previous one that the device must have run dry (late: someone else kept us
+// from running), or when it had to give up on a worker and went out with silence in its place
+// (see WorkerPool). With render-ahead the callback only copies, so those times are the copy's,
+// and a callback that found less than a block in the ring is an underrun. Each xrun is recorded on the audio thread into a lock-free queue and written
+// to the log by a separate, ordinary thread.
+
+enum XrunKind
+{
+    XrunOverrun,
+    XrunLate,
+    XrunWorker,
+    XrunUnderrun,
+};
+
+struct XrunEvent
+{
+    XrunKind kind;
+    Uint32 callback;        // index since the monitor started
+    Uint64 sampleTime;      // engine sample clock at the start of the block
+    float durationMs;
+    float intervalMs;       // since the previous callback started
+    float budgetMs;
+    int activeVoices;
+};
+
+struct XrunMonitor
+{
+    // a callback starting more than this many periods after the previous one is late
+    float lateThreshold = 1.5f;
+
+    // audio thread, right after CallbackProfiler::end()
+    void check(const CallbackProfiler& profiler, Uint64 sampleTime, int activeVoices, bool workerLate = false, bool underrun = false);
+
+    std::atomic<Uint32> xruns { 0 };
+    std::atomic<Uint32> dropped { 0 };      // events that didn't fit in the queue (still counted)
+    SpscQueue<XrunEvent, 256> events;
+
+    // audio thread only
+    Uint32 callbacks = 0;
+    double ticksToMs = 1000.0 / SDL_GetPerformanceFrequency();
+
+    // logger thread
+    std::atomic<bool> logging { false };
+    SDL_Thread* logger = nullptr;
+};
+
+void StartXrunLogging(XrunMonitor& monitor);
+void StopXrunLogging(XrunMonitor& monitor);